@@ -57,7 +57,7 @@ public:
 	/**
 	 * @brief	Default constructor.
 	 */
-	BeamDensity(){ }
+	BeamDensity() : mType(NONE) { }
 
 	/**
 	 * @brief	Prepares images of the given type and resolution.
@@ -101,6 +101,16 @@ public:
 			mData[OVERFULL].resize(0);
 	}
 
+	/**
+	 * @brief	Query if any image is accumulated.
+	 *
+	 * @return	true if statistics are accumulated, false if the type is \c NONE.
+	 */
+	bool IsUsed() const
+	{
+		return mType != NONE;
+	}
+
 	/**
 	 * @brief	Accumulates the given statistics to the image at the given pixel.
 	 *
@@ -169,6 +179,50 @@ public:
 		}
 	}
 
+	/**
+	 * @brief	Accumulates all data of the other \c BeamDensity objects at once.
+	 * 			
+	 * 			Same as calling Accumulate() for each of them, but pixels are processed in parallel.
+	 *
+	 * @param	others	The other \c BeamDensity objects.
+	 */
+	void Accumulate(const std::vector<const BeamDensity*>& others)
+	{
+		if (mType == NONE)
+			return;
+
+		const int count = (int)others.size();
+		for (int j = 0; j < count; j++)
+			UPBP_ASSERT(mResolution.x == others[j]->mResolution.x && mResolution.y == others[j]->mResolution.y && mType == others[j]->mType);
+
+		for (int i = 0; i < ALL; i++)
+		{
+			if (!mData[i].size())
+				continue;
+
+			for (int j = 0; j < count; j++)
+				mContribMax[i] = std::max(mContribMax[i], others[j]->mContribMax[i]);
+
+			float dataMax = mDataMax[i];
+#pragma omp parallel
+			{
+				float threadMax = 0.0f;
+#pragma omp for schedule(static)
+				for (int pixID = 0; pixID < mSize; pixID++)
+				{
+					float sum = mData[i][pixID];
+					for (int j = 0; j < count; j++)
+						sum += others[j]->mData[i][pixID];
+					mData[i][pixID] = sum;
+					threadMax = std::max(threadMax, sum);
+				}
+#pragma omp critical
+				dataMax = std::max(dataMax, threadMax);
+			}
+			mDataMax[i] = dataMax;
+		}
+	}
+
 	/**
 	 * @brief	Outputs accumulated image(s) to a file.
 	 * 			
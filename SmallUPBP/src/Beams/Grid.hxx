@@ -32,6 +32,7 @@
 #include "PhotonBeam.hxx"
 #include "GridStats.hxx"
 #include "..\Path\StaticArray.hxx"
+#include "..\Misc\MemoryBudget.hxx"
 
 /**
  * @brief	A grid for storing photon beams.
@@ -56,7 +57,10 @@ public:
 	 * @param [in,out]	Objects	The objects to store.
 	 */
 	Grid(ObjectHandler & Objects) :
-		mObjects(Objects)
+		mObjects(Objects),
+		mUseAvx(Sse::cpuHasAvx()),
+		mMeanOccupancy(0),
+		mMemory(MemoryBudget::kBeamGrids)
 	{
 	}
 
@@ -254,9 +258,11 @@ public:
 		}*/
 		
 		uint accum = 0;
+		uint occupied = 0;
 		for (Indices::iterator it = mCells.begin(), dup = testDuplicates.begin(), itcheck = test.begin(); it != mCells.end(); ++it, ++itcheck, ++dup)
 		{
 			UPBP_ASSERT(accum + *it >= accum);
+			if (*it) ++occupied;
 			*itcheck = accum;
 			accum += *it;
 			*it = accum;
@@ -265,6 +271,7 @@ public:
 		if (verbose)
 			std::cout << "Beam count " << mObjects.size() << ", Allocating indices: " << accum << std::endl;
 
+		mMeanOccupancy = occupied ? (float)accum / occupied : 0.0f;
 		mPointers.resize(accum);
 		
 		buildloop<Store>(testDuplicates);
@@ -276,6 +283,28 @@ public:
 		}
 
 		reduceBeams(maxBeamsInCell, reductionType, seed);
+
+		if (mUseAvx)
+			storeBeamData();
+
+		// The peak includes the temporary arrays of the build
+		mMemory.Set(memorySize() + (testDuplicates.capacity() + test.capacity()) * sizeof(uint));
+		mMemory.Set(memorySize());
+	}
+
+	/**
+	 * @brief	Gets memory taken by the grid.
+	 *
+	 * @return	The size in bytes.
+	 */
+	size_t memorySize() const
+	{
+		size_t beamData = 0;
+		for (int i = 0; i < BEAM_DATA_COUNT; ++i)
+			beamData += mBeamData[i].capacity();
+
+		return (mCells.capacity() + mClusterRoots.capacity()) * sizeof(uint) + mPointers.capacity() * sizeof(void *) +
+			(mPdfs.capacity() + beamData) * sizeof(float) + mClusters.capacity() * sizeof(Cluster);
 	}
 
 	/**
@@ -359,7 +388,12 @@ public:
 					float cell_mint = t;
 					float cell_maxt = std::min(t + l[minAxis], _maxt);
 					
-					if (_pdf == 1.0f) // No reduction.
+					if (!mClusterRoots.empty() && mClusterRoots[cell] != NO_CLUSTER)
+					{
+						gridStats.intersectedBeams += intersectClustered(mClusterRoots[cell], ray, invDir, mint, maxt, cell_mint, cell_maxt, tmp);
+						gridStats.overfullCells++;
+					}
+					else if (_pdf == 1.0f) // No reduction.
 					{
 						intersectAll(begin, end, ray, mint, maxt, cell_mint, cell_maxt, 1.0f, tmp);
 						gridStats.intersectedBeams += end - begin;
@@ -414,6 +448,17 @@ public:
 		return mPdfs[cell];
 	}
 
+	/**
+	 * @brief	Gets mean number of beams in non-empty cells of the last built grid (before the
+	 * 			reduction).
+	 *
+	 * @return	The mean cell occupancy.
+	 */
+	inline float meanOccupancy() const
+	{
+		return mMeanOccupancy;
+	}
+
 private:
 
 	/**
@@ -431,12 +476,85 @@ private:
 	 */
 	inline void intersectAll(uint begin, uint end, const Ray & ray, float mint, float maxt, const float cellmint, const float cellmaxt, float pdf, void * tmp)
 	{
+		if (mUseAvx)
+		{
+			intersectAll8(begin, end, ray, mint, maxt, cellmint, cellmaxt, pdf, tmp);
+			return;
+		}
+
 		for (uint index = begin; index != end; ++index)
 		{
 			mObjects.intersect(mPointers[index], ray, mint, maxt, cellmint, cellmaxt, pdf, tmp);
 		}
 	}
 
+	/**
+	 * @brief	Intersects all beams inside a cell, rejects them 8 at a time (AVX).
+	 * 			
+	 * 			Beams passing \c PhotonBeam::testIntersectionBeamBeam8() are intersected one by one.
+	 *
+	 * @param	begin	   	Index of the first pointer to a beam of the tested cell in \c mPointers array.
+	 * @param	end		   	Index of the last pointer to a beam of the tested cell in \c mPointers array.
+	 * @param	ray		   	The ray.
+	 * @param	mint	   	Original minimum value of the ray t parameter.
+	 * @param	maxt	   	Original maximum value of the ray t parameter.
+	 * @param	cellmint   	Minimum value of the ray t parameter inside the tested cell.
+	 * @param	cellmaxt   	Maximum value of the ray t parameter inside the tested cell.
+	 * @param	pdf		   	PDF of testing a beam in the tested cell.
+	 * @param [in,out]	tmp	\c AccelStruct::AdditionalRayData.
+	 */
+	inline void intersectAll8(uint begin, uint end, const Ray & ray, float mint, float maxt, const float cellmint, const float cellmaxt, float pdf, void * tmp)
+	{
+		for (uint index = begin; index < end; index += 8)
+		{
+			const Pos8 origins(&mBeamData[ORIGIN_X][index], &mBeamData[ORIGIN_Y][index], &mBeamData[ORIGIN_Z][index]);
+			const Dir8 directions(&mBeamData[DIRECTION_X][index], &mBeamData[DIRECTION_Y][index], &mBeamData[DIRECTION_Z][index]);
+			const Float8 lengths = Float8::loadUnaligned(&mBeamData[LENGTH][index]);
+			const Float8 maxRadiiSqr = Float8::loadUnaligned(&mBeamData[MAX_RADIUS_SQR][index]);
+
+			int mask = PhotonBeam::testIntersectionBeamBeam8(ray.origin, ray.direction, cellmint, cellmaxt, origins, directions, lengths, maxRadiiSqr);
+			if (end - index < 8)
+				mask &= (1 << (end - index)) - 1;
+
+			while (mask)
+			{
+				unsigned long lane;
+				_BitScanForward(&lane, (unsigned long)mask);
+				mask &= mask - 1;
+
+				mObjects.intersect(mPointers[index + lane], ray, mint, maxt, cellmint, cellmaxt, pdf, tmp);
+			}
+		}
+
+		// Avoid AVX-SSE transition penalty in the following SSE code
+		_mm256_zeroupper();
+	}
+
+	/**
+	 * @brief	Copies data of beams used by \c intersectAll8() into SoA arrays in the order of \c mPointers.
+	 * 			
+	 * 			The arrays are padded, so that a batch can be loaded past the last pointer.
+	 */
+	void storeBeamData()
+	{
+		const size_t count = mPointers.size();
+		for (int i = 0; i < BEAM_DATA_COUNT; ++i)
+			mBeamData[i].assign(count + 8, 0.0f);
+
+		for (size_t index = 0; index < count; ++index)
+		{
+			const PhotonBeam * beam = mPointers[index];
+			mBeamData[ORIGIN_X][index] = beam->mRay.origin.x();
+			mBeamData[ORIGIN_Y][index] = beam->mRay.origin.y();
+			mBeamData[ORIGIN_Z][index] = beam->mRay.origin.z();
+			mBeamData[DIRECTION_X][index] = beam->mRay.direction.x();
+			mBeamData[DIRECTION_Y][index] = beam->mRay.direction.y();
+			mBeamData[DIRECTION_Z][index] = beam->mRay.direction.z();
+			mBeamData[LENGTH][index] = beam->mLength;
+			mBeamData[MAX_RADIUS_SQR][index] = beam->mMaxRadiusSqr;
+		}
+	}
+
 	/**
 	 * @brief	Intersects all beams left inside a cell after presampling.
 	 *
@@ -548,6 +666,158 @@ private:
 		}
 	}	
 
+	/**
+	 * @brief	Tests beams of a cell organized in a cluster tree.
+	 * 			
+	 * 			Clusters whose AABB misses the ray inside the cell or whose beams are farther from it
+	 * 			than their radius are skipped. A cluster whose contribution bound for this query (see
+	 * 			\c clusterBound) is at most 1/\c mMaxBeamsInCell of the bound of the whole cell is
+	 * 			replaced by its representative, which is then tested alone with weight cluster power /
+	 * 			representative power. The representative was picked proportionally to power, so the
+	 * 			estimate stays unbiased. Other clusters are refined, leaves reached this way are
+	 * 			tested beam by beam.
+	 *
+	 * @param	root	   	Index of the root cluster of the tested cell in \c mClusters.
+	 * @param	ray		   	The ray.
+	 * @param	invDir	   	Inverse of the ray direction.
+	 * @param	mint	   	Original minimum value of the ray t parameter.
+	 * @param	maxt	   	Original maximum value of the ray t parameter.
+	 * @param	cellmint   	Minimum value of the ray t parameter inside the tested cell.
+	 * @param	cellmaxt   	Maximum value of the ray t parameter inside the tested cell.
+	 * @param [in,out]	tmp	\c AccelStruct::AdditionalRayData.
+	 *
+	 * @return	Number of tested beams.
+	 */
+	inline uint intersectClustered(uint root, const Ray & ray, const Dir & invDir, float mint, float maxt, const float cellmint, const float cellmaxt, void * tmp)
+	{
+		const float rootBound = clusterBound(mClusters[root], ray, invDir, cellmint, cellmaxt);
+		if (rootBound == 0)
+			return 0;
+
+		const float acceptedBound = rootBound / mMaxBeamsInCell;
+		uint tested = 0;
+
+		uint stack[64];
+		int top = 0;
+		stack[top++] = root;
+
+		while (top)
+		{
+			const Cluster & cluster = mClusters[stack[--top]];
+
+			const float bound = clusterBound(cluster, ray, invDir, cellmint, cellmaxt);
+			if (bound == 0)
+				continue;
+
+			if (!cluster.left) // Leaf.
+			{
+				intersectAll(cluster.begin, cluster.end, ray, mint, maxt, cellmint, cellmaxt, 1.0f, tmp);
+				tested += cluster.end - cluster.begin;
+			}
+			else if (bound <= acceptedBound)
+			{
+				mObjects.intersectWeighted(cluster.representative, ray, mint, maxt, cellmint, cellmaxt, 1.0f, cluster.power / beamPower(cluster.representative), tmp);
+				++tested;
+			}
+			else
+			{
+				UPBP_ASSERT(top + 2 <= 64);
+				stack[top++] = cluster.left;
+				stack[top++] = cluster.right;
+			}
+		}
+
+		return tested;
+	}
+
+	/**
+	 * @brief	Gets power of a beam used for building clusters.
+	 *
+	 * @param	beam	The beam.
+	 *
+	 * @return	The power.
+	 */
+	static INLINE float beamPower(const PhotonBeam * beam)
+	{
+		return beam->mThroughputAtOrigin.max();
+	}
+
+	/**
+	 * @brief	Recursively builds a cluster tree over the given beams of a cell.
+	 * 			
+	 * 			Beams are split at the median of centers of their AABBs clipped to the cell along the
+	 * 			axis of the largest extent of the centers. Reorders the pointers in \c mPointers.
+	 *
+	 * @param	begin  	Index of the first pointer to a beam of the cluster in \c mPointers array.
+	 * @param	end	   	Index of the last pointer to a beam of the cluster in \c mPointers array.
+	 * @param	cellBox	AABB of the cell.
+	 *
+	 * @return	Index of the cluster in \c mClusters.
+	 */
+	uint buildClusters(uint begin, uint end, const BoundingBox3 & cellBox)
+	{
+		const uint leafSize = 4;
+
+		Cluster cluster;
+		cluster.begin = begin;
+		cluster.end = end;
+		cluster.left = cluster.right = 0;
+		cluster.power = 0;
+		cluster.minRadius = FLOAT_INFINITY;
+		cluster.maxRadius = 0;
+		BoundingBox3 centers;
+		for (uint index = begin; index != end; ++index)
+		{
+			const PhotonBeam * beam = mPointers[index];
+			const BoundingBox3 box = beam->getAABB().getIntersection(cellBox);
+			cluster.aabb += box;
+			centers += box.getCenter();
+			cluster.power += beamPower(beam);
+
+			// Only axis points within the radius of the cell can contribute to queries inside it.
+			const float maxRadius = std::max(beam->mStartRadius, beam->mEndRadius);
+			const BoundingBox3 reach(cellBox.point1 - Dir(maxRadius), cellBox.point2 + Dir(maxRadius));
+			cluster.core += BoundingBox3(beam->mRay.origin, beam->mRay.target(beam->mLength)).getIntersection(reach);
+			cluster.minRadius = std::min(cluster.minRadius, std::min(beam->mStartRadius, beam->mEndRadius));
+			cluster.maxRadius = std::max(cluster.maxRadius, maxRadius);
+		}
+
+		// Pick a representative proportionally to power.
+		float r = mRng.GetFloat() * cluster.power;
+		cluster.representative = mPointers[begin];
+		for (uint index = begin; index != end; ++index)
+		{
+			const float power = beamPower(mPointers[index]);
+			if (power > 0)
+			{
+				cluster.representative = mPointers[index];
+				if ((r -= power) < 0)
+					break;
+			}
+		}
+
+		const uint node = (uint)mClusters.size();
+		mClusters.push_back(cluster);
+
+		if (end - begin > leafSize)
+		{
+			const int axis = centers.size().argMax();
+			const uint mid = begin + (end - begin) / 2;
+			std::nth_element(mPointers.begin() + begin, mPointers.begin() + mid, mPointers.begin() + end,
+				[&cellBox, axis](const PhotonBeam * a, const PhotonBeam * b)
+			{
+				return a->getAABB().getIntersection(cellBox).getCenter()[axis] < b->getAABB().getIntersection(cellBox).getCenter()[axis];
+			});
+
+			const uint left = buildClusters(begin, mid, cellBox);
+			const uint right = buildClusters(mid, end, cellBox);
+			mClusters[node].left = left;
+			mClusters[node].right = right;
+		}
+
+		return node;
+	}
+
 	/**
 	 * @brief	Reduce number of beams in cells.
 	 *
@@ -618,6 +888,29 @@ private:
 				}
 			}
 		}
+		else if (mReductionType == CLUSTER)
+		{
+			mClusters.clear();
+			mClusterRoots.assign(cells, (uint)NO_CLUSTER);
+			for (size_t i = 0; i < cells; i++)
+			{
+				mPdfs[i] = 1.0f;
+
+				const uint begin = mCells[i];
+				const uint end = mCells[i + 1];
+				if (end - begin <= mMaxBeamsInCell)
+					continue;
+
+				// Cell AABB slightly enlarged not to cull beams touching its faces.
+				const int x = (int)(i % mRes[0]);
+				const int y = (int)((i / mRes[0]) % mRes[1]);
+				const int z = (int)(i / (mRes[0] * mRes[1]));
+				const Pos cellMin = mAABB.point1 + Dir((float)x, (float)y, (float)z) * mCellSize;
+				const BoundingBox3 cellBox = BoundingBox3(cellMin, cellMin + mCellSize).getEpsilonEnlarged(1e-4f);
+
+				mClusterRoots[i] = buildClusters(begin, end, cellBox);
+			}
+		}
 		else
 		{
 			for (size_t i = 0; i < cells; i++)
@@ -640,10 +933,83 @@ private:
 	 */
 	typedef std::vector<float> Pdfs;
 
+	/**
+	 * @brief	A node of a cluster tree of beams in a cell.
+	 */
+	struct Cluster
+	{
+		BoundingBox3 aabb;                  //!< AABB of the beams clipped to the cell.
+		BoundingBox3 core;                  //!< AABB of the beam axes within the beam radius of the cell.
+		float power;                        //!< Sum of powers of the beams.
+		float minRadius;                    //!< Minimum radius of the beams.
+		float maxRadius;                    //!< Maximum radius of the beams.
+		uint begin;                         //!< Index of the first pointer to a beam of the cluster in \c mPointers array.
+		uint end;                           //!< Index of the last pointer to a beam of the cluster in \c mPointers array.
+		uint left;                          //!< Index of the left child in \c mClusters, 0 for a leaf.
+		uint right;                         //!< Index of the right child in \c mClusters, 0 for a leaf.
+		const PhotonBeam * representative;  //!< Beam picked proportionally to power to represent the cluster.
+	};
+
+	/**
+	 * @brief	Defines an alias representing the cluster trees.
+	 */
+	typedef std::vector<Cluster> Clusters;
+
+	enum { NO_CLUSTER = 0xFFFFFFFF }; //!< Root index of cells tested beam by beam.
+
+	/**
+	 * @brief	Components of beams stored in SoA arrays for \c intersectAll8().
+	 */
+	enum BeamData { ORIGIN_X, ORIGIN_Y, ORIGIN_Z, DIRECTION_X, DIRECTION_Y, DIRECTION_Z, LENGTH, MAX_RADIUS_SQR, BEAM_DATA_COUNT };
+
+	/**
+	 * @brief	Bounds contribution of beams of a cluster to the query ray inside the tested cell.
+	 * 			
+	 * 			Beam axes lie in the core AABB of the cluster, so no point of the ray segment inside
+	 * 			the cluster AABB is closer to them than the largest gap between the segment and the
+	 * 			core along a single axis. The bound is cluster power times the kernel maximum over
+	 * 			beam radii at that distance. It ignores the sine and attenuation terms of the estimate,
+	 * 			so it serves only to compare clusters of the same cell.
+	 *
+	 * @param	cluster	   	The cluster.
+	 * @param	ray		   	The ray.
+	 * @param	invDir	   	Inverse of the ray direction.
+	 * @param	cellmint   	Minimum value of the ray t parameter inside the tested cell.
+	 * @param	cellmaxt   	Maximum value of the ray t parameter inside the tested cell.
+	 *
+	 * @return	The bound, 0 if beams of the cluster cannot contribute.
+	 */
+	static INLINE float clusterBound(const Cluster & cluster, const Ray & ray, const Dir & invDir, const float cellmint, const float cellmaxt)
+	{
+		float t0, t1;
+		if (cluster.power == 0 || !cluster.aabb.intersect(ray, invDir, t0, t1) || t1 < cellmint || t0 > cellmaxt)
+			return 0;
+
+		const Pos start = ray.target(std::max(t0, cellmint));
+		const Pos end = ray.target(std::min(t1, cellmaxt));
+		float gap = 0;
+		for (int i = 0; i < 3; ++i)
+		{
+			const float lo = std::min(start[i], end[i]);
+			const float hi = std::max(start[i], end[i]);
+			gap = std::max(gap, std::max(cluster.core.point1[i] - hi, lo - cluster.core.point2[i]));
+		}
+
+		if (gap >= cluster.maxRadius)
+			return 0;
+
+		// Maximum of the kernel 3 / (4 r) * (1 - d^2 / r^2) for radii and distances of the cluster.
+		return cluster.power * 0.75f / cluster.minRadius * (1 - gap * gap / (cluster.maxRadius * cluster.maxRadius));
+	}
+
 	ObjectHandler & mObjects;     //!< The beams.
 	Indices mCells;               //!< For each cell contains index of a pointer to its first beam in \c mPointers array.
 	Pointers mPointers;           //!< The pointers to beams.
 	Pdfs mPdfs;                   //!< The PDFs of intersecting beams in cells.
+	Clusters mClusters;           //!< Cluster trees of cells with more than \c mMaxBeamsInCell beams (\c CLUSTER reduction only).
+	Indices mClusterRoots;        //!< For each cell index of its root cluster in \c mClusters or \c NO_CLUSTER.
+	std::vector<float> mBeamData[BEAM_DATA_COUNT]; //!< Components of beams in \c mPointers order (AVX only).
+	bool mUseAvx;                 //!< Whether beams in cells are rejected 8 at a time.
 	uint mRes[3];                 //!< Grid resolution.
 	uint mIndexShift[3];	      //!< The index shift.
 	uint mMaxBeamsInCell;         //!< The maximum number of tested beams in a single cell.
@@ -651,6 +1017,8 @@ private:
 	Dir mCellSize;                //!< Size of a cell.
 	Dir mInvCellSize;             //!< Inverse of the size of a cell.
 	BoundingBox3 mAABB;           //!< Axis aligned bounding box of the beams.
+	float mMeanOccupancy;         //!< Mean number of beams in non-empty cells (before the reduction).
+	MemoryBudget::Tracker mMemory; //!< Reported memory of the grid.
 	Rng mRng;                     //!< Random number generator for sampling beams during reduction.
 };
 #endif
\ No newline at end of file
@@ -27,6 +27,9 @@
 #include "PhBeams.hxx"
 #include "..\Misc\Timer.hxx"
 #include "..\Misc\KdTmpl.hxx"
+#include "..\Misc\MemoryBudget.hxx"
+#include "..\Misc\QueryTruncation.hxx"
+#include "..\Misc\EstimatorTuner.hxx"
 
 #ifdef USE_BRUTE
 #include "PhBrute.hxx"
@@ -74,6 +77,7 @@ void PhotonBeamsEvaluator::build(PhotonBeamsArray & beams,
 	UPBP_ASSERT(accelStruct == nullptr);
 	UPBP_ASSERT( !beams.empty() );
 
+	MemoryBudget::Tracker knnMemory(MemoryBudget::kKnnTrees);
 	KdTree * tree;
 	KdTree::CKNNQuery * query;
 	if (radiusCalculation == KNN_RADIUS)
@@ -85,6 +89,7 @@ void PhotonBeamsEvaluator::build(PhotonBeamsArray & beams,
 			tree->AddItem((Pos *)(&beams[i].mRay.origin), i);
 		}
 		tree->BuildUp();
+		knnMemory.Set(tree->GetMemorySize());
 		query = new KdTree::CKNNQuery(knn);
 	}
 
@@ -120,6 +125,7 @@ void PhotonBeamsEvaluator::build(PhotonBeamsArray & beams,
 	{
 		delete query;
 		delete tree;
+		knnMemory.Set(0);
 	}
 
 	Timer timer;
@@ -129,8 +135,8 @@ void PhotonBeamsEvaluator::build(PhotonBeamsArray & beams,
 	accelStruct = new AccelStruct();
 	UPBP_ASSERT(accelStruct != nullptr);
 #ifdef USE_GRID
-	accelStruct->setGridSize(sGridSize);
-	accelStruct->setMaxBeamsInCell(sMaxBeamsInCell);
+	accelStruct->setGridSize(mGridSize);
+	accelStruct->setMaxBeamsInCell(mMaxBeamsInCell);
 	accelStruct->setReductionType(sReductionType);
 	accelStruct->setSeed(mSeed);
 #endif
@@ -193,6 +199,8 @@ Rgb PhotonBeamsEvaluator::evalBeamBeamEstimate(
 	float raySampleRevPdf = 1.0f;
 	GridStats _gridStats;
 	if (!gridStats) gridStats = &_gridStats;
+	QueryTruncation * truncation = (beamType == LONG_BEAM && additionalRayDataForMis) ? static_cast<QueryTruncation*>(additionalRayDataForMis->mQueryTruncation) : NULL;
+	EstimatorTuner * tuner = additionalRayDataForMis ? static_cast<EstimatorTuner*>(additionalRayDataForMis->mEstimatorTuner) : NULL;
 
 	/// Accumulate for each segment
 	for (VolumeSegments::const_iterator it = segments.begin(); it != segments.end(); ++it)
@@ -200,9 +208,19 @@ Rgb PhotonBeamsEvaluator::evalBeamBeamEstimate(
 		// Get segment medium
 		const AbstractMedium * medium = scene.mMedia[it->mMediumID];
 		
+		// Decide how far the segment is traversed
+		float distMax = it->mDistMax;
+		float truncationWeight = 1.0f;
+		if (truncation)
+		{
+			truncationWeight = truncation->BeginSegment(attenuation, medium, it->mDistMin, distMax, *additionalRayDataForMis);
+			if (truncationWeight == 0)
+				break;
+		}
+
 		// Accumulate
 		Rgb segmentResult(0);
-		if (medium->HasScattering())
+		if (medium->HasScattering() && (!tuner || (tuner->MediumTechniques(medium) & BB1D)))
 		{
 			if (additionalRayDataForMis)
 			{
@@ -212,18 +230,23 @@ Rgb PhotonBeamsEvaluator::evalBeamBeamEstimate(
 				if (it == segments.begin())
 					additionalRayDataForMis->mRaySamplingFlags |= raySamplingFlags;
 			}
-			segmentResult = accelStruct->evalBeamBeamEstimate(queryRay, beamType | estimatorTechniques, medium, it->mDistMin, it->mDistMax, *gridStats, additionalRayDataForMis);
+			if (tuner && tuner->IsCollecting()) tuner->StartQuery();
+			segmentResult = accelStruct->evalBeamBeamEstimate(queryRay, beamType | estimatorTechniques, medium, it->mDistMin, distMax, *gridStats, additionalRayDataForMis);
+			if (tuner && tuner->IsCollecting()) tuner->EndQuery(medium, BB1D, attenuation * truncationWeight * segmentResult);
 		}
 		// Add to total result
-		result += attenuation * segmentResult;
+		result += attenuation * truncationWeight * segmentResult;
 
-		if (additionalRayDataForMis)
+		if (additionalRayDataForMis && additionalRayDataForMis->mDebugImages)
 		{
 			DebugImages & debugImages = *static_cast<DebugImages *>(additionalRayDataForMis->mDebugImages);
-			debugImages.accumRgb2ToRgb(DebugImages::BB1D, attenuation);
+			debugImages.accumRgb2ToRgb(DebugImages::BB1D, attenuation * truncationWeight);
 			debugImages.ResetAccum2();
 		}
 
+		if (truncation && !truncation->EndSegment(*additionalRayDataForMis))
+			break;
+
 		// Update attenuation
 		attenuation *= beamType == SHORT_BEAM ? it->mAttenuation / it->mRaySamplePdf :  // Short beams - no attenuation
 			it->mAttenuation;
@@ -274,6 +297,8 @@ Rgb PhotonBeamsEvaluator::evalBeamBeamEstimate(
 	float raySampleRevPdf = 1.0f;
 	GridStats _gridStats;
 	if (!gridStats) gridStats = &_gridStats;
+	QueryTruncation * truncation = (beamType == LONG_BEAM && additionalRayDataForMis) ? static_cast<QueryTruncation*>(additionalRayDataForMis->mQueryTruncation) : NULL;
+	EstimatorTuner * tuner = additionalRayDataForMis ? static_cast<EstimatorTuner*>(additionalRayDataForMis->mEstimatorTuner) : NULL;
 
 	/// Accumulate for each segment
 	for (LiteVolumeSegments::const_iterator it = segments.begin(); it != segments.end(); ++it)
@@ -281,9 +306,19 @@ Rgb PhotonBeamsEvaluator::evalBeamBeamEstimate(
 		// Get segment medium
 		const AbstractMedium * medium = scene.mMedia[it->mMediumID];
 
+		// Decide how far the segment is traversed
+		float distMax = it->mDistMax;
+		float truncationWeight = 1.0f;
+		if (truncation)
+		{
+			truncationWeight = truncation->BeginSegment(attenuation, medium, it->mDistMin, distMax, *additionalRayDataForMis);
+			if (truncationWeight == 0)
+				break;
+		}
+
 		// Accumulate
 		Rgb segmentResult(0);
-		if (medium->HasScattering())
+		if (medium->HasScattering() && (!tuner || (tuner->MediumTechniques(medium) & BB1D)))
 		{
 			if (additionalRayDataForMis)
 			{
@@ -293,19 +328,24 @@ Rgb PhotonBeamsEvaluator::evalBeamBeamEstimate(
 				if (it == segments.begin())
 					additionalRayDataForMis->mRaySamplingFlags |= raySamplingFlags;
 			}
-			segmentResult = accelStruct->evalBeamBeamEstimate(queryRay, beamType | estimatorTechniques, medium, it->mDistMin, it->mDistMax, *gridStats, additionalRayDataForMis);
+			if (tuner && tuner->IsCollecting()) tuner->StartQuery();
+			segmentResult = accelStruct->evalBeamBeamEstimate(queryRay, beamType | estimatorTechniques, medium, it->mDistMin, distMax, *gridStats, additionalRayDataForMis);
+			if (tuner && tuner->IsCollecting()) tuner->EndQuery(medium, BB1D, attenuation * truncationWeight * segmentResult);
 		}
 
 		// Add to total result
-		result += attenuation * segmentResult;
+		result += attenuation * truncationWeight * segmentResult;
 
-		if (additionalRayDataForMis)
+		if (additionalRayDataForMis && additionalRayDataForMis->mDebugImages)
 		{
 			DebugImages & debugImages = *static_cast<DebugImages *>(additionalRayDataForMis->mDebugImages);
-			debugImages.accumRgb2ToRgb(DebugImages::BB1D, attenuation);
+			debugImages.accumRgb2ToRgb(DebugImages::BB1D, attenuation * truncationWeight);
 			debugImages.ResetAccum2();
 		}
 
+		if (truncation && !truncation->EndSegment(*additionalRayDataForMis))
+			break;
+
 		// Update attenuation
 		attenuation *= medium->EvalAttenuation(queryRay, it->mDistMin, it->mDistMax);
 		if (!attenuation.isPositive())
@@ -336,4 +376,18 @@ Rgb PhotonBeamsEvaluator::evalBeamBeamEstimate(
 float PhotonBeamsEvaluator::getBeamSelectionPdf(const Pos & pos) const
 {
 	return accelStruct->getBeamSelectionPdf(pos);
+}
+
+/**
+ * @brief	Gets mean number of beams in non-empty cells of the built structure (grid only).
+ *
+ * @return	The mean cell occupancy, 0 if not available.
+ */
+float PhotonBeamsEvaluator::getMeanCellOccupancy() const
+{
+#ifdef USE_GRID
+	return accelStruct ? accelStruct->getMeanCellOccupancy() : 0.0f;
+#else
+	return 0.0f;
+#endif
 }
\ No newline at end of file
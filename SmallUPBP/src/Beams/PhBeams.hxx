@@ -53,7 +53,7 @@ public:
 	 * @param	aScene	The scene the beams are located in (needed for access to media).
 	 */
 	PhotonBeamsEvaluator(const Scene& aScene)
-		: scene(aScene), mSeed(1234)
+		: scene(aScene), mSeed(1234), mGridSize(sGridSize), mMaxBeamsInCell(sMaxBeamsInCell)
 	{
 		accelStruct = nullptr;
 	}
@@ -148,11 +148,20 @@ public:
 	 */
 	float getBeamSelectionPdf(const Pos & pos) const;
 
+	/**
+	 * @brief	Gets mean number of beams in non-empty cells of the built structure (grid only).
+	 *
+	 * @return	The mean cell occupancy, 0 if not available.
+	 */
+	float getMeanCellOccupancy() const;
+
 	static uint sGridSize;       //!< Size of the grid.
 	static uint sMaxBeamsInCell; //!< Maximum number of tested beams in a single cell.
 	static uint sReductionType;  //!< Type of the reduction of numbers of tested beams in cells.	
 	
 	int mSeed; //!< Seed for sampling beams during the reduction.
+	uint mGridSize;       //!< Size of the grid of this evaluator, initialized from \c sGridSize.
+	uint mMaxBeamsInCell; //!< Maximum number of tested beams in a single cell of this evaluator, initialized from \c sMaxBeamsInCell.
 
 private:
 	const Scene& scene;        //!< Reference to the scene for material evaluation.
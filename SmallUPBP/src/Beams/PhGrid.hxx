@@ -129,6 +129,18 @@ public:
 		return Grid::pdf(pos);
 	}
 
+	/**
+	 * @brief	Gets mean number of beams in non-empty grid cells.
+	 * 			
+	 * 			Only calls \c Grid::meanOccupancy().
+	 *
+	 * @return	The mean cell occupancy.
+	 */
+	inline float getMeanCellOccupancy() const
+	{
+		return Grid::meanOccupancy();
+	}
+
 	/**
 	 * @brief	Compute the AABB of a beam (only used during tree construction).
 	 *
@@ -196,6 +208,38 @@ public:
 		return false;
 	}
 
+	/**
+	 * @brief	Intersects a single beam representing a cluster of beams found in the grid.
+	 * 			
+	 * 			Same as \c intersect() except that the contribution is multiplied by the given weight.
+	 * 			The weight does not enter the PDF, so MIS weights stay the same as for the beam
+	 * 			tested on its own.
+	 *
+	 * @param	beamptr	   	Pointer to the beam.
+	 * @param	ray		   	The query ray.
+	 * @param	mint	   	Original minimum value of the ray t parameter.
+	 * @param	maxt	   	Original maximum value of the ray t parameter.
+	 * @param	cellmint   	Minimum value of the ray t parameter inside the tested cell.
+	 * @param	cellmaxt   	Maximum value of the ray t parameter inside the tested cell.
+	 * @param	pdf		   	PDF of testing a beam in the tested cell.
+	 * @param	weight	   	Weight of the contribution.
+	 * @param [in,out]	tmp	\c AccelStruct::AdditionalRayData.
+	 *
+	 * @return	always false, not used
+	 */
+	inline bool intersectWeighted(const void *beamptr, const Ray &ray,
+		const float mint, const float maxt, const float cellmint, const float cellmaxt, const float pdf, const float weight, void *tmp) const 
+	{
+		AdditionalRayData * rayData = static_cast<AdditionalRayData *>(tmp);
+		const PhotonBeam & beam = *static_cast<const PhotonBeam *>(beamptr);
+		
+		Rgb result(0);
+		beam.accumulate(ray, mint, maxt, cellmint, cellmaxt, pdf, result, rayData->flags, rayData->medium, rayData->additionalDataForMis);
+		rayData->accumResult += weight * result;
+		
+		return false;
+	}
+
 	/**
 	 * @brief	Returns a pointer to a beam at the specified index.
 	 *
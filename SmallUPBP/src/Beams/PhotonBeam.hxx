@@ -32,7 +32,9 @@
 #include "common\ray.h"
 #include "..\Misc\Debugimages.hxx"
 #include "..\Structs\BoundingBox.hxx"
+#include "..\Structs\Vector8.hxx"
 #include "..\Path\PathWeight.hxx"
+#include "..\Misc\EstimatorTuner.hxx"
 
 /**
  * @brief	Photon beam.
@@ -51,7 +53,7 @@ struct PhotonBeam
 	float   mLastPdfWInv;           //!< Direction sampling PDF of the generating ray.
 	bool    mIsFirstSegment;        //!< Whether this beam corresponds to the first volume segment on the generating ray.
 	const AbstractMedium * mMedium;	//!< Medium in which beam resides.
-	UPBPLightVertex* mLightVertex;  //!< Light vertex at the origin of the generating ray.
+	int     mLightVertexIdx;        //!< Index of the light vertex at the origin of the generating ray in the light vertex array.
 	
 	// Filled by PhotonBeamsEvaluator:
 
@@ -295,6 +297,59 @@ struct PhotonBeam
 		return true; // Found an intersection.
 	}
 
+	/**
+	 * @brief	Conservative test of a query ray against 8 photon beams at once (AVX).
+	 * 			
+	 * 			Batch version of the rejections of \c testIntersectionBeamBeam() (distance of the lines
+	 * 			and ranges of the closest points on both of them) with a small slack, so that it never
+	 * 			rejects a beam the exact test would accept. Beams with set bits are then tested by
+	 * 			\c testIntersectionBeamBeam(). Photon beam segments start at t = 0.
+	 *
+	 * @param	O1				 	Query ray origin.
+	 * @param	d1				 	Query ray direction.
+	 * @param	minT1			 	Query ray minimum t.
+	 * @param	maxT1			 	Query ray maximum t.
+	 * @param	O2				 	Photon beam origins.
+	 * @param	d2				 	Photon beam directions.
+	 * @param	maxT2			 	Photon beam lengths.
+	 * @param	maxDistSqr		 	Maximum distances squared.
+	 *
+	 * @return	8 bit mask, i-th bit is set if the i-th beam may intersect the query ray.
+	 */
+	static INLINE int testIntersectionBeamBeam8(
+		const Pos& O1,
+		const Dir& d1,
+		const float minT1,
+		const float maxT1,
+		const Pos8& O2,
+		const Dir8& d2,
+		const Float8& maxT2,
+		const Float8& maxDistSqr)
+	{
+		const Dir8 d1v(d1);
+		const Dir8 d1d2c = d1v.cross(d2);
+		const Float8 sinThetaSqr = d1d2c.square();
+
+		const Dir8 O1O2 = Pos8(O1) - O2;
+		const Float8 ad = O1O2.dot(d1d2c);
+
+		// Lines too far apart.
+		const Bool8 close = ad * ad < maxDistSqr * sinThetaSqr * 1.001f;
+
+		// Closest points, parallel lines give infinite or NaN parameters failing the comparisons.
+		const Float8 d1d2 = d2.dot(d1v);
+		const Float8 d1w = O1O2.dot(d1v);
+		const Float8 t1 = (d1w - d1d2 * O1O2.dot(d2)) / (d1d2 * d1d2 - 1.0f);
+		const Float8 t2 = (t1 + d1w) / d1d2;
+
+		const float slack1 = 1e-3f * (maxT1 - minT1);
+		const Float8 slack2 = maxT2 * 1e-3f;
+		const Bool8 inRange1 = (t1 > Float8(minT1 - slack1)) && (t1 < Float8(maxT1 + slack1));
+		const Bool8 inRange2 = (t2 > -slack2) && (t2 < maxT2 + slack2);
+
+		return (close && inRange1 && inRange2).mask();
+	}
+
 	/**
 	 * @brief	Accumulates photon beam contribution to ray with given [mint,maxt] and flags,
 	 * 			accumulation is stored to \c accumResult.
@@ -390,8 +445,11 @@ struct PhotonBeam
 		if (mMedium == medium && testIntersectionBeamBeam(ray.origin, ray.direction, isectmint, isectmaxt, mRay.origin,
 			mRay.direction, 0, mLength, mMaxRadiusSqr, beamBeamDistance, sinTheta, queryIsectDist, beamIsectDist))
 		{
-			UPBP_ASSERT(mLightVertex);
+			UPBP_ASSERT(mLightVertexIdx >= 0);
 			UPBP_ASSERT(additionalDataForMis);
+
+			// Vertices are referenced by index, the array may grow and reallocate while beams are added
+			UPBPLightVertex *lightVertex = &(*static_cast<std::vector<UPBPLightVertex>*>(additionalDataForMis->mLightVertices))[mLightVertexIdx];
 			UPBP_ASSERT(queryIsectDist);
 			UPBP_ASSERT(beamIsectDist);
 
@@ -399,8 +457,8 @@ struct PhotonBeam
 			UPBP_ASSERT(medium->IsHomogeneous());
 
 			// Reject if full path length below/above min/max path length.
-			if ((mLightVertex->mPathLength + 1 + additionalDataForMis->mCameraPathLength > additionalDataForMis->mMaxPathLength) ||
-				(mLightVertex->mPathLength + 1 + additionalDataForMis->mCameraPathLength < additionalDataForMis->mMinPathLength))
+			if ((lightVertex->mPathLength + 1 + additionalDataForMis->mCameraPathLength > additionalDataForMis->mMaxPathLength) ||
+				(lightVertex->mPathLength + 1 + additionalDataForMis->mCameraPathLength < additionalDataForMis->mMinPathLength))
 			return;
 
 			// Ignore contribution of primary rays from medium too close to camera.
@@ -499,6 +557,7 @@ struct PhotonBeam
 			const float distSqQuery = Utils::sqr(queryIsectDist);
 			const float raySamplePdfInvQuery = 1.0f / raySamplePdfQuery;
 			MisData* cameraVerticesMisData = static_cast<MisData*>(additionalDataForMis->mCameraVerticesMisData);
+			const uint mediumTechniques = additionalDataForMis->mEstimatorTuner ? static_cast<const EstimatorTuner*>(additionalDataForMis->mEstimatorTuner)->MediumTechniques(medium) : (PP3D | PB2D | BB1D);
 			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mPdfAInv = additionalDataForMis->mLastPdfWInv * distSqQuery * raySamplePdfInvQuery;
 			//cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mRevPdfA = 1.0f; // not used (sent through AccumulateCameraPathWeight params)
 			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mRaySamplePdfInv = raySamplePdfInvQuery;
@@ -507,8 +566,8 @@ struct PhotonBeam
 			//cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mRaySampleRevPdfsRatio = raySamplePdfsRatioBeam; // not used (sent through AccumulateCameraPathWeight params)
 			//cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mSinTheta = sinTheta; // not used (sent through AccumulateCameraPathWeight params)
 			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mSurfMisWeightFactor = 0;
-			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mPP3DMisWeightFactor = additionalDataForMis->mPP3DMisWeightFactor;
-			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mPB2DMisWeightFactor = additionalDataForMis->mPB2DMisWeightFactor; 
+			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mPP3DMisWeightFactor = (mediumTechniques & PP3D) ? additionalDataForMis->mPP3DMisWeightFactor : 0;
+			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mPB2DMisWeightFactor = (mediumTechniques & PB2D) ? additionalDataForMis->mPB2DMisWeightFactor : 0; 
 			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mBB1DMisWeightFactor = additionalDataForMis->mBB1DMisWeightFactor;
 			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mBB1DBeamSelectionPdf = beamSelectionPdf;
 			cameraVerticesMisData[additionalDataForMis->mCameraPathLength].mIsDelta = false;
@@ -521,7 +580,7 @@ struct PhotonBeam
 			cameraVerticesMisData[additionalDataForMis->mCameraPathLength - 1].mRaySampleRevPdfInv = 1.0f / raySampleRevPdfQuery;
 
 			// Update affected MIS data for beam.
-			const float distSqBeam = mLightVertex->mIsFinite ? Utils::sqr(beamIsectDist) : 1.0f;
+			const float distSqBeam = lightVertex->mIsFinite ? Utils::sqr(beamIsectDist) : 1.0f;
 			const float raySamplePdfInvBeam = 1.0f / raySamplePdfBeam;
 			MisData beamLightVertexMisData;
 			beamLightVertexMisData.mPdfAInv = mLastPdfWInv * distSqBeam * raySamplePdfInvBeam;
@@ -533,8 +592,8 @@ struct PhotonBeam
 			//beamLightVertexMisData.mRaySampleRevPdfsRatio = raySamplePdfsRatioQuery; // not used (sent through AccumulatePathWeight params)
 			//beamLightVertexMisData.mSinTheta = sinTheta; // not used (sent through AccumulateLightPathWeight params)
 			beamLightVertexMisData.mSurfMisWeightFactor = 0;
-			beamLightVertexMisData.mPP3DMisWeightFactor = additionalDataForMis->mPP3DMisWeightFactor;
-			beamLightVertexMisData.mPB2DMisWeightFactor = additionalDataForMis->mPB2DMisWeightFactor;
+			beamLightVertexMisData.mPP3DMisWeightFactor = (mediumTechniques & PP3D) ? additionalDataForMis->mPP3DMisWeightFactor : 0;
+			beamLightVertexMisData.mPB2DMisWeightFactor = (mediumTechniques & PB2D) ? additionalDataForMis->mPB2DMisWeightFactor : 0;
 			beamLightVertexMisData.mBB1DMisWeightFactor = additionalDataForMis->mBB1DMisWeightFactor;
 			beamLightVertexMisData.mBB1DBeamSelectionPdf = beamSelectionPdf;
 			beamLightVertexMisData.mIsDelta = false;
@@ -543,10 +602,10 @@ struct PhotonBeam
 			beamLightVertexMisData.mInMediumWithBeams = true;
 
 			// Update reverse PDFs of the previous light vertex.
-			//mLightVertex->mMisData.mRevPdfA *= raySampleRevPdfBeam / distSq; // done directly in AccumulateLightPathWeight params in order not to spoil the original data (it is not assignement but multiplication!)
-			//mLightVertex->mMisData.mRevPdfAWithoutBsdf = mLightVertex->mMisData.mRevPdfA; // not used
-			const float originRaySampleRevPdfInvBackup = mLightVertex->mMisData.mRaySampleRevPdfInv;
-			mLightVertex->mMisData.mRaySampleRevPdfInv = 1.0f / raySampleRevPdfBeam;
+			//lightVertex->mMisData.mRevPdfA *= raySampleRevPdfBeam / distSq; // done directly in AccumulateLightPathWeight params in order not to spoil the original data (it is not assignement but multiplication!)
+			//lightVertex->mMisData.mRevPdfAWithoutBsdf = lightVertex->mMisData.mRevPdfA; // not used
+			const float originRaySampleRevPdfInvBackup = lightVertex->mMisData.mRaySampleRevPdfInv;
+			lightVertex->mMisData.mRaySampleRevPdfInv = 1.0f / raySampleRevPdfBeam;
 
 			if (rayFlags & NO_SINE_IN_WEIGHTS)
 				sinTheta = 1.0;
@@ -574,13 +633,13 @@ struct PhotonBeam
 				rayFlags, 
 				cameraVerticesMisData);
 			const float wLight = AccumulateLightPathWeight(
-				mLightVertex->mPathIdx, 
-				mLightVertex->mPathLength + 1, 
+				lightVertex->mPathIdx, 
+				lightVertex->mPathLength + 1, 
 				last, 
 				0, 
 				0, 
 				0, 
-				(mLightVertex->mMisData.mIsOnLightSource && mLightVertex->mMisData.mIsDelta) ? 0 : bsdfDirPdfW * raySampleRevPdfBeam * std::abs(mLightVertex->mMisData.mCosThetaOut) / distSqBeam, 
+				(lightVertex->mMisData.mIsOnLightSource && lightVertex->mMisData.mIsDelta) ? 0 : bsdfDirPdfW * raySampleRevPdfBeam * std::abs(lightVertex->mMisData.mCosThetaOut) / distSqBeam, 
 				BB1D, 
 				additionalDataForMis->mQueryBeamType, 
 				additionalDataForMis->mPhotonBeamType, 
@@ -588,21 +647,26 @@ struct PhotonBeam
 				false,
 				static_cast<std::vector<int>*>(additionalDataForMis->mPathEnds), 
 				static_cast<std::vector<UPBPLightVertex>*>(additionalDataForMis->mLightVertices),
-				&beamLightVertexMisData);
+				&beamLightVertexMisData,
+				static_cast<std::vector<int>*>(additionalDataForMis->mPathVertexIndices));
 			const float misWeight = 1.f / (wLight + wCamera);
 
 			// Restore modified value of the previous light vertex.
-			mLightVertex->mMisData.mRaySampleRevPdfInv = originRaySampleRevPdfInvBackup;
+			lightVertex->mMisData.mRaySampleRevPdfInv = originRaySampleRevPdfInvBackup;
 
 			// Weight and accumulate result.
 			accumResult +=
 				misWeight *
+				additionalDataForMis->truncationWeight(queryIsectDist) *
 				unweightedResult;
 
 			UPBP_ASSERT(!accumResult.isNanInfNeg());
 
-			DebugImages & debugImages = *static_cast<DebugImages *>(additionalDataForMis->mDebugImages);
-			debugImages.accumRgb2Weight(mLightVertex->mPathLength + 1, DebugImages::BB1D, unweightedResult, misWeight);
+			if (additionalDataForMis->mDebugImages)
+			{
+				DebugImages & debugImages = *static_cast<DebugImages *>(additionalDataForMis->mDebugImages);
+				debugImages.accumRgb2Weight(lightVertex->mPathLength + 1, DebugImages::BB1D, unweightedResult, misWeight);
+			}
 		}
 	}
 };
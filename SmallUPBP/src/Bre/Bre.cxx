@@ -32,7 +32,10 @@
 #include "..\Beams\PhBeams.hxx"
 #include "..\Misc\Timer.hxx"
 #include "..\Misc\KdTmpl.hxx"
+#include "..\Misc\MemoryBudget.hxx"
 #include "..\Misc\DebugImages.hxx"
+#include "..\Misc\QueryTruncation.hxx"
+#include "..\Misc\EstimatorTuner.hxx"
 #include "..\Path\PathWeight.hxx"
 #include "..\Structs\BoundingBox.hxx"
 
@@ -42,6 +45,7 @@
 typedef KdTreeTmplPtr< Pos,Pos > KdTree;
 
 const float MAX_FLOAT_SQUARE_ROOT = std::sqrtf(std::numeric_limits< float >::max());	//!< The maximum float square root
+const size_t kBvhBytesPerPhoton = 64; //!< Estimated memory of embree's BVH per photon (allocated inside embree)
 
 // ----------------------------------------------------------------------------------------------
 
@@ -381,6 +385,7 @@ public:
 
 			// Unweighted result.
 			const Rgb unweightedResult = lightVertex->mThroughput *
+				lightVertex->mMergeWeight *
 				attenuation *
 				scatteringCoeff *
 				cameraBsdfFactor *
@@ -393,6 +398,7 @@ public:
 			const float distSq = Utils::sqr(photonIsectDist);
 			const float raySamplePdfInv = 1.0f / raySamplePdf;
 			MisData* cameraVerticesMisData = static_cast<MisData*>(data->mCameraVerticesMisData);
+			const uint mediumTechniques = data->mEstimatorTuner ? static_cast<const EstimatorTuner*>(data->mEstimatorTuner)->MediumTechniques(ray.medium) : (PP3D | PB2D | BB1D);
 			cameraVerticesMisData[data->mCameraPathLength].mPdfAInv = data->mLastPdfWInv * distSq * raySamplePdfInv;
 			//cameraVerticesMisData[data->mCameraPathLength].mRevPdfA = 1.0f; // not used (sent through AccumulateCameraPathWeight params)
 			cameraVerticesMisData[data->mCameraPathLength].mRaySamplePdfInv = raySamplePdfInv;
@@ -401,14 +407,14 @@ public:
 			//cameraVerticesMisData[data->mCameraPathLength].mRaySampleRevPdfsRatio = lightVertex->mMisData.mRaySamplePdfsRatio; // not used (sent through AccumulateCameraPathWeight params)
 			//cameraVerticesMisData[data->mCameraPathLength].mSinTheta = sinTheta; // not used (sent through AccumulateCameraPathWeight params)
 			cameraVerticesMisData[data->mCameraPathLength].mSurfMisWeightFactor = 0;
-			cameraVerticesMisData[data->mCameraPathLength].mPP3DMisWeightFactor = data->mPP3DMisWeightFactor;
+			cameraVerticesMisData[data->mCameraPathLength].mPP3DMisWeightFactor = (mediumTechniques & PP3D) ? data->mPP3DMisWeightFactor : 0;
 			cameraVerticesMisData[data->mCameraPathLength].mPB2DMisWeightFactor = data->mPB2DMisWeightFactor; //data->mLightSubPathCount / kernel;
 			cameraVerticesMisData[data->mCameraPathLength].mBB1DMisWeightFactor = data->mBB1DMisWeightFactor;
 			if (!data->mBB1DPhotonBeams) cameraVerticesMisData[data->mCameraPathLength].mBB1DBeamSelectionPdf = 0.0f;
 			else
 			{
 				PhotonBeamsEvaluator* pbe = static_cast<PhotonBeamsEvaluator*>(data->mBB1DPhotonBeams);
-				if (pbe->sMaxBeamsInCell) 
+				if (pbe->mMaxBeamsInCell) 
 					cameraVerticesMisData[data->mCameraPathLength].mBB1DBeamSelectionPdf = pbe->getBeamSelectionPdf(isectPt);
 				else
 					cameraVerticesMisData[data->mCameraPathLength].mBB1DBeamSelectionPdf = 1.0f;								
@@ -416,7 +422,7 @@ public:
 			cameraVerticesMisData[data->mCameraPathLength].mIsDelta = false;
 			cameraVerticesMisData[data->mCameraPathLength].mIsOnLightSource = false;
 			cameraVerticesMisData[data->mCameraPathLength].mIsSpecular = false;
-			cameraVerticesMisData[data->mCameraPathLength].mInMediumWithBeams = ray.medium->GetMeanFreePath(isectPt) > data->mBB1DMinMFP;
+			cameraVerticesMisData[data->mCameraPathLength].mInMediumWithBeams = (mediumTechniques & BB1D) && ray.medium->GetMeanFreePath(isectPt) > data->mBB1DMinMFP;
 
 			// Update reverse PDFs of the previous vertex.
 			cameraVerticesMisData[data->mCameraPathLength - 1].mRaySampleRevPdfInv = 1.0f / raySampleRevPdf;
@@ -450,16 +456,22 @@ public:
 				ray.flags,
 				false,
 				static_cast<std::vector<int>*>(data->mPathEnds), 
-				static_cast<std::vector<UPBPLightVertex>*>(data->mLightVertices));
+				static_cast<std::vector<UPBPLightVertex>*>(data->mLightVertices),
+				NULL,
+				static_cast<std::vector<int>*>(data->mPathVertexIndices));
 			const float misWeight = 1.f / (wLight + wCamera);			
 
 			// Weight and accumulate contribution.
 			*static_cast<Rgb*>(ray.accumResult) +=
 				misWeight *
+				data->truncationWeight(photonIsectDist) *
 				unweightedResult;
 
-			DebugImages & debugImages = *static_cast<DebugImages *>(data->mDebugImages);
-			debugImages.accumRgb2Weight(lightVertex->mPathLength, DebugImages::PB2D, unweightedResult, misWeight);
+			if (data->mDebugImages)
+			{
+				DebugImages & debugImages = *static_cast<DebugImages *>(data->mDebugImages);
+				debugImages.accumRgb2Weight(lightVertex->mPathLength, DebugImages::PB2D, unweightedResult, misWeight);
+			}
 		}
 	}
 
@@ -559,6 +571,7 @@ int EmbreeBre::build(const VltLightVertex* lightSubPathVertices, const int numVe
 	UPBP_ASSERT( embreePhotons != nullptr );
 
 	
+	MemoryBudget::Tracker knnMemory(MemoryBudget::kKnnTrees);
 	KdTree * tree;
 	KdTree::CKNNQuery * query;
 	if (radiusCalculation == KNN_RADIUS)
@@ -573,6 +586,7 @@ int EmbreeBre::build(const VltLightVertex* lightSubPathVertices, const int numVe
 			}
 		}
 		tree->BuildUp();
+		knnMemory.Set(tree->GetMemorySize());
 		query = new KdTree::CKNNQuery(knn);
 	}
 	// Convert path vertices to embree photons.
@@ -599,6 +613,7 @@ int EmbreeBre::build(const VltLightVertex* lightSubPathVertices, const int numVe
 	{
 		delete query;
 		delete tree;
+		knnMemory.Set(0);
 	}
 	UPBP_ASSERT( inMediumIdx == numVerticesInMedium );
 
@@ -613,6 +628,7 @@ int EmbreeBre::build(const VltLightVertex* lightSubPathVertices, const int numVe
 
 	// Retrieve the intersectable interface for this data structure.
 	embreeIntersector = embree::rtcQueryIntersector1 ( embreeGeo, "default" );
+	mMemory.Set(numVerticesInMedium * (sizeof(EmbreePhoton) + kBvhBytesPerPhoton));
 
 	UPBP_ASSERT( embreeIntersector != nullptr );
 
@@ -661,7 +677,7 @@ int EmbreeBre::build(const UPBPLightVertex* lightSubPathVertices, const int numV
 	int numVerticesInMedium = 0;
 	for (int i = 0; i<numVertices; i++)
 	{
-		if (lightSubPathVertices[i].mInMedium)
+		if (lightSubPathVertices[i].mInMedium && lightSubPathVertices[i].mMergeWeight > 0)
 			numVerticesInMedium++;
 	}
 
@@ -682,6 +698,7 @@ int EmbreeBre::build(const UPBPLightVertex* lightSubPathVertices, const int numV
 	UPBP_ASSERT(embreePhotons != nullptr);
 
 
+	MemoryBudget::Tracker knnMemory(MemoryBudget::kKnnTrees);
 	KdTree * tree;
 	KdTree::CKNNQuery * query;
 	if (radiusCalculation == KNN_RADIUS)
@@ -690,19 +707,20 @@ int EmbreeBre::build(const UPBPLightVertex* lightSubPathVertices, const int numV
 		tree->Reserve(numVerticesInMedium);
 		for (int i = 0; i < numVertices; i++)
 		{
-			if (lightSubPathVertices[i].mInMedium)
+			if (lightSubPathVertices[i].mInMedium && lightSubPathVertices[i].mMergeWeight > 0)
 			{
 				tree->AddItem((Pos *)(&lightSubPathVertices[i].mHitpoint), i);
 			}
 		}
 		tree->BuildUp();
+		knnMemory.Set(tree->GetMemorySize());
 		query = new KdTree::CKNNQuery(knn);
 	}
 	// Convert path vertices to embree photons.
 	int inMediumIdx = 0;
 	for (int i = 0; i<numVertices; i++)
 	{
-		if (lightSubPathVertices[i].mInMedium)
+		if (lightSubPathVertices[i].mInMedium && lightSubPathVertices[i].mMergeWeight > 0)
 		{
 			const UPBPLightVertex& v = lightSubPathVertices[i];
 			float radius = photonRadius;
@@ -722,6 +740,7 @@ int EmbreeBre::build(const UPBPLightVertex* lightSubPathVertices, const int numV
 	{
 		delete query;
 		delete tree;
+		knnMemory.Set(0);
 	}
 	UPBP_ASSERT(inMediumIdx == numVerticesInMedium);
 
@@ -736,6 +755,7 @@ int EmbreeBre::build(const UPBPLightVertex* lightSubPathVertices, const int numV
 
 	// Retrieve the intersectable interface for this data structure.
 	embreeIntersector = embree::rtcQueryIntersector1(embreeGeo, "default");
+	mMemory.Set(numVerticesInMedium * (sizeof(EmbreePhoton) + kBvhBytesPerPhoton));
 
 	UPBP_ASSERT(embreeIntersector != nullptr);
 
@@ -774,6 +794,7 @@ void EmbreeBre::destroy( )
 	numEmbreePhotons = 0;
 	embreeGeo = nullptr;
 	embreeIntersector = nullptr;
+	mMemory.Set(0);
 }
 
 // ----------------------------------------------------------------------------------------------
@@ -828,6 +849,8 @@ Rgb EmbreeBre::evalBre(
 	Rgb attenuation(1);
 	float raySamplePdf = 1.0f;
 	float raySampleRevPdf = 1.0f;
+	QueryTruncation * truncation = (beamType == LONG_BEAM && additionalRayDataForMis) ? static_cast<QueryTruncation*>(additionalRayDataForMis->mQueryTruncation) : NULL;
+	EstimatorTuner * tuner = additionalRayDataForMis ? static_cast<EstimatorTuner*>(additionalRayDataForMis->mEstimatorTuner) : NULL;
 
 	/// Accumulate for each segment.
 	for (VolumeSegments::const_iterator it = segments.begin(); it != segments.end(); ++it)
@@ -835,9 +858,19 @@ Rgb EmbreeBre::evalBre(
 		// Get segment medium.
 		const AbstractMedium * medium = scene.mMedia[it->mMediumID];
 
+		// Decide how far the segment is traversed.
+		float distMax = it->mDistMax;
+		float truncationWeight = 1.0f;
+		if (truncation)
+		{
+			truncationWeight = truncation->BeginSegment(attenuation, medium, it->mDistMin, distMax, *additionalRayDataForMis);
+			if (truncationWeight == 0)
+				break;
+		}
+
 		// Accumulate.
 		Rgb segmentResult(0);
-		if (medium->HasScattering())
+		if (medium->HasScattering() && (!tuner || (tuner->MediumTechniques(medium) & PB2D)))
 		{
 			if (additionalRayDataForMis)
 			{
@@ -847,21 +880,26 @@ Rgb EmbreeBre::evalBre(
 				if (it == segments.begin())
 					additionalRayDataForMis->mRaySamplingFlags |= raySamplingFlags;
 			}
-			embree::Ray embreeRay(toEmbreeV3f(queryRay.origin), toEmbreeV3f(queryRay.direction), it->mDistMin, it->mDistMax);
+			embree::Ray embreeRay(toEmbreeV3f(queryRay.origin), toEmbreeV3f(queryRay.direction), it->mDistMin, distMax);
 			embreeRay.setAdditionalData(medium, &segmentResult, beamType | estimatorTechniques, &queryRay, additionalRayDataForMis);
+			if (tuner && tuner->IsCollecting()) tuner->StartQuery();
 			embreeIntersector->intersect(embreeRay);
+			if (tuner && tuner->IsCollecting()) tuner->EndQuery(medium, PB2D, attenuation * truncationWeight * segmentResult);
 		}
 
 		// Add to total result.
-		result += attenuation * segmentResult;
+		result += attenuation * truncationWeight * segmentResult;
 
-		if (additionalRayDataForMis)
+		if (additionalRayDataForMis && additionalRayDataForMis->mDebugImages)
 		{
 			DebugImages & debugImages = *static_cast<DebugImages *>(additionalRayDataForMis->mDebugImages);
-			debugImages.accumRgb2ToRgb(DebugImages::PB2D, attenuation);
+			debugImages.accumRgb2ToRgb(DebugImages::PB2D, attenuation * truncationWeight);
 			debugImages.ResetAccum2();
 		}
 
+		if (truncation && !truncation->EndSegment(*additionalRayDataForMis))
+			break;
+
 		// Update attenuation.
 		attenuation *= beamType == SHORT_BEAM ? it->mAttenuation / it->mRaySamplePdf :  // Short beams - no attenuation
 			it->mAttenuation;
@@ -912,6 +950,8 @@ Rgb EmbreeBre::evalBre(
 	Rgb attenuation(1);
 	float raySamplePdf = 1.0f;
 	float raySampleRevPdf = 1.0f;
+	QueryTruncation * truncation = (beamType == LONG_BEAM && additionalRayDataForMis) ? static_cast<QueryTruncation*>(additionalRayDataForMis->mQueryTruncation) : NULL;
+	EstimatorTuner * tuner = additionalRayDataForMis ? static_cast<EstimatorTuner*>(additionalRayDataForMis->mEstimatorTuner) : NULL;
 	
 	/// Accumulate for each segment.
 	for (LiteVolumeSegments::const_iterator it = segments.begin(); it != segments.end(); ++it)
@@ -919,9 +959,19 @@ Rgb EmbreeBre::evalBre(
 		// Get segment medium.
 		const AbstractMedium * medium = scene.mMedia[it->mMediumID];
 		
+		// Decide how far the segment is traversed.
+		float distMax = it->mDistMax;
+		float truncationWeight = 1.0f;
+		if (truncation)
+		{
+			truncationWeight = truncation->BeginSegment(attenuation, medium, it->mDistMin, distMax, *additionalRayDataForMis);
+			if (truncationWeight == 0)
+				break;
+		}
+
 		// Accumulate.
 		Rgb segmentResult(0);
-		if (medium->HasScattering())
+		if (medium->HasScattering() && (!tuner || (tuner->MediumTechniques(medium) & PB2D)))
 		{
 			if (additionalRayDataForMis)
 			{
@@ -931,21 +981,26 @@ Rgb EmbreeBre::evalBre(
 				if (it == segments.begin())
 					additionalRayDataForMis->mRaySamplingFlags |= raySamplingFlags;
 			}
-			embree::Ray embreeRay(toEmbreeV3f(queryRay.origin), toEmbreeV3f(queryRay.direction), it->mDistMin, it->mDistMax);			
+			embree::Ray embreeRay(toEmbreeV3f(queryRay.origin), toEmbreeV3f(queryRay.direction), it->mDistMin, distMax);			
 			embreeRay.setAdditionalData(medium, &segmentResult, beamType | estimatorTechniques, &queryRay, additionalRayDataForMis);
+			if (tuner && tuner->IsCollecting()) tuner->StartQuery();
 			embreeIntersector->intersect(embreeRay);
+			if (tuner && tuner->IsCollecting()) tuner->EndQuery(medium, PB2D, attenuation * truncationWeight * segmentResult);
 		}
 		
 		// Add to total result.
-		result += attenuation * segmentResult;
+		result += attenuation * truncationWeight * segmentResult;
 
-		if (additionalRayDataForMis)
+		if (additionalRayDataForMis && additionalRayDataForMis->mDebugImages)
 		{
 			DebugImages & debugImages = *static_cast<DebugImages *>(additionalRayDataForMis->mDebugImages);
-			debugImages.accumRgb2ToRgb(DebugImages::PB2D, attenuation);
+			debugImages.accumRgb2ToRgb(DebugImages::PB2D, attenuation * truncationWeight);
 			debugImages.ResetAccum2();
 		}
 
+		if (truncation && !truncation->EndSegment(*additionalRayDataForMis))
+			break;
+
 		// Update attenuation.
 		attenuation *= medium->EvalAttenuation(queryRay, it->mDistMin, it->mDistMax);
 		if (!attenuation.isPositive())
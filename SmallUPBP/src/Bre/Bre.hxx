@@ -29,6 +29,7 @@
 
 #include "..\Path\VltPathVertex.hxx"
 #include "..\Path\UPBPLightVertex.hxx"
+#include "..\Misc\MemoryBudget.hxx"
 #include "include\embree.h"
 #include "common\ray.h"
 
@@ -47,7 +48,7 @@ public:
 	 * @param	aScene	The scene.
 	 */
 	EmbreeBre(const Scene& aScene)
-		: scene (aScene)
+		: scene (aScene), mMemory(MemoryBudget::kPB2DTrees)
 	{
 		embreePhotons = nullptr;
 		numEmbreePhotons = 0;
@@ -181,6 +182,7 @@ protected:
 	int numEmbreePhotons;                       //!< Number of elements in the embreePhotons array.
 	embree::RTCGeometry* embreeGeo;             //!< Embree's data structure storing the photon spheres.
 	embree::RTCIntersector1* embreeIntersector; //!< Embree's intersector associated with the acceleration data structure.
+	MemoryBudget::Tracker mMemory;              //!< Reported memory of the photons and (estimated) embree's data structure.
 };
 
 
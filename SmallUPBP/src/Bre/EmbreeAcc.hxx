@@ -48,6 +48,20 @@ public:
 		embree::rtcStartThreads(0); 
 	}
 
+	/**
+	 * @brief	Restarts embree with the given number of threads used when building the data structure.
+	 *			
+	 *			Builds of per-iteration structures are invoked from all render threads at once, so the
+	 *			builder threads would otherwise compete with the render threads for the same cores.
+	 *
+	 * @param	aNumThreads	Number of threads (0 means use all threads).
+	 */
+	static void setBuildThreads(int aNumThreads)
+	{
+		embree::rtcStopThreads();
+		embree::rtcStartThreads(aNumThreads);
+	}
+
 	/**
 	 * @brief	To be called once after the last use of embree.
 	 */
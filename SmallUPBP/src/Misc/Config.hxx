@@ -43,6 +43,8 @@
 #include "..\Renderers\VolLightTracer.hxx"
 #include "..\Renderers\VolPathTracer.hxx"
 #include "..\Renderers\UPBP.hxx"
+#include "..\Renderers\PipelinedRenderer.hxx"
+#include "FastMathTest.hxx"
 
 /**
  * @brief	Renderer configuration, holds algorithm, scene, and all other settings.
@@ -173,6 +175,7 @@ struct Config
 	Vec2i       mResolution; //!< Resolution of the rendered image.
 
 	Framebuffer *mFramebuffer; //!< Framebuffer that accumulates result of rendering iterations.
+	mutable std::vector<Framebuffer> mViewFramebuffers; //!< Accumulated results of additional views of the scene (multi-view rendering).
 	
 	uint mMaxPathLength; //!< Maximum length of constructed paths.
 	uint mMinPathLength; //!< Minimum length of constructed paths.
@@ -187,6 +190,7 @@ struct Config
 	
 	float mRefPathCountPerIter; //!< Reference number of paths traced from lights per iteration. 
 	float mPathCountPerIter;    //!< Number of paths traced from lights per iteration.
+	int   mCameraPassCount;     //!< Number of camera passes per light pass (and structures build) in one iteration.
 
 	BeamType mQueryBeamType;  //!< Used type of query beams.
 	BeamType mPhotonBeamType; //!< Used type of photon beams.	
@@ -214,11 +218,26 @@ struct Config
 	int					mContinuousOutput;   //!< Value x > 0 means generating one image per x iterations.
 	mutable DebugImages mDebugImages;        //!< For creating debug images.
 	std::string         mEnvMapFilePath;	 //!< Full pathname of the environment map file specified on the command line using the -em option.
-	size_t				mMaxMemoryPerThread; //!< Maximum memory for light vertices in thread.
+	size_t				mMaxMemoryPerThread; //!< Memory reserved for light vertices and beams in thread (approximate, the arrays grow beyond it if needed, beams refer to vertices by index).
+	size_t              mMemoryBudget;       //!< Memory for the whole render, fitted by scaling threads, light paths and grid resolution (0 means no budget).
 	float               mMinDistToMed;       //!< Minimum distance from camera at which scattering events in media can occur.
 	bool                mShowTime;           //!< Whether to append duration of the rendering to the name of the output image file.	
+	bool                mNumaAware;          //!< Whether to pin render threads to NUMA nodes and allocate their data on the local node.
+	int                 mEmbreeThreads;      //!< Number of threads embree uses for building (0 means all threads, negative means automatic).
+	bool                mPipelineIterations; //!< Whether to trace light sub-paths of the next iteration during the camera pass of the current one (upbp only).
+	bool                mConcurrentBuilds;   //!< Whether to build independent per-iteration acceleration structures concurrently (upbp only).
+	bool                mSortLightData;      //!< Whether to reorder light vertices and beams along the Morton curve after light tracing (upbp only).
+	float               mQueryCullSurvivalProb; //!< Probability of keeping photons and beams in regions not queried by the previous camera pass (0 means no culling, upbp only).
+	float               mQueryTruncationThreshold; //!< Attenuation below which BB1D and PB2D query traversal continues by Russian roulette (0 means no truncation, upbp only).
+	int                 mTunerIterations;    //!< Number of iterations measuring volumetric techniques before selecting them per medium (0 means no selection, upbp only).
+	float               mTargetTimeRatio;    //!< Target ratio of light to camera pass times steering paths per iteration (0 means fixed, upbp only).
+	float               mTargetCellOccupancy; //!< Target mean number of beams in non-empty grid cells steering grid resolution (0 means fixed, upbp only).
 	
 	bool				mIgnoreFullySpecPaths; //!< Flag for upbp only, its sets it to ignore fully specular paths from camera.	
+	float               mRRThreshold;          //!< Relative throughput below which throughput based Russian roulette starts (0 means disabled).
+	int                 mLvcConnections;       //!< Number of connections of each camera vertex to the light vertex cache in vbpt and upbp (0 means connecting to own light path).
+	int                 mLvcCandidates;        //!< Number of candidates for resampled selection of each connection to the light vertex cache (only 1, MIS weights assume uniform selection).
+	float               mShadowCullThreshold;  //!< Fraction of the largest connection of a vertex below which connections are culled by Russian roulette before tracing shadow rays.
 };
 
 /**
@@ -230,16 +249,22 @@ struct Config
  * @param	aConfig  	The configuration for the renderer.
  * @param	aSeed	 	Thread specific seed. Used by all renderers but \c UPBP.
  * @param	aBaseSeed	Global seed. Used by \c UPBP only.
+ * @param	aLightPathCounter	Light passes shared by all renderers of a render. Used by \c UPBP only, \c NULL for own one.
  *
  * @return	New renderer that corresponds to settings in the given \c aConfig.
  */
 AbstractRenderer* CreateRenderer(
     const Config& aConfig,
     const int     aSeed,
-	const int     aBaseSeed)
+	const int     aBaseSeed,
+	LightPathCounter* aLightPathCounter = NULL)
 {
     const Scene& scene = *aConfig.mScene;
 
+	// Path count and grid resolution planned by the memory budget limit the iteration tuner
+	const float tunerMaxPathCount = aConfig.mMemoryBudget ? aConfig.mPathCountPerIter : 0.f;
+	const uint  tunerMaxGridSize = aConfig.mMemoryBudget ? aConfig.mGridResolution : 0;
+
     switch(aConfig.mAlgorithm)
     {
     case Config::kEyeLight:
@@ -248,19 +273,19 @@ AbstractRenderer* CreateRenderer(
         return new PathTracer(scene, aSeed);
     case Config::kLightTracing:
         return new VertexCM(scene, VertexCM::kLightTrace,
-            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aSeed);
+            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mShadowCullThreshold, aSeed);
     case Config::kProgressivePhotonMapping:
         return new VertexCM(scene, VertexCM::kPpm,
-            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aSeed);
+            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mShadowCullThreshold, aSeed);
     case Config::kBidirectionalPhotonMapping:
         return new VertexCM(scene, VertexCM::kBpm,
-            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aSeed);
+            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mShadowCullThreshold, aSeed);
     case Config::kBidirectionalPathTracing:
         return new VertexCM(scene, VertexCM::kBpt,
-            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aSeed);
+            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mShadowCullThreshold, aSeed);
     case Config::kVertexConnectionMerging:
         return new VertexCM(scene, VertexCM::kVcm,
-            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aSeed);
+            aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mShadowCullThreshold, aSeed);
 	case Config::kVolumetricPathTracingDirect:
 		return new VolPathTracer(scene, aSeed, VolPathTracer::kDirect);
 	case Config::kVolumetricPathTracingLight:
@@ -271,69 +296,105 @@ AbstractRenderer* CreateRenderer(
 		return new VolPathTracer(scene, aSeed, VolPathTracer::kSpecOnly);
 	case Config::kVolumetricLightTracing:
 		return new VolLightTracer(scene, aSeed, VolLightTracer::kLightTracer, aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mRefPathCountPerIter);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter);
 	case Config::kPointBeam2D:
 		return new VolLightTracer(scene, aSeed, VolLightTracer::kPointBeam2D, aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mRefPathCountPerIter);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter);
 	case Config::kBeamBeam1D:
 		return new VolLightTracer(scene, aSeed, VolLightTracer::kBeamBeam1D, aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mRefPathCountPerIter);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter);
 	case Config::kVolumetricLightTracingFromVBPT:
-		return new VolBidirPT(scene, VolBidirPT::kLT, aSeed);
+		return new VolBidirPT(scene, VolBidirPT::kLT, aConfig.mPathCountPerIter, aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold, aSeed);
 	case Config::kVolumetricPathTracingDirectFromVBPT:
-		return new VolBidirPT(scene, VolBidirPT::kPTdir, aSeed);
+		return new VolBidirPT(scene, VolBidirPT::kPTdir, aConfig.mPathCountPerIter, aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold, aSeed);
 	case Config::kVolumetricPathTracingLightFromVBPT:
-		return new VolBidirPT(scene, VolBidirPT::kPTls, aSeed);
+		return new VolBidirPT(scene, VolBidirPT::kPTls, aConfig.mPathCountPerIter, aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold, aSeed);
 	case Config::kVolumetricPathTracingMISFromVBPT:
-		return new VolBidirPT(scene, VolBidirPT::kPTmis, aSeed);
+		return new VolBidirPT(scene, VolBidirPT::kPTmis, aConfig.mPathCountPerIter, aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold, aSeed);
 	case Config::kVolumetricBidirPathTracing:
-		return new VolBidirPT(scene, VolBidirPT::kBPT, aSeed);
+		return new VolBidirPT(scene, VolBidirPT::kBPT, aConfig.mPathCountPerIter, aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold, aSeed);
 	case Config::kVolumetricLightTracingFromUPBP:
 		return new UPBP(scene, UPBP::kLT, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kVolumetricPathTracingDirectFromUPBP:
 		return new UPBP(scene, UPBP::kPTdir, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kVolumetricPathTracingLightFromUPBP:
 		return new UPBP(scene, UPBP::kPTls, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kVolumetricPathTracingMISFromUPBP:
 		return new UPBP(scene, UPBP::kPTmis, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kVolumetricBidirPathTracingFromUPBP:
 		return new UPBP(scene, UPBP::kBPT, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kProgressivePhotonMappingFromUPBP:
 		return new UPBP(scene, UPBP::kPPM, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kBidirectionalPhotonMappingFromUPBP:
 		return new UPBP(scene, UPBP::kBPM, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kVolumetricVertexConnectionMergingFromUPBP:
 		return new UPBP(scene, UPBP::kVCM, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	case Config::kUPBPCustom:
 	case Config::kUPBPAll:
 		return new UPBP(scene, UPBP::kCustom, aConfig.mAlgorithmFlags, aConfig.mSurfRadiusInitial, aConfig.mSurfRadiusAlpha, aConfig.mPP3DRadiusInitial, aConfig.mPP3DRadiusAlpha,
 			aConfig.mPB2DRadiusInitial, aConfig.mPB2DRadiusAlpha, aConfig.mPB2DRadiusCalculation, aConfig.mPB2DRadiusKNN, aConfig.mQueryBeamType,
-			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter,
-			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread, aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths);
+			aConfig.mBB1DRadiusInitial, aConfig.mBB1DRadiusAlpha, aConfig.mBB1DRadiusCalculation, aConfig.mBB1DRadiusKNN, aConfig.mPhotonBeamType, aConfig.mBB1DUsedLightSubPathCount, aConfig.mBB1DBeamStorageFactor, aConfig.mRefPathCountPerIter, aConfig.mPathCountPerIter, aConfig.mCameraPassCount,
+			aConfig.mMinDistToMed, aConfig.mMaxMemoryPerThread,
+			aConfig.mRRThreshold, aConfig.mLvcConnections, aConfig.mLvcCandidates, aConfig.mShadowCullThreshold,
+			aConfig.mConcurrentBuilds, aConfig.mSortLightData, aConfig.mQueryCullSurvivalProb, aConfig.mQueryTruncationThreshold,
+			aConfig.mTunerIterations, aConfig.mTargetTimeRatio, aConfig.mTargetCellOccupancy, tunerMaxPathCount, tunerMaxGridSize,
+			aSeed, aBaseSeed, aConfig.mIgnoreFullySpecPaths, aLightPathCounter);
 	default:
         std::cerr << "Error: unknown algorithm" << std::endl;
         exit(2);
@@ -400,6 +461,9 @@ std::string GetDescription(const Config& aConfig, const std::string& aLeadingSpa
 				<< aLeadingSpaces << "min dist to med:   " << aConfig.mMinDistToMed << '\n'
 				;
 
+			if (aConfig.mCameraPassCount > 1)
+				oss << aLeadingSpaces << "camera passes/iter:" << aConfig.mCameraPassCount << '\n';
+
 			if (aConfig.mAlgorithmFlags & COMPATIBLE)
 					oss << aLeadingSpaces << "compatible mode" << '\n';
 			else if (aConfig.mAlgorithmFlags & PREVIOUS)
@@ -428,6 +492,7 @@ std::string GetDescription(const Config& aConfig, const std::string& aLeadingSpa
 				oss << aLeadingSpaces << "query beam type:   LONG\n";
 
 			oss << aLeadingSpaces << "ref. paths/iter:   " << aConfig.mRefPathCountPerIter << '\n';
+			oss << aLeadingSpaces << "     paths/iter:   " << aConfig.mPathCountPerIter << '\n';
 
 			return oss.str();
 		}
@@ -461,7 +526,8 @@ std::string GetDescription(const Config& aConfig, const std::string& aLeadingSpa
 				oss << aLeadingSpaces << "reduction type:    " << aConfig.mReductionType << '\n';
 			}
 
-			oss << aLeadingSpaces << "ref. paths/iter:   " << aConfig.mRefPathCountPerIter << '\n';			
+			oss << aLeadingSpaces << "ref. paths/iter:   " << aConfig.mRefPathCountPerIter << '\n';
+			oss << aLeadingSpaces << "     paths/iter:   " << aConfig.mPathCountPerIter << '\n';
 
 			return oss.str();
 		}
@@ -550,6 +616,9 @@ std::string GetDescription(const Config& aConfig, const std::string& aLeadingSpa
 			oss << aLeadingSpaces << "     paths/iter:   " << aConfig.mPathCountPerIter << '\n';
 			oss << aLeadingSpaces << "min dist to med:   " << aConfig.mMinDistToMed << '\n';
 
+			if (aConfig.mCameraPassCount > 1)
+				oss << aLeadingSpaces << "camera passes/iter:" << aConfig.mCameraPassCount << '\n';
+
 			if (aConfig.mAlgorithmFlags & COMPATIBLE)
 					oss << aLeadingSpaces << "compatible mode" << '\n';
 			else if (aConfig.mAlgorithmFlags & PREVIOUS)
@@ -1076,12 +1145,37 @@ void PrintHelp(const char *argv[])
 	printf("    -i <iter>      Number of iterations to run the algorithm (default 1).\n");
 	printf("    -o <name>      User specified output name, with extension .bmp or .exr (default .exr). The name can be prefixed with relative or absolute path but the path must exists.\n");
 	printf("    -r <res>       Image resolution in format WIDTHxHEIGHT (default 256x256).\n");    
+	printf("    -crop <rect>   Renders only pixels of the rectangle in format LEFT,TOP,WIDTHxHEIGHT, repeat for more non-overlapping rectangles.\n");
+	printf("                   Images store only the bounding window of the rectangles. Light path counts still follow the whole image.\n");
 	printf("    -seed <seed>   Sets base seed (default 1234).\n");
 	printf("\n    Note: Time (-t) takes precedence over iterations (-i) if both are defined.\n"); 
 
 	printf("\n    Performance options:\n\n");
 	printf("    -th <threads>                     Number of threads (default 0 means #threads = #cores).\n");
-	printf("    -maxMemPerThread <memory>         Sets max memory in MB for light vertex array per each thread (default 500). Works only for upbp algorithms.\n");
+	printf("    -maxMemPerThread <memory>         Sets memory in MB reserved for light vertex and beam arrays per each thread (default 500). It is approximate,\n");
+	printf("                                      the arrays grow beyond it when more vertices are traced and the growth shows in the peak memory reported\n");
+	printf("                                      with -maxMem. Works only for upbp algorithms.\n");
+	printf("    -maxMem <memory>                  Sets memory budget in MB of the whole render (default 0 means none). Threads, paths per iteration (upbp)\n");
+	printf("                                      and bb1d grid resolution are reduced up front to fit it (including debug images), and limit -autotune as well,\n");
+	printf("                                      peak memory is reported at the end.\n");
+	printf("    -numa                             Pins render threads to NUMA nodes so that their data are allocated in local memory.\n");
+	printf("    -embreeth <threads>               Number of threads embree uses for building acceleration structures (0 means all cores, default is 0 or 1 with -numa).\n");
+	printf("    -pipeline                         Traces light sub-paths of the next iteration in a background thread during the camera pass of the current one.\n");
+	printf("                                      Works only for upbp algorithms without debug images and beam density, doubles memory of light data.\n");
+	printf("                                      Matches the non-pipelined result unless query culling or tuning options are used, their state is kept per engine.\n");
+	printf("    -cbuild                           Builds per-iteration acceleration structures of different estimators concurrently (upbp only).\n");
+	printf("                                      Useful with fewer render threads than cores, e.g. -th 1, since the tasks add threads.\n");
+	printf("    -morton                           Reorders light vertices and photon beams along the Morton curve after light tracing,\n");
+	printf("                                      improves memory locality of merging (upbp only).\n");
+	printf("    -qcull <probability>              Keeps photons and beams in regions not queried by the previous camera pass only with the given probability\n");
+	printf("                                      (in (0,1], survivors are weighted by its inverse, default 0 means no culling, upbp only).\n");
+	printf("    -qtrunc <threshold>               Continues long BB1D and PB2D query beams by Russian roulette once their attenuation drops below\n");
+	printf("                                      the given threshold (in (0,1), default 0 means full traversal, upbp only).\n");
+	printf("    -tune <iterations>                Measures time and contributions of pp3d, pb2d and bb1d in each medium during the given number\n");
+	printf("                                      of iterations, then disables inefficient ones per medium (default 0 means no selection, upbp only).\n");
+	printf("    -autotune <ratio> <occupancy>     After each iteration adjusts paths per iteration towards the given ratio of light to camera pass\n");
+	printf("                                      times and bb1d grid resolution (and max beams in cell) towards the given mean number of beams\n");
+	printf("                                      in non-empty cells (0 keeps the parameter fixed, default 0 0, upbp only).\n");
 
 	printf("\n    Radius options:\n\n");
 	printf("    -r_alpha <alpha>       Sets same radius reduction parameter for techniques surf, pp3d, pb2d and bb1d.\n");
@@ -1105,11 +1199,21 @@ void PrintHelp(const char *argv[])
 	printf("    -compatible          Restricts traced paths to be comparable with the \"previous work\" (paths ES*M(S|D|M)*L).\n");
 	printf("    -speconly            Traces only purely specular paths.\n");
 	printf("    -ignorespec <option> Sets whether upbp will ignore fully specular paths from camera (0=no(default),1=yes).\n");	
+	printf("    -rrthr <threshold>   Enables Russian roulette based on subpath throughput, paths with throughput (relative to their origin) below threshold\n");
+	printf("                         survive with probability throughput/threshold (default 0 means only albedo based roulette). Works only for upbp and vbpt algorithms.\n");
+	printf("    -lvc_uniform_mis <conn> <cand>\n");
+	printf("                         Connects each camera vertex to <conn> vertices from the cache of all light vertices instead of to all vertices of its own light path,\n");
+	printf("                         each selected uniformly from the cache (default 0 means disabled). <cand> is the number of candidates for resampled selection\n");
+	printf("                         and must be 1, since MIS weights assume uniform selection. Works only for vbpt and upbp algorithms.\n");
+	printf("    -shcull <fraction>   Connections of a camera vertex with unoccluded contribution below <fraction> of the largest one are culled by Russian roulette\n");
+	printf("                         before tracing their shadow rays (default 0 means only zero contributions are culled). Works only for upbp, vbpt and vcm algorithms.\n");
 
 	printf("\n    Beams options:\n\n");
 	printf("    -gridres <res>          Sets photon beams grid resolution in dimension of a maximum extent of grid AABB, resolution in other dim. is set to give cube sized grid cells (default 256).\n");
-	printf("    -gridmax <max>          Sets maximum number of beams in one grid cell (default 0 means unlimited). Works only for bb1d algorithm (not upbp).\n");
-	printf("    -gridred <red>          Sets type of reduction of tested beams in one grid cell (0=presample (default), 1=offset, 2=resample_fixed, 3=resample). Works only for bb1d algorithm (not upbp).\n");
+	printf("    -gridmax <max>          Sets maximum number of beams in one grid cell (default 0 means unlimited). Works for bb1d and upbp algorithms.\n");
+	printf("    -gridred <red>          Sets type of reduction of tested beams in one grid cell (0=presample (default), 1=offset, 2=resample_fixed, 3=resample, 4=cluster). Works for bb1d and upbp algorithms.\n");
+	printf("                            Cluster builds a tree over beams of cells with more than <max> beams, clusters whose contribution bound for the query ray (power times kernel\n");
+	printf("                            maximum at their distance from the ray) is below 1/<max> of the bound of the cell are tested by one representative.\n");
 	printf("    -beamdens <type> <max>  Outputs image(s) of statistics of hit beams and cells (0=none(default), 1=abs, 2=avg, 3=cells, 4=overfull, 5=all) normalized to the given max (-1=max in data(default), positive=given max). Works only for bb1d algorithm (not upbp).\n");
 	printf("    -beamstore <factor>     Sets multiple of bb1d radius used for decision whether to store beams or not (0=stores all beams (default)). Works only for bb1d algorithm (not upbp).\n");
 	printf("    -qbt <type>             Sets query beam type: S = uses short query beams,  L = uses long query beams (default).\n");
@@ -1121,13 +1225,19 @@ void PrintHelp(const char *argv[])
 	printf("    -debugimg_option <option>          Sets debug images output options, possibilities are none(default), simple_pyramid (Veach-like), per_technique (one image per technique), pyramid_per_technique.\n");
 	printf("    -debugimg_multbyweight <option>    Sets whether output debug images should be multiplied by MIS weights or not (no, yes(default), output_both).\n");
 	printf("    -debugimg_output_weights <option>  Sets whether MIS weights per each technique should be output (0=no(default), 1=yes).\n");
+	printf("    -fastmath_test                     Compares fast exp, log, sincos and pow to libm over their domains, prints the largest errors and exits\n");
+	printf("                                       (exit code 1 if some exceeds its documented bound).\n");
 
 	printf("\n    Other options:\n\n");
 	printf("    -continuous_output <iter_count>  Sets whether we should continuously output images (<iter_count> > 0 says output image once per <iter_count> iterations, 0(default) no cont. output).\n");
 	printf("    -em <filepath>                   Sets environment map in scenes with background light (expects absolute path to OpenEXR file with latitude-longitude mapping).\n");
+	printf("    -views <filepath>                Renders additional views sharing light sub-paths and structures with the main camera, the file has one\n");
+	printf("                                     \"<origin x y z> <target x y z> [fov]\" per line, images get suffix _view<n>. Works only for upbp algorithms\n");
+	printf("                                     without debug images and beam density.\n");
 	printf("    -min_dist2med <distance>         Sets minimum distance from camera for medium contribution (positive=absolute, negative=relative to scene size, zero=no effect (default)). Works only for upbp algorithms.\n");	
-	printf("    -rpcpi <path_count>              Reference light path count per iteration (default -1, if positive, absolute, if negative, relative to total number of pixels). Works only for vlt, pb2d, bb1d and upbp algorithms.\n");
-	printf("    -pcpi <path_count>               Light path count per iteration (default -1, if positive, absolute, if negative, relative to total number of traced light paths). Works only for vlt, pb2d, bb1d and upbp algorithms.\n");
+	printf("    -rpcpi <path_count>              Reference light path count per iteration (default -1, if positive, absolute, if negative, relative to total number of pixels). Works only for lt, ppm, bpm, bpt, vcm, vlt, pb2d, bb1d and upbp algorithms.\n");
+	printf("    -pcpi <path_count>               Light path count per iteration (default -1, if positive, absolute, if negative, relative to total number of pixels). Works only for lt, ppm, bpm, bpt, vcm, vlt, pb2d, bb1d, vbpt and upbp algorithms.\n");
+	printf("    -cppi <pass_count>               Camera pass count per iteration, all passes use the same light paths and structures built from them (default 1). Works only for upbp algorithms.\n");
 	printf("    -sn <option>                     Whether to use shading normals: 0 = does not use shading normals, 1 = uses shading normals (default).\n");
 	printf("    -time                            If present algorithm run duration is appended to the name of the output file.\n");	
 }
@@ -1235,6 +1345,7 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 	
 	oConfig.mRefPathCountPerIter = -1;
 	oConfig.mPathCountPerIter    = -1;	
+	oConfig.mCameraPassCount     = 1;
     
 	oConfig.mQueryBeamType	= LONG_BEAM;
 	oConfig.mPhotonBeamType = SHORT_BEAM;
@@ -1260,13 +1371,30 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 	oConfig.mContinuousOutput   = 0;
 	oConfig.mEnvMapFilePath     = "";
 	oConfig.mMaxMemoryPerThread = 500 * 1024 * 1024;
+	oConfig.mMemoryBudget = 0;
 	oConfig.mMinDistToMed       = 0;
 	oConfig.mShowTime           = false;
+	oConfig.mNumaAware          = false;
+	oConfig.mEmbreeThreads      = -1;
+	oConfig.mPipelineIterations = false;
+	oConfig.mConcurrentBuilds   = false;
+	oConfig.mSortLightData      = false;
+	oConfig.mQueryCullSurvivalProb = 0;
+	oConfig.mQueryTruncationThreshold = 0;
+	oConfig.mTunerIterations = 0;
+	oConfig.mTargetTimeRatio = 0;
+	oConfig.mTargetCellOccupancy = 0;
 
 	oConfig.mIgnoreFullySpecPaths = false;
+	oConfig.mRRThreshold          = 0;
+	oConfig.mLvcConnections       = 0;
+	oConfig.mLvcCandidates        = 1;
+	oConfig.mShadowCullThreshold  = 0;
 
     int sceneID = 0;
 	std::string sceneObjFile = "";
+	std::string viewsFile = "";
+	std::vector<Camera::Rect> cropRects;
 	
 	std::ostringstream additionalArgs;
 	
@@ -1303,6 +1431,10 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
             PrintHelp(argv);
             return;
         }
+		else if(arg == "-fastmath_test") // validation of fast math functions against libm
+		{
+			exit(FastMath::RunTest() ? 0 : 1);
+		}
 
         if(arg[0] != '-') // all our commands start with -
         {
@@ -1424,6 +1556,17 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 
 			additionalArgs << "_r" << argv[i];
 		}
+		else if (arg == "-crop") // crop rectangle
+		{
+			if (++i == argc) ReportParsingError("missing argument of -crop option, please see help (-hf)");
+
+			int x = -1, y = -1, w = -1, h = -1;
+			sscanf_s(argv[i], "%d,%d,%dx%d", &x, &y, &w, &h);
+			if (x < 0 || y < 0 || w <= 0 || h <= 0) ReportParsingError("invalid argument of -crop option, please see help (-hf)");
+			cropRects.push_back(Camera::Rect(x, y, x + w, y + h));
+
+			additionalArgs << "_crop" << argv[i];
+		}
 		else if (arg == "-seed")
 		{
 			if (++i == argc) ReportParsingError("missing argument of -seed option, please see help (-hf)");
@@ -1456,6 +1599,78 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 			oConfig.mMaxMemoryPerThread *= 1024 * 1024;
 			if (iss.fail() || oConfig.mMaxMemoryPerThread <= 0) ReportParsingError("invalid argument of -maxMemPerThread option, please see help (-hf)");
 		}
+		else if (arg == "-maxMem") // memory budget of the whole render
+		{
+			if (++i == argc) ReportParsingError("missing argument of -maxMem option, please see help (-hf)");
+
+			std::istringstream iss(argv[i]);
+			iss >> oConfig.mMemoryBudget;
+			oConfig.mMemoryBudget *= 1024 * 1024;
+			if (iss.fail() || oConfig.mMemoryBudget <= 0) ReportParsingError("invalid argument of -maxMem option, please see help (-hf)");
+		}
+		else if (arg == "-numa") // NUMA aware placement of render threads
+		{
+			oConfig.mNumaAware = true;
+		}
+		else if (arg == "-embreeth") // embree build threads count
+		{
+			if (++i == argc) ReportParsingError("missing argument of -embreeth option, please see help (-hf)");
+
+			std::istringstream iss(argv[i]);
+			iss >> oConfig.mEmbreeThreads;
+
+			if (iss.fail() || oConfig.mEmbreeThreads < 0) ReportParsingError("invalid argument of -embreeth option, please see help (-hf)");
+		}
+		else if (arg == "-pipeline") // pipelined iterations
+		{
+			oConfig.mPipelineIterations = true;
+		}
+		else if (arg == "-cbuild") // concurrent builds of acceleration structures
+		{
+			oConfig.mConcurrentBuilds = true;
+		}
+		else if (arg == "-morton") // Morton order of light vertices and beams
+		{
+			oConfig.mSortLightData = true;
+		}
+		else if (arg == "-qcull") // query culling of photons and beams
+		{
+			if (++i == argc) ReportParsingError("missing argument of -qcull option, please see help (-hf)");
+
+			std::istringstream iss(argv[i]);
+			iss >> oConfig.mQueryCullSurvivalProb;
+
+			if (iss.fail() || oConfig.mQueryCullSurvivalProb <= 0 || oConfig.mQueryCullSurvivalProb > 1) ReportParsingError("invalid argument of -qcull option, please see help (-hf)");
+		}
+		else if (arg == "-qtrunc") // transmittance-bounded query traversal
+		{
+			if (++i == argc) ReportParsingError("missing argument of -qtrunc option, please see help (-hf)");
+
+			std::istringstream iss(argv[i]);
+			iss >> oConfig.mQueryTruncationThreshold;
+
+			if (iss.fail() || oConfig.mQueryTruncationThreshold <= 0 || oConfig.mQueryTruncationThreshold >= 1) ReportParsingError("invalid argument of -qtrunc option, please see help (-hf)");
+		}
+		else if (arg == "-tune") // per-medium selection of volumetric techniques
+		{
+			if (++i == argc) ReportParsingError("missing argument of -tune option, please see help (-hf)");
+
+			std::istringstream iss(argv[i]);
+			iss >> oConfig.mTunerIterations;
+
+			if (iss.fail() || oConfig.mTunerIterations <= 0) ReportParsingError("invalid argument of -tune option, please see help (-hf)");
+		}
+		else if (arg == "-autotune") // feedback control of paths per iteration and grid resolution
+		{
+			if (i + 2 >= argc) ReportParsingError("missing argument of -autotune option, please see help (-hf)");
+
+			std::istringstream iss(argv[++i]);
+			iss >> oConfig.mTargetTimeRatio;
+			std::istringstream iss2(argv[++i]);
+			iss2 >> oConfig.mTargetCellOccupancy;
+
+			if (iss.fail() || iss2.fail() || oConfig.mTargetTimeRatio < 0 || oConfig.mTargetCellOccupancy < 0) ReportParsingError("invalid argument of -autotune option, please see help (-hf)");
+		}
 
 		// Radius options:
 		
@@ -1673,6 +1888,42 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 			}
 			else ReportParsingError("invalid argument of -ignorespec option, please see help (-hf)");
 		}
+		else if (arg == "-rrthr") // throughput based Russian roulette
+		{
+			if (++i == argc) ReportParsingError("missing argument of -rrthr option, please see help (-hf)");
+
+			std::istringstream iss(argv[i]);
+			iss >> oConfig.mRRThreshold;
+
+			if (iss.fail() || oConfig.mRRThreshold < 0) ReportParsingError("invalid argument of -rrthr option, please see help (-hf)");
+
+			additionalArgs << "_rrthr" << argv[i];
+		}
+		else if (arg == "-lvc_uniform_mis") // connections to light vertex cache
+		{
+			if (++i == argc) ReportParsingError("missing first argument of -lvc_uniform_mis option, please see help (-hf)");
+
+			sscanf_s(argv[i], "%d", &oConfig.mLvcConnections);
+			if (oConfig.mLvcConnections < 0) ReportParsingError("invalid first argument of -lvc_uniform_mis option, please see help (-hf)");
+
+			if (++i == argc) ReportParsingError("missing second argument of -lvc_uniform_mis option, please see help (-hf)");
+
+			sscanf_s(argv[i], "%d", &oConfig.mLvcCandidates);
+			if (oConfig.mLvcCandidates != 1) ReportParsingError("invalid second argument of -lvc_uniform_mis option, only 1 candidate is supported by the uniform MIS weights, please see help (-hf)");
+
+			additionalArgs << "_lvcu" << argv[i - 1] << "_" << argv[i];
+		}
+		else if (arg == "-shcull") // culling of negligible connections
+		{
+			if (++i == argc) ReportParsingError("missing argument of -shcull option, please see help (-hf)");
+
+			std::istringstream iss(argv[i]);
+			iss >> oConfig.mShadowCullThreshold;
+
+			if (iss.fail() || oConfig.mShadowCullThreshold < 0 || oConfig.mShadowCullThreshold > 1) ReportParsingError("invalid argument of -shcull option, please see help (-hf)");
+
+			additionalArgs << "_shcull" << argv[i];
+		}
 
 		// Beams options:
 
@@ -1703,7 +1954,7 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 			std::istringstream iss(argv[i]);
 			iss >> oConfig.mReductionType;
 
-			if (iss.fail() || oConfig.mReductionType > 3) ReportParsingError("invalid argument of -gridred option, please see help (-hf)");
+			if (iss.fail() || oConfig.mReductionType > 4) ReportParsingError("invalid argument of -gridred option, please see help (-hf)");
 
 			additionalArgs << "_gridred" << argv[i];
 		}
@@ -1858,6 +2109,12 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 			size_t lastDotPos = oConfig.mEnvMapFilePath.find_last_of('.');
 			additionalArgs << "_em-" << oConfig.mEnvMapFilePath.substr(lastSlashPos + 1, lastDotPos - lastSlashPos - 1);
         }
+		else if (arg == "-views") // additional views of multi-view rendering
+		{
+			if (++i == argc) ReportParsingError("missing argument of -views option, please see help (-hf)");
+
+			viewsFile = argv[i];
+		}
 		else if (arg == "-min_dist2med") // minimum distance from camera to medium
 		{
 			if (++i == argc) ReportParsingError("missing argument of -min_dist2med option, please see help (-hf)");
@@ -1884,6 +2141,15 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 
 			additionalArgs << "_pcpi" << argv[i];
 		}
+		else if (arg == "-cppi") // camera pass count per iteration
+		{
+			if (++i == argc) ReportParsingError("missing argument of -cppi option, please see help (-hf)");
+
+			sscanf_s(argv[i], "%d", &oConfig.mCameraPassCount);
+			if (oConfig.mCameraPassCount <= 0) ReportParsingError("invalid argument of -cppi option, please see help (-hf)");
+
+			additionalArgs << "_cppi" << argv[i];
+		}
 		else if (arg == "-sn") // surface normals
 		{
 			if (++i == argc) ReportParsingError("missing argument of -sn option, please see help (-hf)");
@@ -1930,6 +2196,22 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
 		scene->LoadFromObj(sceneObjFile.c_str(), oConfig.mResolution);
     scene->BuildSceneSphere();
 
+	if (!viewsFile.empty() && !scene->LoadViews(viewsFile))
+		ReportParsingError("invalid argument of -views option, cannot read views from " + viewsFile);
+
+	// Crop rectangles are the same for all views (they share resolution)
+	for (size_t r = 0; r < cropRects.size(); ++r)
+	{
+		if (cropRects[r].mMaxX > oConfig.mResolution.x || cropRects[r].mMaxY > oConfig.mResolution.y)
+			ReportParsingError("invalid argument of -crop option, the rectangle exceeds the image resolution");
+		for (size_t s = 0; s < r; ++s)
+			if (cropRects[r].Overlaps(cropRects[s]))
+				ReportParsingError("invalid arguments of -crop options, the rectangles overlap");
+	}
+	scene->mCamera.SetCrop(cropRects);
+	for (size_t v = 0; v < scene->mViews.size(); ++v)
+		scene->mViews[v].SetCrop(cropRects);
+
 	// Set environment map.
 	if (oConfig.mEnvMapFilePath.length() > 0 && scene->mBackground)
 	{
@@ -1959,6 +2241,12 @@ void ParseCommandline(int argc, const char *argv[], Config &oConfig)
         oConfig.mOutputName += ".exr";
 
 	oConfig.mDebugImages.Setup(oConfig.mMaxPathLength, oConfig.mResolution, debugImagesOptions, debugImagesWeightsOptions, debugImagesMisWeights);
+
+	// Debug images and beam density are collected in camera passes of all views, so they are not supported with views
+	if (!scene->mViews.empty() && (oConfig.mDebugImages.IsUsed() || oConfig.mBeamDensType != BeamDensity::NONE))
+		ReportParsingError("-views option cannot be combined with debug images or beam density, please see help (-hf)");
+	if (!scene->mViews.empty() && oConfig.mAlgorithm < Config::kVolumetricLightTracingFromUPBP)
+		ReportParsingError("-views option works only for upbp algorithms, please see help (-hf)");
 	
 	// Grid parameters.
 	PhotonBeamsEvaluator::sGridSize = oConfig.mGridResolution;
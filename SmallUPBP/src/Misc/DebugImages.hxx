@@ -87,7 +87,7 @@ public:
 	/**
 	 * @brief	Default constructor.
 	 */
-	DebugImages() :mAccumulation(0)
+	DebugImages() :mAccumulation(0), mCompletelyIgnore(true), mSampleScale(1.0f)
 	{
 		mTechniqueNames.resize(TECHNIQUE_COUNT);
 		mTechniqueNames[BPT] = "BPT";
@@ -158,6 +158,31 @@ public:
 		}
 	}
 
+	/**
+	 * @brief	Query if any image is generated.
+	 * 			
+	 * 			Renderers use it to pick code paths that skip debug image collection altogether.
+	 *
+	 * @return	true if images are generated, false if all samples are ignored.
+	 */
+	bool IsUsed() const
+	{
+		return !mCompletelyIgnore;
+	}
+
+	/**
+	 * @brief	Gets memory taken by the frame buffers of the images.
+	 *
+	 * @return	The size in bytes.
+	 */
+	size_t GetMemorySize() const
+	{
+		size_t size = 0;
+		for (FrameBuffers::const_iterator it = frameBuffers.begin(); it != frameBuffers.end(); ++it)
+			size += it->GetMemorySize();
+		return size;
+	}
+
 	/**
 	 * @brief	Adds a sample to images.
 	 *
@@ -258,6 +283,43 @@ public:
 		++mAccumulation;
 	}
 
+	/**
+	 * @brief	Accumulates data from all the given \c DebugImages at once.
+	 * 			
+	 * 			Same as calling Accumulate() for each of them, but each image is reduced in parallel
+	 * 			and written only once.
+	 *
+	 * @param	aDebugImages	Images to accumulate.
+	 * @param	aIterations 	Numbers of used iterations of the corresponding images.
+	 */
+	void Accumulate(const std::vector<const DebugImages*> & aDebugImages, const std::vector<int> & aIterations)
+	{
+		if (mCompletelyIgnore)
+			return;
+
+		std::vector<const DebugImages*> used;
+		std::vector<float> scaling;
+		for (size_t i = 0; i < aDebugImages.size(); ++i)
+		{
+			UPBP_ASSERT(aDebugImages[i]->frameBuffers.size() == frameBuffers.size());
+			if (aIterations[i] == 0)
+				continue;
+
+			used.push_back(aDebugImages[i]);
+			scaling.push_back(1.0f / aIterations[i]);
+		}
+
+		std::vector<const Framebuffer*> srcs(used.size());
+		for (size_t img = 0; img < frameBuffers.size(); ++img)
+		{
+			for (size_t i = 0; i < used.size(); ++i)
+				srcs[i] = &used[i]->frameBuffers[img];
+			frameBuffers[img].AddScaled(srcs, scaling);
+		}
+
+		mAccumulation += (int)used.size();
+	}
+
 	/**
 	 * @brief	Outputs the images.
 	 *
@@ -338,6 +400,19 @@ public:
 		}
 	}
 
+	/**
+	 * @brief	Sets scale of colors of subsequently added samples.
+	 * 			
+	 * 			Used when one iteration consists of more passes than one (e.g. more camera passes per
+	 * 			light pass), so images of all techniques are normalized by the number of iterations.
+	 *
+	 * @param	aScale	The scale.
+	 */
+	void SetSampleScale(float aScale)
+	{
+		mSampleScale = aScale;
+	}
+
 	// The following functions must be const - so they change only mutable variables
 
 	/**
@@ -478,14 +553,14 @@ private:
 		switch (mMisWeights)
 		{
 		case IGNORE_WEIGHTS:
-			frameBuffers[aIndex].AddColor(aSample, aColor);
+			frameBuffers[aIndex].AddColor(aSample, aColor * mSampleScale);
 			break;
 		case MULTIPLY_BY_WEIGHTS:
-			frameBuffers[aIndex].AddColor(aSample, aWeightedColor);
+			frameBuffers[aIndex].AddColor(aSample, aWeightedColor * mSampleScale);
 			break;
 		case OUTPUT_BOTH_VERSIONS:
-			frameBuffers[aIndex * 2].AddColor(aSample, aColor);
-			frameBuffers[aIndex * 2 + 1].AddColor(aSample, aWeightedColor);
+			frameBuffers[aIndex * 2].AddColor(aSample, aColor * mSampleScale);
+			frameBuffers[aIndex * 2 + 1].AddColor(aSample, aWeightedColor * mSampleScale);
 			break;
 		}
 	}
@@ -540,6 +615,8 @@ private:
 	
 	bool mCompletelyIgnore; //!< If true, no image will be generated and output.
 
+	float mSampleScale; //!< Scale of colors of added samples.
+
 	DebugOptions mDebugOptions;     //!< Type of debugging images to generate.
 	WeightsOptions mWeightsOptions; //!< Whether to output MIS weights of used techniques.
 	MisWeights mMisWeights;         //!< How to deal with MIS weights in images.
@@ -166,7 +166,8 @@ enum BeamReduction
 	PRESAMPLE = 0,      //!< Stored: all beams randomly shuffled, tested: first fixed number of stored beams.
 	OFFSET = 1,         //!< Stored: all beams randomly shuffled, tested: fixed number of stored beams beginning at a random offset.
 	RESAMPLE_FIXED = 2, //!< Stored: all beams, tested: fixed number of randomly picked stored beams.
-	RESAMPLE = 3	    //!< Stored: all beams, tested: all stored beams which were accepted in a random test.
+	RESAMPLE = 3,	    //!< Stored: all beams, tested: all stored beams which were accepted in a random test.
+	CLUSTER = 4         //!< Stored: all beams in a cluster tree, tested: beams near the query, farther clusters of low power by one representative.
 };
 
 /**
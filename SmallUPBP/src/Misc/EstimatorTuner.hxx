@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __ESTIMATORTUNER_HXX__
+#define __ESTIMATORTUNER_HXX__
+
+#include <vector>
+#include <iostream>
+
+#include "..\Misc\Defs.hxx"
+#include "..\Misc\Timer.hxx"
+#include "..\Misc\Utils2.hxx"
+#include "..\Scene\Media.hxx"
+
+/**
+ * @brief	Online selection of volumetric estimators per medium.
+ *			
+ *			During the first iterations time spent and luminance of weighted contributions of PP3D,
+ *			PB2D and BB1D queries are recorded for each medium. Then a technique is disabled in a
+ *			medium if its contribution per second, discounted by its relative second moment, is
+ *			far below the best technique there. A disabled technique is removed from MIS through
+ *			the per-vertex weight factors, so the remaining ones stay unbiased.
+ */
+class EstimatorTuner
+{
+public:
+
+	EstimatorTuner() : mIterations(0), mFinishedIterations(0), mVerbose(0), mScale(1.0f) {}
+
+	/**
+	 * @brief	Setups the tuner, all techniques are enabled in all media.
+	 *
+	 * @param	aMedia	  	Media of the scene.
+	 * @param	aTechniques	Estimator techniques of the renderer.
+	 * @param	aIterations	Number of iterations to collect statistics in.
+	 * @param	aVerbose   	Whether to print the selection.
+	 */
+	void Setup(const std::vector<AbstractMedium*> &aMedia, const uint aTechniques, const int aIterations, const int aVerbose)
+	{
+		mMedia.assign(aMedia.begin(), aMedia.end());
+		mTechniques.assign(mMedia.size(), aTechniques & (PP3D | PB2D | BB1D));
+		mStats.assign(mMedia.size() * kTechniqueCount, Stats());
+		mIterations = aIterations;
+		mFinishedIterations = 0;
+		mVerbose = aVerbose;
+	}
+
+	bool IsSetup() const { return mIterations > 0; }
+
+	bool IsCollecting() const { return mFinishedIterations < mIterations; }
+
+	// Volumetric techniques (PP3D, PB2D, BB1D) enabled in the given medium
+	uint MediumTechniques(const AbstractMedium *aMedium) const
+	{
+		const int index = MediumIndex(aMedium);
+		return index >= 0 ? mTechniques[index] : (PP3D | PB2D | BB1D);
+	}
+
+	// Sets the factor (camera path throughput times normalization) of contributions of the next queries
+	void SetScale(const float aScale)
+	{
+		mScale = aScale;
+	}
+
+	void StartQuery()
+	{
+		mTimer.Start();
+	}
+
+	// Records a query of the given technique in the given medium started by StartQuery()
+	void EndQuery(const AbstractMedium *aMedium, const uint aTechnique, const Rgb &aContrib)
+	{
+		mTimer.Stop();
+		const int index = MediumIndex(aMedium);
+		if (index < 0) return;
+
+		Stats &stats = mStats[index * kTechniqueCount + TechniqueIndex(aTechnique)];
+		const float contrib = mScale * Luminance(aContrib);
+		stats.mTime += mTimer.GetLastElapsedTime();
+		stats.mSum += contrib;
+		stats.mSumSqr += contrib * contrib;
+		++stats.mCount;
+	}
+
+	// Called after the camera pass, selects the techniques after the last collecting iteration
+	void EndIteration()
+	{
+		if (!IsCollecting()) return;
+		if (++mFinishedIterations == mIterations)
+			Select();
+	}
+
+private:
+
+	enum { kTechniqueCount = 3 };
+
+	struct Stats
+	{
+		Stats() : mTime(0), mSum(0), mSumSqr(0), mCount(0) {}
+
+		double mTime;
+		double mSum;
+		double mSumSqr;
+		double mCount;
+	};
+
+	static int TechniqueIndex(const uint aTechnique)
+	{
+		return aTechnique == PP3D ? 0 : aTechnique == PB2D ? 1 : 2;
+	}
+
+	int MediumIndex(const AbstractMedium *aMedium) const
+	{
+		for (size_t i = 0; i < mMedia.size(); ++i)
+			if (mMedia[i] == aMedium) return (int)i;
+		return -1;
+	}
+
+	void Select()
+	{
+		const uint techniques[kTechniqueCount] = { PP3D, PB2D, BB1D };
+		const char *names[kTechniqueCount] = { "pp3d", "pb2d", "bb1d" };
+
+		// Techniques below this fraction of the best score in a medium are disabled.
+		const double minRelativeScore = 0.1;
+
+		for (size_t i = 0; i < mMedia.size(); ++i)
+		{
+			double scores[kTechniqueCount];
+			double best = 0;
+			for (int t = 0; t < kTechniqueCount; ++t)
+			{
+				const Stats &stats = mStats[i * kTechniqueCount + t];
+				scores[t] = -1;
+				if (!(mTechniques[i] & techniques[t]) || stats.mCount == 0 || stats.mTime <= 0)
+					continue;
+
+				// Contribution per second times mean^2 / second moment (1 for a noiseless technique).
+				scores[t] = stats.mSumSqr > 0 ? (stats.mSum / stats.mTime) * (stats.mSum * stats.mSum / (stats.mSumSqr * stats.mCount)) : 0;
+				best = std::max(best, scores[t]);
+			}
+
+			if (best <= 0) continue;
+
+			for (int t = 0; t < kTechniqueCount; ++t)
+			{
+				if (scores[t] >= 0 && scores[t] < minRelativeScore * best)
+					mTechniques[i] &= ~techniques[t];
+			}
+
+			if (mVerbose)
+			{
+				std::cout << "medium " << i << " uses";
+				for (int t = 0; t < kTechniqueCount; ++t)
+					if (mTechniques[i] & techniques[t]) std::cout << " " << names[t];
+				std::cout << std::endl;
+			}
+		}
+	}
+
+	std::vector<const AbstractMedium*> mMedia;
+	std::vector<uint>  mTechniques;       // Enabled volumetric techniques of each medium
+	std::vector<Stats> mStats;            // Statistics of each medium and technique
+	int                mIterations;       // Number of iterations to collect statistics in
+	int                mFinishedIterations;
+	int                mVerbose;
+	float              mScale;
+	Timer              mTimer;
+};
+
+#endif //__ESTIMATORTUNER_HXX__
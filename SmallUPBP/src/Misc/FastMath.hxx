@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __FASTMATH_HXX__
+#define __FASTMATH_HXX__
+
+#include <cmath>
+
+#include "Sse.hxx"
+
+/**
+ * @brief	Whether the scalar functions in FastMath use the SSE approximations (comment out to use
+ * 			libm instead, e.g. for checking results).
+ */
+#define USE_FAST_MATH
+
+//////////////////////////////////////////////////////////////////////////
+// Fast scalar transcendental functions
+
+/**
+ * @brief	Transcendental functions used on hot paths (medium sampling, attenuation, lobe sampling and
+ * 			Phong evaluation).
+ * 			
+ * 			With USE_FAST_MATH defined they are thin scalar wrappers of the SSE functions Ff::exp,
+ * 			Ff::log and Ff::sincos of the bundled FastFloat library (cephes based polynomials of
+ * 			sse_mathfun), which are also used by the vectorized Rgb::exp. Otherwise libm is called.
+ * 			
+ * 			Largest errors compared to libm measured by -fastmath_test (FastMathTest.hxx, 10M samples
+ * 			per function), the bounds below are the ones the test checks:
+ * 			- exp:    relative error 8.1e-8 (bound 1e-7) for x in [-87, 88], outside the results
+ * 			          underflow to 0 or overflow to infinity.
+ * 			- log:    absolute error 2.3e-8 (bound 5e-8) where |log(x)| < 0.5, relative error 7.9e-8
+ * 			          (bound 1e-7) elsewhere, x must be positive and normalized.
+ * 			- sincos: absolute error 7.8e-8 (bound 1e-7) for |x| <= 8192. Precision is lost for larger
+ * 			          |x| (2.6e-7 at 16384, 3e-2 at 1e6).
+ * 			- pow:    computed as exp(y * log(x)), relative error 1.1e-7 * (2 + |y * log(x)|) (bound
+ * 			          1.5e-7 * (2 + |y * log(x)|)) for x in [e^-20, e^20] and y in [-4, 4]. Non-positive x
+ * 			          is passed to libm.
+ */
+namespace FastMath
+{
+	const double kExpMaxRelError       = 1e-7;   //!< Bound of relative error of exp.
+	const double kLogMaxAbsError       = 5e-8;   //!< Bound of absolute error of log where |log(x)| < 0.5.
+	const double kLogMaxRelError       = 1e-7;   //!< Bound of relative error of log elsewhere.
+	const double kSinCosMaxAbsError    = 1e-7;   //!< Bound of absolute error of sincos for |x| <= 8192.
+	const double kPowMaxRelErrorFactor = 1.5e-7; //!< Bound of relative error of pow divided by (2 + |y * log(x)|).
+
+	/**
+	 * @brief	Exponential of x.
+	 */
+	INLINE float exp(const float x)
+	{
+#ifdef USE_FAST_MATH
+		return _mm_cvtss_f32(Ff::exp(_mm_set_ss(x)));
+#else
+		return std::exp(x);
+#endif
+	}
+
+	/**
+	 * @brief	Natural logarithm of positive x.
+	 */
+	INLINE float log(const float x)
+	{
+#ifdef USE_FAST_MATH
+		return _mm_cvtss_f32(Ff::log(_mm_set_ss(x)));
+#else
+		return std::log(x);
+#endif
+	}
+
+	/**
+	 * @brief	x raised to the power of y.
+	 */
+	INLINE float pow(const float x, const float y)
+	{
+#ifdef USE_FAST_MATH
+		if (x <= 0.f)
+			return std::pow(x, y);
+		return _mm_cvtss_f32(Ff::exp(_mm_set_ss(y * _mm_cvtss_f32(Ff::log(_mm_set_ss(x))))));
+#else
+		return std::pow(x, y);
+#endif
+	}
+
+	/**
+	 * @brief	Sine and cosine of x computed together, wraps Ff::sincos (sincos_ps of sse_mathfun).
+	 */
+	INLINE void sincos(const float x, float& oSin, float& oCos)
+	{
+#ifdef USE_FAST_MATH
+		__m128 s, c;
+		Ff::sincos(_mm_set_ss(x), s, c);
+		oSin = _mm_cvtss_f32(s);
+		oCos = _mm_cvtss_f32(c);
+#else
+		oSin = std::sin(x);
+		oCos = std::cos(x);
+#endif
+	}
+}
+
+#endif //__FASTMATH_HXX__
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __FASTMATHTEST_HXX__
+#define __FASTMATHTEST_HXX__
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "FastMath.hxx"
+
+namespace FastMath
+{
+	/**
+	 * @brief	Sweeps the FastMath functions over their documented domains, compares them to libm (in double
+	 * 			precision) and prints the largest errors found (-fastmath_test option).
+	 * 			
+	 * 			The bounds checked are the ones stated in FastMath.hxx. Without USE_FAST_MATH the functions
+	 * 			call libm and the test trivially passes.
+	 *
+	 * @param	aSampleCount	Number of samples of each sweep.
+	 *
+	 * @return	True if all errors are within the bounds.
+	 */
+	inline bool RunTest(const int aSampleCount = 10000000)
+	{
+		const double n = double(aSampleCount);
+		double expRel = 0, logAbs = 0, logRel = 0, sincosAbs = 0, powRel = 0;
+
+		// exp, x uniform in [-87, 88]
+		for (int i = 0; i <= aSampleCount; i++)
+		{
+			const float x = float(-87.0 + 175.0 * i / n);
+			const double ref = std::exp(double(x));
+			expRel = std::max(expRel, std::fabs(FastMath::exp(x) - ref) / ref);
+		}
+
+		// log, x log-uniform over positive normalized floats, absolute error where |log(x)| < 0.5 and
+		// relative error elsewhere
+		for (int i = 0; i <= aSampleCount; i++)
+		{
+			const float x = float(std::exp(-87.3 + 176.0 * i / n));
+			const double ref = std::log(double(x));
+			const double err = std::fabs(FastMath::log(x) - ref);
+			if (std::fabs(ref) < 0.5)
+				logAbs = std::max(logAbs, err);
+			else
+				logRel = std::max(logRel, err / std::fabs(ref));
+		}
+
+		// sincos, x uniform in [-8192, 8192]
+		for (int i = 0; i <= aSampleCount; i++)
+		{
+			const float x = float(-8192.0 + 16384.0 * i / n);
+			float s, c;
+			FastMath::sincos(x, s, c);
+			sincosAbs = std::max(sincosAbs, std::max(std::fabs(s - std::sin(double(x))), std::fabs(c - std::cos(double(x)))));
+		}
+
+		// pow, x log-uniform in [e^-20, e^20] and y uniform in [-4, 4] (a stratified grid), relative error
+		// divided by its bound factor (2 + |y * log(x)|), results out of the float range are skipped
+		const int side = std::max(1, int(std::sqrt(n)));
+		for (int i = 0; i <= side; i++)
+		{
+			const float x = float(std::exp(-20.0 + 40.0 * i / side));
+			for (int j = 0; j <= side; j++)
+			{
+				const float y = float(-4.0 + 8.0 * j / side);
+				const double ref = std::pow(double(x), double(y));
+				if (ref < 1e-37 || ref > 1e37)
+					continue;
+				const double err = std::fabs(FastMath::pow(x, y) - ref) / ref;
+				powRel = std::max(powRel, err / (2 + std::fabs(y * std::log(double(x)))));
+			}
+		}
+
+		const bool expOk    = expRel <= kExpMaxRelError;
+		const bool logOk    = logAbs <= kLogMaxAbsError && logRel <= kLogMaxRelError;
+		const bool sincosOk = sincosAbs <= kSinCosMaxAbsError;
+		const bool powOk    = powRel <= kPowMaxRelErrorFactor;
+
+		printf("FastMath vs libm, %d samples per sweep:\n", aSampleCount);
+		printf("  exp     max rel error %.3g (bound %.3g) %s\n", expRel, kExpMaxRelError, expOk ? "ok" : "FAILED");
+		printf("  log     max abs error %.3g (bound %.3g), max rel error %.3g (bound %.3g) %s\n",
+			logAbs, kLogMaxAbsError, logRel, kLogMaxRelError, logOk ? "ok" : "FAILED");
+		printf("  sincos  max abs error %.3g (bound %.3g) %s\n", sincosAbs, kSinCosMaxAbsError, sincosOk ? "ok" : "FAILED");
+		printf("  pow     max rel error / (2 + |y log x|) %.3g (bound %.3g) %s\n", powRel, kPowMaxRelErrorFactor, powOk ? "ok" : "FAILED");
+
+		return expOk && logOk && sincosOk && powOk;
+	}
+}
+
+#endif //__FASTMATHTEST_HXX__
@@ -68,14 +68,14 @@ public:
         const Vec2f& aSample,
         const Rgb& aColor)
     {
-        if(aSample.get(0) < 0 || aSample.get(0) >= mResolution.get(0))
+        if(aSample.get(0) < mMinX || aSample.get(0) >= mMinX + mResX)
             return;
 
-        if(aSample.get(1) < 0 || aSample.get(1) >= mResolution.get(1))
+        if(aSample.get(1) < mMinY || aSample.get(1) >= mMinY + mResY)
             return;
 
-        int x = int(aSample.get(0));
-        int y = int(aSample.get(1));
+        int x = int(aSample.get(0)) - mMinX;
+        int y = int(aSample.get(1)) - mMinY;
 
         mColor[x + y * mResX] = mColor[x + y * mResX] + aColor;
     }
@@ -89,10 +89,29 @@ public:
      * @param	aResolution	Resolution of the framebuffer.
      */
     void Setup(const Vec2f& aResolution)
+    {
+        Setup(aResolution, 0, 0, int(aResolution.get(0)), int(aResolution.get(1)));
+    }
+
+    /**
+     * @brief	Setups the framebuffer storing only a window of the image.
+     * 			
+     * 			Samples outside the window are ignored and saved images have the size of the window
+     * 			(OpenEXR keeps the whole image as its display window).
+     *
+     * @param	aResolution	Resolution of the whole image.
+     * @param	aMinX	   	Left column of the window.
+     * @param	aMinY	   	Top row of the window.
+     * @param	aMaxX	   	Column after the right end of the window.
+     * @param	aMaxY	   	Row after the bottom end of the window.
+     */
+    void Setup(const Vec2f& aResolution, int aMinX, int aMinY, int aMaxX, int aMaxY)
     {
         mResolution = aResolution;
-        mResX = int(aResolution.get(0));
-        mResY = int(aResolution.get(1));
+        mMinX = aMinX;
+        mMinY = aMinY;
+        mResX = aMaxX - aMinX;
+        mResY = aMaxY - aMinY;
         mColor.resize(mResX * mResY);
         Clear();
     }
@@ -128,6 +147,30 @@ public:
 			mColor[i] = mColor[i] + aOther.mColor[i] * aScale;
 	}
 
+	/**
+	 * @brief	Adds other framebuffers scaled, in parallel.
+	 * 			
+	 * 			Pixels are distributed among threads and each pixel sums all the other framebuffers at
+	 * 			once, so the result is written only once and no temporary copies are needed.
+	 *
+	 * @param	aOthers	The other framebuffers to add (of the same resolution).
+	 * @param	aScales	The factors to scale the values of the corresponding other framebuffers.
+	 */
+	void AddScaled(const std::vector<const Framebuffer*>& aOthers, const std::vector<float>& aScales)
+	{
+		const int count = (int)aOthers.size();
+		const int size = (int)mColor.size();
+
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < size; i++)
+		{
+			Rgb sum = mColor[i];
+			for (int j = 0; j < count; j++)
+				sum = sum + aOthers[j]->mColor[i] * aScales[j];
+			mColor[i] = sum;
+		}
+	}
+
     /**
      * @brief	Scales values in this framebuffer.
      *
@@ -241,6 +284,16 @@ public:
         uint   mImportantColors; //!< 0 - all are important.
     };
 
+	/**
+	 * @brief	Gets memory taken by the pixels.
+	 *
+	 * @return	The size in bytes.
+	 */
+	size_t GetMemorySize() const
+	{
+		return mColor.capacity() * sizeof(Rgb);
+	}
+
 	/**
 	 * @brief	Saves this framebuffer as an image in a format corresponding to the given file name
 	 * 			(BMP, HDR, OpenEXR).
@@ -379,7 +432,9 @@ private:
 	{
 		try
 		{
-			Imf::Header header(mResX, mResY);
+			const Imath::Box2i displayWindow(Imath::V2i(0, 0), Imath::V2i(int(mResolution.get(0)) - 1, int(mResolution.get(1)) - 1));
+			const Imath::Box2i dataWindow(Imath::V2i(mMinX, mMinY), Imath::V2i(mMinX + mResX - 1, mMinY + mResY - 1));
+			Imf::Header header(displayWindow, dataWindow);
 			header.channels().insert("R", Imf::Channel(Imf::FLOAT));
 			header.channels().insert("G", Imf::Channel(Imf::FLOAT));
 			header.channels().insert("B", Imf::Channel(Imf::FLOAT));
@@ -388,7 +443,8 @@ private:
 
 			Imf::FrameBuffer frameBuffer;
 
-			char * pixels = reinterpret_cast<char *>(&mColor[0]);
+			// Slices are addressed by absolute pixel coordinates of the data window
+			char * pixels = reinterpret_cast<char *>(&mColor[0]) - (mMinX + mMinY * mResX) * sizeof(Rgb);
 			frameBuffer.insert("R",					// name
 				Imf::Slice(Imf::FLOAT,			// type
 				pixels,		// base
@@ -418,9 +474,11 @@ private:
 	}
 
     std::vector<Rgb>   mColor;      //!< The color
-    Vec2f              mResolution; //!< Resolution of the framebuffer.
-    int                mResX;       //!< Width of the framebuffer.
-    int                mResY;       //!< Height of the framebuffer.
+    Vec2f              mResolution; //!< Resolution of the whole image.
+    int                mMinX;       //!< Left column of the stored window.
+    int                mMinY;       //!< Top row of the stored window.
+    int                mResX;       //!< Width of the stored window.
+    int                mResY;       //!< Height of the stored window.
 };
 
 #endif //__FRAMEBUFFER_HXX__
\ No newline at end of file
@@ -31,6 +31,8 @@
 #include <cmath>
 
 #include "Utils2.hxx"
+#include "MemoryBudget.hxx"
+#include "..\Structs\Vector8.hxx"
 
 /**
  * @brief	A hash grid used for photon lookup in surface photon mapping (PPM, BPM) and PP3D.
@@ -38,6 +40,11 @@
 class HashGrid
 {
 public:
+    HashGrid() : mMemory(MemoryBudget::kHashGrids)
+    {
+        mUseAvx = Sse::cpuHasAvx();
+    }
+
     void Reserve(int aNumCells)
     {
         mCellEnds.resize(aNumCells);
@@ -109,6 +116,23 @@ public:
         // now mCellEnds[x] points to the index right after the last
         // element of cell x
 
+        // copy positions in the cell order into SoA arrays for the batch distance tests,
+        // padded so that a batch can be loaded past the last particle
+        const size_t paddedCount = matchedCount + 8;
+        mPositionsX.resize(paddedCount, 0.f);
+        mPositionsY.resize(paddedCount, 0.f);
+        mPositionsZ.resize(paddedCount, 0.f);
+        for(size_t i=0; i<matchedCount; i++)
+        {
+            const Pos &pos = aParticles[mIndices[i]].GetPosition();
+            mPositionsX[i] = pos.x();
+            mPositionsY[i] = pos.y();
+            mPositionsZ[i] = pos.z();
+        }
+
+        mMemory.Set((mIndices.capacity() + mCellEnds.capacity()) * sizeof(int) +
+            (mPositionsX.capacity() + mPositionsY.capacity() + mPositionsZ.capacity()) * sizeof(float));
+
         //// DEBUG
         //for(size_t i=0; i<aParticles.size(); i++)
         //{
@@ -173,21 +197,85 @@ public:
             case 7: activeRange = GetCellRange(GetCellIndex(pxo, pyo, pzo)); break;
             }
 
-            for(; activeRange[0] < activeRange[1]; activeRange[0]++)
-            {
-                const int particleIndex   = mIndices[activeRange[0]];
-                const tParticle &particle = aParticles[particleIndex];
+            if(mUseAvx)
+                ProcessRange8(aParticles, aQuery, queryPos, activeRange[0], activeRange[1]);
+            else
+                ProcessRange4(aParticles, aQuery, queryPos, activeRange[0], activeRange[1]);
+        }
+    }
 
-                const float distSqr =
-                    (aQuery.GetPosition() - particle.GetPosition()).square();
+private:
 
-                if(distSqr <= mRadiusSqr)
-                    aQuery.Process(particle);
-            }
+    // Tests distances of particles in the range 8 at a time (AVX)
+    template<typename tParticle, typename tQuery>
+    void ProcessRange8(
+        const std::vector<tParticle> &aParticles,
+        tQuery& aQuery,
+        const Pos& aQueryPos,
+        const int aBegin,
+        const int aEnd)
+    {
+        const Pos8 queryPos(aQueryPos);
+
+        for(int i=aBegin; i<aEnd; i+=8)
+        {
+            const Pos8 pos(&mPositionsX[i], &mPositionsY[i], &mPositionsZ[i]);
+
+            int mask = (queryPos.squareDistance(pos) <= mRadiusSqr).mask();
+            if(aEnd - i < 8)
+                mask &= (1 << (aEnd - i)) - 1;
+
+            ProcessMask(aParticles, aQuery, i, mask);
         }
+
+        // avoid AVX-SSE transition penalty in the following SSE code
+        _mm256_zeroupper();
     }
 
-private:
+    // Tests distances of particles in the range 4 at a time (SSE)
+    template<typename tParticle, typename tQuery>
+    void ProcessRange4(
+        const std::vector<tParticle> &aParticles,
+        tQuery& aQuery,
+        const Pos& aQueryPos,
+        const int aBegin,
+        const int aEnd)
+    {
+        const Float4 queryX(aQueryPos.x());
+        const Float4 queryY(aQueryPos.y());
+        const Float4 queryZ(aQueryPos.z());
+
+        for(int i=aBegin; i<aEnd; i+=4)
+        {
+            const Float4 dx = queryX - Float4(_mm_loadu_ps(&mPositionsX[i]));
+            const Float4 dy = queryY - Float4(_mm_loadu_ps(&mPositionsY[i]));
+            const Float4 dz = queryZ - Float4(_mm_loadu_ps(&mPositionsZ[i]));
+
+            int mask = (dx * dx + dy * dy + dz * dz <= mRadiusSqr).mask();
+            if(aEnd - i < 4)
+                mask &= (1 << (aEnd - i)) - 1;
+
+            ProcessMask(aParticles, aQuery, i, mask);
+        }
+    }
+
+    // Processes particles of the batch starting at aFirst with set bits in the mask
+    template<typename tParticle, typename tQuery>
+    INLINE void ProcessMask(
+        const std::vector<tParticle> &aParticles,
+        tQuery& aQuery,
+        const int aFirst,
+        int aMask)
+    {
+        while(aMask)
+        {
+            unsigned long lane;
+            _BitScanForward(&lane, (unsigned long)aMask);
+            aMask &= aMask - 1;
+
+            aQuery.Process(aParticles[mIndices[aFirst + lane]]);
+        }
+    }
 
     Vec2i GetCellRange(int aCellIndex) const
     {
@@ -224,6 +312,15 @@ private:
     std::vector<int> mIndices;
     std::vector<int> mCellEnds;
 
+    // positions of particles in the order of mIndices (SoA)
+    std::vector<float> mPositionsX;
+    std::vector<float> mPositionsY;
+    std::vector<float> mPositionsZ;
+
+    bool mUseAvx; // whether to use 8-wide distance tests, chosen at runtime
+
+    MemoryBudget::Tracker mMemory; // reported size of the arrays above
+
     float mRadius;
     float mRadiusSqr;
     float mCellSize;
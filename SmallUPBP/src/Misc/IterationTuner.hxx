@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+
+#ifndef __ITERATIONTUNER_HXX__
+#define __ITERATIONTUNER_HXX__
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+
+#include "..\Misc\Defs.hxx"
+
+/**
+ * @brief	Feedback control of per-iteration parameters of a renderer.
+ *			
+ *			After each iteration the number of light sub-paths is scaled so that the ratio of light
+ *			to camera pass times approaches the target, and the BB1D grid resolution is scaled so
+ *			that the mean number of beams in non-empty cells approaches the target occupancy. The
+ *			maximum number of tested beams in a cell keeps its initial ratio to the occupancy, applied
+ *			to the target occupancy the grid is steered to.
+ *			Steps are damped (square root) and limited to a factor of two per iteration.
+ *
+ *			Each renderer (each thread and each engine of a pipelined renderer) owns its tuner, so the
+ *			tuned parameters of different renderers may diverge. Radius reduction therefore takes the mean
+ *			path count of all light passes of all renderers from a shared \c LightPathCounter, the radii
+ *			still depend on which passes finished first, so tuned renders are not repeatable. With pipelining the light pass of the next iteration
+ *			overlaps the camera pass of the current one, both measured times include the contention of
+ *			the other pass, so the time ratio is only an estimate of the ratio without overlapping.
+ */
+class IterationTuner
+{
+public:
+
+	IterationTuner() : mTargetTimeRatio(0), mTargetOccupancy(0), mMinPathCount(0), mMaxPathCount(0), mMaxGridSize(kMaxGridSize), mMaxBeamsPerOccupancy(-1), mVerbose(0) {}
+
+	/**
+	 * @brief	Setups the tuner.
+	 *
+	 * @param	aTargetTimeRatio	Target ratio of light to camera pass times, 0 keeps the path count.
+	 * @param	aTargetOccupancy	Target mean number of beams in non-empty cells, 0 keeps the grid.
+	 * @param	aPathCount			Initial number of light sub-paths per iteration.
+	 * @param	aVerbose			Whether to print the parameters.
+	 * @param	aMaxPathCount		Upper limit of the number of light sub-paths (e.g. from a memory budget), 0 means 16 times the initial one.
+	 * @param	aMaxGridSize		Upper limit of the grid resolution (e.g. from a memory budget), 0 means the default limit.
+	 */
+	void Setup(const float aTargetTimeRatio, const float aTargetOccupancy, const float aPathCount, const int aVerbose, const float aMaxPathCount = 0, const uint aMaxGridSize = 0)
+	{
+		mTargetTimeRatio = aTargetTimeRatio;
+		mTargetOccupancy = aTargetOccupancy;
+		mMinPathCount = std::max(1.0f, std::floor(aPathCount / 16));
+		mMaxPathCount = aMaxPathCount > 0 ? std::min(aPathCount * 16, aMaxPathCount) : aPathCount * 16;
+		mMaxGridSize = aMaxGridSize > 0 ? std::min<uint>(kMaxGridSize, aMaxGridSize) : kMaxGridSize;
+		mMaxBeamsPerOccupancy = -1;
+		mVerbose = aVerbose;
+	}
+
+	bool IsSetup() const { return mTargetTimeRatio > 0 || mTargetOccupancy > 0; }
+
+	/**
+	 * @brief	Proposes parameters of the next iteration from measurements of the last one.
+	 *
+	 * @param	aLightTime				Time of the light pass (tracing and builds) in seconds.
+	 * @param	aCameraTime				Time of the camera pass in seconds.
+	 * @param	aOccupancy				Mean number of beams in non-empty cells, 0 if no grid was built.
+	 * @param [in,out]	ioPathCount		Number of light sub-paths per iteration.
+	 * @param [in,out]	ioGridSize		Grid resolution.
+	 * @param [in,out]	ioMaxBeamsInCell	Maximum number of tested beams in a cell, 0 means no restriction.
+	 */
+	void Update(
+		const double aLightTime,
+		const double aCameraTime,
+		const float  aOccupancy,
+		float        &ioPathCount,
+		uint         &ioGridSize,
+		uint         &ioMaxBeamsInCell)
+	{
+		if (mTargetTimeRatio > 0 && aLightTime > 0 && aCameraTime > 0)
+		{
+			// Camera time also grows with the path count (more vertices and beams to query), hence the damping
+			const float ratio = float(aLightTime / aCameraTime);
+			const float scale = Clamp(std::sqrt(mTargetTimeRatio / ratio));
+			ioPathCount = std::max(mMinPathCount, std::min(mMaxPathCount, std::floor(ioPathCount * scale + 0.5f)));
+		}
+
+		if (mTargetOccupancy > 0 && aOccupancy > 0)
+		{
+			if (mMaxBeamsPerOccupancy < 0)
+				mMaxBeamsPerOccupancy = ioMaxBeamsInCell / aOccupancy;
+
+			// Occupancy falls roughly with the square of the resolution (beams cross proportionally more cells)
+			const float scale = Clamp(std::sqrt(aOccupancy / mTargetOccupancy));
+			ioGridSize = std::max<uint>(kMinGridSize, std::min<uint>(mMaxGridSize, uint(ioGridSize * scale + 0.5f)));
+
+			if (ioMaxBeamsInCell)
+				ioMaxBeamsInCell = std::max(1u, uint(std::ceil(mMaxBeamsPerOccupancy * mTargetOccupancy)));
+		}
+
+		if (mVerbose)
+			std::cout << "iteration tuner: light paths " << ioPathCount << ", grid size " << ioGridSize << ", max beams in cell " << ioMaxBeamsInCell << std::endl;
+	}
+
+private:
+
+	enum { kMinGridSize = 16, kMaxGridSize = 1024 };
+
+	static float Clamp(const float aScale)
+	{
+		return std::max(0.5f, std::min(2.0f, aScale));
+	}
+
+	float mTargetTimeRatio;       //!< Target ratio of light to camera pass times.
+	float mTargetOccupancy;       //!< Target mean number of beams in non-empty cells.
+	float mMinPathCount;          //!< Lower bound of the number of light sub-paths.
+	float mMaxPathCount;          //!< Upper bound of the number of light sub-paths.
+	uint  mMaxGridSize;           //!< Upper bound of the grid resolution.
+	float mMaxBeamsPerOccupancy;  //!< Initial ratio of the cell cap to the occupancy, negative before the first grid.
+	int   mVerbose;               //!< Whether to print the parameters.
+};
+
+/**
+ * @brief	Light sub-paths traced by all renderers of a render.
+ *			
+ *			Shared by the renderers so that radius reduction counts the paths of all threads and engines,
+ *			whatever path counts their tuners chose. Path counts are summed as integers, so the sums do not
+ *			depend on the order of the passes.
+ */
+class LightPathCounter
+{
+public:
+
+	LightPathCounter() : mPathCountSum(0), mBB1DPathCountSum(0), mPassCount(0) {}
+
+	/**
+	 * @brief	Adds a light pass.
+	 *
+	 * @param	aPathCount		Number of light sub-paths of the pass.
+	 * @param	aBB1DPathCount	Number of light sub-paths generating photon beams in the pass.
+	 */
+	void AddPass(const float aPathCount, const float aBB1DPathCount)
+	{
+		mPathCountSum += (long long)aPathCount;
+		mBB1DPathCountSum += (long long)aBB1DPathCount;
+		++mPassCount;
+	}
+
+	// Mean number of light sub-paths of the passes added so far
+	float GetMeanPathCount() const
+	{
+		return float(double(mPathCountSum) / std::max(1LL, (long long)mPassCount));
+	}
+
+	// Mean number of light sub-paths generating photon beams of the passes added so far
+	float GetMeanBB1DPathCount() const
+	{
+		return float(double(mBB1DPathCountSum) / std::max(1LL, (long long)mPassCount));
+	}
+
+private:
+
+	std::atomic<long long> mPathCountSum;     //!< Sum of light sub-path counts of all passes.
+	std::atomic<long long> mBB1DPathCountSum; //!< Sum of light sub-path counts generating photon beams of all passes.
+	std::atomic<int>       mPassCount;        //!< Number of passes.
+};
+
+#endif //__ITERATIONTUNER_HXX__
@@ -210,6 +210,8 @@ public:
     void TraverseBF(Tlist &list) const;
 
   int GetNumPoints() const { return _numPoints; }
+  /// Memory taken by the nodes
+  size_t GetMemorySize() const { return _points.capacity() * sizeof(CTreeNode); }
 
   const T* GetPoint(int i) const { return _points[i+1].pt; }
         T* GetPoint(int i)       { return _points[i+1].pt; }
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+
+#ifndef __MEMORYBUDGET_HXX__
+#define __MEMORYBUDGET_HXX__
+
+#include <atomic>
+#include <cstdio>
+
+/**
+ * @brief	Process-wide accounting of memory of the rendering structures.
+ *			
+ *			Each structure instance owns a \c Tracker of its category and reports its current size
+ *			to it after (re)building. Trackers of all threads add to one total per category, whose
+ *			peaks are printed at the end of rendering.
+ */
+class MemoryBudget
+{
+public:
+
+	enum Category
+	{
+		kFramebuffers = 0, //!< Framebuffers and debug images of renderers and the accumulated result.
+		kLightData,        //!< Light vertices, photon beams and their indices.
+		kHashGrids,        //!< Hash grids of SURF and PP3D.
+		kPB2DTrees,        //!< Photons and BVHs of PB2D (embree BVH estimated).
+		kBeamGrids,        //!< Grids of BB1D including temporary arrays of builds.
+		kKnnTrees,         //!< Temporary k-NN trees of photon and beam radius calculation.
+		kCategoryCount
+	};
+
+	/**
+	 * @brief	Memory reported by one structure instance.
+	 */
+	class Tracker
+	{
+	public:
+
+		explicit Tracker(const Category aCategory) : mCategory(aCategory), mBytes(0) {}
+
+		~Tracker() { Set(0); }
+
+		// Replaces the reported size of the structure
+		void Set(const size_t aBytes)
+		{
+			Counters &counters = GetCounters();
+			const long long delta = (long long)aBytes - (long long)mBytes;
+			mBytes = aBytes;
+
+			UpdatePeak(counters.mPeak[mCategory], counters.mCurrent[mCategory] += delta);
+			UpdatePeak(counters.mTotalPeak, counters.mTotal += delta);
+		}
+
+	private:
+
+		Tracker(const Tracker&);
+		Tracker& operator=(const Tracker&);
+
+		Category mCategory;
+		size_t   mBytes;
+	};
+
+	// Clears all counters, to be called from the main thread before rendering
+	static void Reset()
+	{
+		Counters &counters = GetCounters();
+		for (int i = 0; i < kCategoryCount; ++i)
+		{
+			counters.mCurrent[i] = 0;
+			counters.mPeak[i] = 0;
+		}
+		counters.mTotal = 0;
+		counters.mTotalPeak = 0;
+	}
+
+	static size_t GetPeak(const Category aCategory)
+	{
+		return (size_t)GetCounters().mPeak[aCategory].load();
+	}
+
+	static size_t GetTotalPeak()
+	{
+		return (size_t)GetCounters().mTotalPeak.load();
+	}
+
+	// Prints peak memory of all categories in MB
+	static void Print()
+	{
+		static const char* names[kCategoryCount] = { "framebuffers", "light data", "hash grids", "pb2d trees", "bb1d grids", "knn trees" };
+
+		printf("peak memory %.1f MB (", GetTotalPeak() / (1024.f * 1024.f));
+		for (int i = 0; i < kCategoryCount; ++i)
+			printf("%s%s %.1f", i ? ", " : "", names[i], GetPeak(Category(i)) / (1024.f * 1024.f));
+		printf(")\n");
+	}
+
+private:
+
+	struct Counters
+	{
+		std::atomic<long long> mCurrent[kCategoryCount];
+		std::atomic<long long> mPeak[kCategoryCount];
+		std::atomic<long long> mTotal;
+		std::atomic<long long> mTotalPeak;
+	};
+
+	static Counters& GetCounters()
+	{
+		static Counters counters;
+		return counters;
+	}
+
+	static void UpdatePeak(std::atomic<long long> &aPeak, const long long aValue)
+	{
+		long long peak = aPeak.load();
+		while (aValue > peak && !aPeak.compare_exchange_weak(peak, aValue));
+	}
+};
+
+#endif //__MEMORYBUDGET_HXX__
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __MORTONORDER_HXX__
+#define __MORTONORDER_HXX__
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include "..\Structs\Vector3.hxx"
+
+// Ordering of items along the Morton (Z-order) curve, so that spatially close items are close in memory.
+namespace MortonOrder {
+
+	/**
+	 * @brief	Spreads the lowest 21 bits of the value, so that there are two zero bits between each two of them.
+	 *
+	 * @param	aValue	The value.
+	 *
+	 * @return	The spread value.
+	 */
+	INLINE unsigned long long spreadBits(unsigned long long aValue) {
+		aValue &= 0x1fffff;
+		aValue = (aValue | aValue << 32) & 0x1f00000000ffffULL;
+		aValue = (aValue | aValue << 16) & 0x1f0000ff0000ffULL;
+		aValue = (aValue | aValue << 8) & 0x100f00f00f00f00fULL;
+		aValue = (aValue | aValue << 4) & 0x10c30c30c30c30c3ULL;
+		aValue = (aValue | aValue << 2) & 0x1249249249249249ULL;
+		return aValue;
+	}
+
+	/**
+	 * @brief	Computes the Morton code of the position quantized to 21 bits per axis within the given box.
+	 *
+	 * @param	aPos		The position.
+	 * @param	aBoxMin 	Minimum corner of the box containing all positions.
+	 * @param	aInvExtent	Inverse size of the box along each axis (0 for flat axes).
+	 *
+	 * @return	The Morton code.
+	 */
+	INLINE unsigned long long code(const Pos &aPos, const Pos &aBoxMin, const Pos &aInvExtent) {
+		unsigned long long result = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const float t = std::min(std::max((aPos[i] - aBoxMin[i]) * aInvExtent[i], 0.f), 1.f);
+			result |= spreadBits((unsigned long long)(t * 2097151.f)) << i;
+		}
+		return result;
+	}
+
+	/**
+	 * @brief	Computes the order of the items along the Morton curve.
+	 *
+	 * @param	aItems		The items.
+	 * @param	aPosition	Functor returning position of an item.
+	 * @param [out]	oOrder	Index of the item that should be at each position of the ordered array.
+	 */
+	template<typename tItem, typename tPosition>
+	void computeOrder(const std::vector<tItem> &aItems, const tPosition &aPosition, std::vector<int> &oOrder) {
+		const int count = (int)aItems.size();
+		oOrder.resize(count);
+		if (count == 0)
+			return;
+
+		Pos boxMin(1e36f), boxMax(-1e36f);
+		for (int i = 0; i < count; i++)
+		{
+			const Pos pos = aPosition(aItems[i]);
+			boxMin = Pos::min(boxMin, pos);
+			boxMax = Pos::max(boxMax, pos);
+		}
+
+		Pos invExtent;
+		for (int i = 0; i < 3; i++)
+			invExtent[i] = boxMax[i] > boxMin[i] ? 1.f / (boxMax[i] - boxMin[i]) : 0.f;
+
+		std::vector<std::pair<unsigned long long, int> > codes(count);
+		for (int i = 0; i < count; i++)
+			codes[i] = std::make_pair(code(aPosition(aItems[i]), boxMin, invExtent), i);
+
+		std::sort(codes.begin(), codes.end());
+
+		for (int i = 0; i < count; i++)
+			oOrder[i] = codes[i].second;
+	}
+
+	/**
+	 * @brief	Reorders the items in place according to the given order, following cycles of the permutation.
+	 *
+	 * @param [in,out]	aoItems	The items.
+	 * @param	aOrder		   	Index of the item that should be at each position, as computed by \c computeOrder().
+	 */
+	template<typename tItem>
+	void apply(std::vector<tItem> &aoItems, const std::vector<int> &aOrder) {
+		UPBP_ASSERT(aoItems.size() == aOrder.size());
+
+		std::vector<bool> done(aOrder.size(), false);
+		for (size_t start = 0; start < aOrder.size(); start++)
+		{
+			if (done[start])
+				continue;
+
+			// Items of the cycle are moved one position back along the cycle
+			tItem first = aoItems[start];
+			size_t current = start;
+			while ((size_t)aOrder[current] != start)
+			{
+				aoItems[current] = aoItems[aOrder[current]];
+				done[current] = true;
+				current = aOrder[current];
+			}
+			aoItems[current] = first;
+			done[current] = true;
+		}
+	}
+}
+
+#endif //__MORTONORDER_HXX__
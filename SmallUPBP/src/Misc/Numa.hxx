@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __NUMA_HXX__
+#define __NUMA_HXX__
+
+// Include ---------------------------------------------------------------
+#define NOMINMAX
+
+#include <vector>
+#include <string.h>
+#include <winsock2.h>
+#include <windows.h>
+
+// Declaration -----------------------------------------------------------
+
+/**
+ * @brief	NUMA topology of the machine, used for placing render threads on nodes.
+ *
+ *			Render threads are assigned to nodes in contiguous blocks (threads 0..k-1 to node 0 etc.)
+ *			and pinned to processors of their node. Windows allocates pages on the node of the thread
+ *			that touches them first, so everything a pinned thread allocates and initializes (its
+ *			renderer, framebuffer, light vertices, photon beams and acceleration structures) stays in
+ *			memory local to that node.
+ */
+class NumaTopology
+{
+public:
+
+	/**
+	 * @brief	Constructor, detects nodes of the machine.
+	 */
+	NumaTopology()
+	{
+		Detect();
+	}
+
+	/**
+	 * @brief	Detects nodes of the machine and their processors.
+	 */
+	void Detect()
+	{
+		mNodes.clear();
+
+		ULONG highestNode = 0;
+		if (!GetNumaHighestNodeNumber(&highestNode))
+			return;
+
+		for (ULONG node = 0; node <= highestNode; ++node)
+		{
+			GROUP_AFFINITY affinity;
+			memset(&affinity, 0, sizeof(GROUP_AFFINITY));
+
+			// Nodes without processors (memory only nodes) are skipped
+			if (GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Mask != 0)
+				mNodes.push_back(affinity);
+		}
+	}
+
+	/**
+	 * @brief	Gets number of detected nodes with at least one processor.
+	 */
+	int GetNodeCount() const
+	{
+		return (int)mNodes.size();
+	}
+
+	/**
+	 * @brief	Gets node assigned to the given thread.
+	 *
+	 * @param	aThreadIndex	Index of the thread.
+	 * @param	aThreadCount	Number of all threads.
+	 *
+	 * @return	Index of the node (0 if the machine is not NUMA).
+	 */
+	int GetThreadNode(int aThreadIndex, int aThreadCount) const
+	{
+		if (mNodes.size() <= 1 || aThreadCount <= 0)
+			return 0;
+
+		return (int)(((long long)aThreadIndex * (long long)mNodes.size()) / aThreadCount);
+	}
+
+	/**
+	 * @brief	Pins the calling thread to processors of its node.
+	 *
+	 * @param	aThreadIndex	Index of the calling thread.
+	 * @param	aThreadCount	Number of all threads.
+	 *
+	 * @return	Whether the thread was pinned.
+	 */
+	bool PinCurrentThread(int aThreadIndex, int aThreadCount) const
+	{
+		if (mNodes.size() <= 1)
+			return false;
+
+		GROUP_AFFINITY affinity = mNodes[GetThreadNode(aThreadIndex, aThreadCount)];
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL) != 0;
+	}
+
+private:
+
+	std::vector<GROUP_AFFINITY> mNodes; //!< Processors of nodes with at least one processor.
+};
+
+#endif // __NUMA_HXX__
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __QUERYTRUNCATION_HXX__
+#define __QUERYTRUNCATION_HXX__
+
+#include <cmath>
+
+#include "common\ray.h"
+#include "..\Misc\Rng.hxx"
+#include "..\Scene\Media.hxx"
+
+/**
+ * @brief	Transmittance-bounded truncation of BB1D and PB2D query traversal.
+ *			
+ *			A long query beam is traversed only while its attenuation (times the weight of the
+ *			roulette survived so far) stays above a threshold. Below it the traversal is continued
+ *			by Russian roulette and the survivors are reweighted, so the estimate stays unbiased.
+ *			At segment boundaries the roulette is played with probability proportional to the
+ *			attenuation. Inside homogeneous media the distance at which the attenuation bound falls
+ *			to half of the threshold is known analytically, so the segment is cut there and
+ *			every further halving of the bound is survived with probability 1/2. The cuts are passed
+ *			to the intersection callbacks in \c embree::AdditionalRayDataForMis, which weight
+ *			the hits beyond them (see \c AdditionalRayDataForMis::truncationWeight()).
+ */
+class QueryTruncation
+{
+public:
+
+	QueryTruncation() : mThreshold(0), mRng(NULL), mWeight(1), mCutWeight(1), mTerminated(false) {}
+
+	/**
+	 * @brief	Setups the truncation for a new query ray.
+	 *
+	 * @param	aThreshold	Attenuation below which the query traversal is played by roulette.
+	 * @param [in,out]	aRng	Random number generator of the rendering thread.
+	 */
+	void Setup(const float aThreshold, Rng &aRng)
+	{
+		mThreshold = aThreshold;
+		mRng = &aRng;
+		mWeight = 1.0f;
+		mCutWeight = 1.0f;
+		mTerminated = false;
+	}
+
+	/**
+	 * @brief	Decides how far a query segment is traversed.
+	 *
+	 * @param	aAttenuation	  	Attenuation of the query ray at the segment begin.
+	 * @param	aMedium			  	Medium of the segment.
+	 * @param	aDistMin		  	Distance of the segment begin from the ray origin.
+	 * @param [in,out]	ioDistMax 	Distance of the segment end, shortened if the traversal is
+	 * 								terminated inside the segment.
+	 * @param [in,out]	oData	  	Data for intersection callbacks, gets the in-segment cuts.
+	 *
+	 * @return	Weight of the segment contribution, 0 if the query is terminated before the segment.
+	 */
+	float BeginSegment(const Rgb &aAttenuation, const AbstractMedium *aMedium, const float aDistMin, float &ioDistMax, embree::AdditionalRayDataForMis &oData)
+	{
+		float bound = mWeight * aAttenuation.max();
+		if (bound < mThreshold)
+		{
+			const float survivalProb = bound / mThreshold;
+			if (mRng->GetFloat() >= survivalProb)
+				return 0.0f;
+			mWeight /= survivalProb;
+			bound = mThreshold;
+		}
+
+		// Inside the segment every halving of the bound is survived with probability 1/2.
+		const float cutSurvivalProb = 0.5f;
+		mCutWeight = 1.0f;
+		if (aMedium->IsHomogeneous())
+		{
+			const float minAttenuationCoef = ((const HomogeneousMedium *)aMedium)->GetAttenuationCoef().min();
+			if (minAttenuationCoef > 0)
+			{
+				const float step = std::log(1.0f / cutSurvivalProb) / minAttenuationCoef;
+				float cut = aDistMin + std::log(bound / (cutSurvivalProb * mThreshold)) / minAttenuationCoef;
+				if (cut < ioDistMax)
+				{
+					oData.mTruncationDist = cut;
+					oData.mTruncationStep = step;
+					oData.mTruncationInvProb = 1.0f / cutSurvivalProb;
+					for (; cut < ioDistMax; cut += step)
+					{
+						if (mRng->GetFloat() >= cutSurvivalProb)
+						{
+							ioDistMax = cut;
+							mTerminated = true;
+							break;
+						}
+						mCutWeight /= cutSurvivalProb;
+					}
+				}
+			}
+		}
+
+		return mWeight;
+	}
+
+	/**
+	 * @brief	Finishes a query segment.
+	 *
+	 * @param [in,out]	oData	Data for intersection callbacks, the in-segment cuts are cleared.
+	 *
+	 * @return	False if the traversal was terminated inside the segment.
+	 */
+	bool EndSegment(embree::AdditionalRayDataForMis &oData)
+	{
+		oData.mTruncationDist = embree::inf;
+		mWeight *= mCutWeight;
+		return !mTerminated;
+	}
+
+private:
+
+	float mThreshold;
+	Rng*  mRng;
+	float mWeight;     // Weight of the roulette survived at segment boundaries and in previous segments.
+	float mCutWeight;  // Weight of the cuts survived inside the current segment.
+	bool  mTerminated;
+};
+
+#endif //__QUERYTRUNCATION_HXX__
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __QUERYVOLUME_HXX__
+#define __QUERYVOLUME_HXX__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "..\Path\Ray.hxx"
+
+/**
+ * @brief	Coarse voxel volume of regions where merging queries were evaluated.
+ *			
+ *			Queries of a camera pass are recorded into one set of cells, at the end of the pass the set
+ *			is dilated by one cell and becomes the history the next light pass is tested against.
+ *			Positions outside the volume are always reported as queried.
+ */
+class QueryVolume
+{
+public:
+
+	QueryVolume() : mResolution(0), mHasHistory(false) {}
+
+	/**
+	 * @brief	Setups the volume as a cube around the given sphere, clears the history.
+	 *
+	 * @param	aCenter	  	Center of the sphere.
+	 * @param	aRadius   	Radius of the sphere.
+	 * @param	aResolution	Number of cells along each axis.
+	 */
+	void Setup(const Pos &aCenter, const float aRadius, const int aResolution)
+	{
+		mBoxMin = aCenter - Dir(aRadius);
+		mResolution = aResolution;
+		mCellSize = 2.f * aRadius / aResolution;
+		mInvCellSize = 1.f / mCellSize;
+		mRecorded.assign(aResolution * aResolution * aResolution, 0);
+		mQueried.assign(mRecorded.size(), 0);
+		mHasHistory = false;
+	}
+
+	// Whether the volume has been set up
+	bool IsSetup() const
+	{
+		return mResolution > 0;
+	}
+
+	// Whether a camera pass has been recorded yet
+	bool HasHistory() const
+	{
+		return mHasHistory;
+	}
+
+	// Records a query around the given point
+	void RecordPoint(const Pos &aPoint)
+	{
+		int cell[3];
+		if (GetCell(aPoint, cell))
+			mRecorded[GetIndex(cell)] = 1;
+	}
+
+	// Records a query along the given ray segment
+	void RecordSegment(const Ray &aRay, const float aDistMin, const float aDistMax)
+	{
+		const float step = 0.5f * mCellSize;
+		const int steps = std::min((int)((aDistMax - aDistMin) / step), 4 * mResolution);
+		for (int i = 0; i <= steps; ++i)
+			RecordPoint(aRay.target(aDistMin + i * step));
+		RecordPoint(aRay.target(aDistMax));
+	}
+
+	// Makes the recorded queries the history and starts recording anew
+	void EndPass()
+	{
+		mQueried.swap(mRecorded);
+		std::fill(mRecorded.begin(), mRecorded.end(), 0);
+
+		// Dilate by one cell (separably along each axis), so that queries with radius reaching
+		// to neighbouring cells and small changes between passes are covered
+		const int strides[3] = { 1, mResolution, mResolution * mResolution };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			mRecorded.swap(mQueried);
+			for (int i = 0; i < (int)mQueried.size(); ++i)
+			{
+				const int coord = (i / strides[axis]) % mResolution;
+				mQueried[i] = mRecorded[i] |
+					(coord > 0 ? mRecorded[i - strides[axis]] : 0) |
+					(coord < mResolution - 1 ? mRecorded[i + strides[axis]] : 0);
+			}
+		}
+		std::fill(mRecorded.begin(), mRecorded.end(), 0);
+
+		mHasHistory = true;
+	}
+
+	// Whether the given point was queried in the last recorded pass
+	bool WasQueried(const Pos &aPoint) const
+	{
+		int cell[3];
+		return !GetCell(aPoint, cell) || mQueried[GetIndex(cell)] != 0;
+	}
+
+	// Whether any point of the given ray segment was queried in the last recorded pass
+	bool WasQueried(const Ray &aRay, const float aDistMin, const float aDistMax) const
+	{
+		const float step = 0.5f * mCellSize;
+		const int steps = std::min((int)((aDistMax - aDistMin) / step), 4 * mResolution);
+		for (int i = 0; i <= steps; ++i)
+		{
+			if (WasQueried(aRay.target(aDistMin + i * step)))
+				return true;
+		}
+		return WasQueried(aRay.target(aDistMax));
+	}
+
+private:
+
+	// Cell containing the point, false if the point is outside the volume
+	bool GetCell(const Pos &aPoint, int oCell[3]) const
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			const float coord = (aPoint[i] - mBoxMin[i]) * mInvCellSize;
+			if (!(coord >= 0.f && coord < (float)mResolution))
+				return false;
+			oCell[i] = (int)coord;
+		}
+		return true;
+	}
+
+	int GetIndex(const int aCell[3]) const
+	{
+		return (aCell[2] * mResolution + aCell[1]) * mResolution + aCell[0];
+	}
+
+	Pos   mBoxMin;      // Minimum corner of the volume
+	int   mResolution;  // Number of cells along each axis
+	float mCellSize;    // Size of a cell
+	float mInvCellSize; // 1 / mCellSize
+	bool  mHasHistory;  // Whether mQueried holds a recorded pass
+
+	std::vector<unsigned char> mRecorded; // Cells queried in the current pass
+	std::vector<unsigned char> mQueried;  // Cells queried in the last finished pass (dilated)
+};
+
+#endif //__QUERYVOLUME_HXX__
@@ -31,6 +31,7 @@
 #include <xmmintrin.h>
 #include <smmintrin.h>
 #include <immintrin.h>
+#include <intrin.h>
 
 #include "..\PrecompiledLibs\FastFloat\FastFloat.h"
 #include "Defs.hxx"
@@ -71,6 +72,18 @@ namespace Sse {
         UPBP_ASSERT(unsigned(index) < 8);
         return ((float*)(&in))[index];
     }
+
+    // Whether both the CPU and the OS support AVX (8-wide float vectors). Used for choosing kernels at runtime,
+    // code using Float8 must not run when this is false.
+    INLINE bool cpuHasAvx() {
+        int info[4];
+        __cpuid(info, 1);
+        const bool osXsave = (info[2] & (1 << 27)) != 0;
+        const bool avx     = (info[2] & (1 << 28)) != 0;
+        if(!osXsave || !avx) return false;
+        // OS must save upper halves of YMM registers on context switch
+        return (_xgetbv(_XCR_XFEATURE_ENABLED_MASK) & 0x6) == 0x6;
+    }
 }
 
 
@@ -135,6 +148,12 @@ public:
         return !allTrue();
     }
 
+    // Returns 4 bit mask, i-th bit is set for true i-th element.
+    INLINE int mask() const {
+        UPBP_ASSERT(isValid());
+        return _mm_movemask_ps(_mm_castsi128_ps(_sse));
+    }
+
     // Returns all ones for true, all zeros for false elements.
     INLINE Int4 maskedInts(const uint mask) const;
     
@@ -562,9 +581,44 @@ INLINE Int4 Bool4::blend(const Int4& trueVals, const Int4& falseVals) const {
 }
 
 
-#if 0
-//AVX stuff
+//////////////////////////////////////////////////////////////////////////
+// Classes for fast computation with vectors using AVX. Check Sse::cpuHasAvx() before running code using them.
+
+class Float8;
+
+// Holds 8 bool values in an AVX vector. Is a result of comparison of Float8 vectors.
+class Bool8 {
+public:
+    __m256 data;
+
+    INLINE explicit Bool8(const __m256& data) : data(data) { }
+
+    INLINE Bool8 operator&&(const Bool8& other) const {
+        return Bool8(_mm256_and_ps(data, other.data));
+    }
+
+    INLINE Bool8 operator||(const Bool8& other) const {
+        return Bool8(_mm256_or_ps(data, other.data));
+    }
+
+    // Returns 8 bit mask, i-th bit is set for true i-th element.
+    INLINE int mask() const {
+        return _mm256_movemask_ps(data);
+    }
+
+    INLINE bool allFalse() const {
+        return mask() == 0;
+    }
+
+    INLINE bool allTrue() const {
+        return mask() == 0xFF;
+    }
+
+    // Returns Float8 with trueVals for true elements and falseVales for false elements of this Bool8.
+    INLINE Float8 blend(const Float8& trueVals, const Float8& falseVals) const;
+};
 
+// 8 floating point values packed in an AVX vector.
 class Float8 {    
 public:
     __m256 data;
@@ -574,10 +628,16 @@ public:
     INLINE explicit Float8(const __m256& data)                                 : data(data) { }
     //INLINE Float8(const float x, const float y, const float z, const float w) : data(_mm256_set_ps(w, z, y, x)) { }
     INLINE explicit Float8(const float value)                                 : data(_mm256_set1_ps(value)) { }
+    // Loads an array of 8 floats into memory. MemoryLocation have to be aligned to 32B.
     INLINE Float8(const float* memoryLocation)                                : data(_mm256_load_ps(memoryLocation)) {
         UPBP_ASSERT(((int64)memoryLocation%32) == 0);
     }
 
+    // Loads an array of 8 floats from memory with any alignment.
+    static INLINE Float8 loadUnaligned(const float* memoryLocation) {
+        return Float8(_mm256_loadu_ps(memoryLocation));
+    }
+
     INLINE const float operator[](const int index) const {
         return Sse::get(data, index);
     }
@@ -686,8 +746,35 @@ public:
     INLINE Float8 clamp(const float minimum, const float maximum) const {
         return Float8(_mm256_min_ps(_mm256_max_ps(_mm256_set1_ps(minimum), data), _mm256_set1_ps(maximum)));
     }  
+
+    INLINE Bool8 operator<(const Float8& other) const {
+        return Bool8(_mm256_cmp_ps(data, other.data, _CMP_LT_OQ));
+    }
+    INLINE Bool8 operator>(const Float8& other) const {
+        return Bool8(_mm256_cmp_ps(data, other.data, _CMP_GT_OQ));
+    }
+    INLINE Bool8 operator<=(const Float8& other) const {
+        return Bool8(_mm256_cmp_ps(data, other.data, _CMP_LE_OQ));
+    }
+    INLINE Bool8 operator>=(const Float8& other) const {
+        return Bool8(_mm256_cmp_ps(data, other.data, _CMP_GE_OQ));
+    }
+    INLINE Bool8 operator<(const float other) const {
+        return Bool8(_mm256_cmp_ps(data, _mm256_set1_ps(other), _CMP_LT_OQ));
+    }
+    INLINE Bool8 operator>(const float other) const {
+        return Bool8(_mm256_cmp_ps(data, _mm256_set1_ps(other), _CMP_GT_OQ));
+    }
+    INLINE Bool8 operator<=(const float other) const {
+        return Bool8(_mm256_cmp_ps(data, _mm256_set1_ps(other), _CMP_LE_OQ));
+    }
+    INLINE Bool8 operator>=(const float other) const {
+        return Bool8(_mm256_cmp_ps(data, _mm256_set1_ps(other), _CMP_GE_OQ));
+    }
 };
 
-#endif
+INLINE Float8 Bool8::blend(const Float8& trueVals, const Float8& falseVals) const {
+    return Float8(_mm256_blendv_ps(falseVals.data, trueVals.data, data));
+}
 
 #endif //__SSE_HXX__
\ No newline at end of file
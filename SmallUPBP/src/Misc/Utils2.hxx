@@ -33,6 +33,7 @@
 #include <algorithm>
 
 #include "..\Structs\Rgb.hxx"
+#include "FastMath.hxx"
 
 //////////////////////////////////////////////////////////////////////////
 // Cosine lobe hemisphere sampling
@@ -52,17 +53,20 @@ inline Dir SamplePowerCosHemisphereW(
     float        *oPdfW)
 {
     const float term1 = 2.f * PI_F * aSamples.get(0);
-    const float term2 = std::pow(aSamples.get(1), 1.f / (aPower + 1.f));
+    const float term2 = FastMath::pow(aSamples.get(1), 1.f / (aPower + 1.f));
     const float term3 = std::sqrt(1.f - term2 * term2);
 
     if(oPdfW)
     {
-        *oPdfW = (aPower + 1.f) * std::pow(term2, aPower) * (0.5f * INV_PI_F);
+        *oPdfW = (aPower + 1.f) * FastMath::pow(term2, aPower) * (0.5f * INV_PI_F);
     }
 
+    float sinTerm1, cosTerm1;
+    FastMath::sincos(term1, sinTerm1, cosTerm1);
+
     return Dir(
-        std::cos(term1) * term3,
-        std::sin(term1) * term3,
+        cosTerm1 * term3,
+        sinTerm1 * term3,
         term2);
 }
 
@@ -82,7 +86,7 @@ inline float PowerCosHemispherePdfW(
 {
     const float cosTheta = std::max(0.f, dot(aNormal, aDirection));
 
-    return (aPower + 1.f) * std::pow(cosTheta, aPower) * (INV_PI_F * 0.5f);
+    return (aPower + 1.f) * FastMath::pow(cosTheta, aPower) * (INV_PI_F * 0.5f);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -134,9 +138,12 @@ inline Vec2f SampleConcentricDisc(
         }
     }
 
+    float sinPhi, cosPhi;
+    FastMath::sincos(phi, sinPhi, cosPhi);
+
     Vec2f res;
-    res.get(0) = r * std::cos(phi);
-    res.get(1) = r * std::sin(phi);
+    res.get(0) = r * cosPhi;
+    res.get(1) = r * sinPhi;
     return res;
 }
 
@@ -168,9 +175,12 @@ inline Dir SampleCosHemisphereW(
     const float term1 = 2.f * PI_F * aSamples.get(0);
     const float term2 = std::sqrt(1.f - aSamples.get(1));
 
+    float sinTerm1, cosTerm1;
+    FastMath::sincos(term1, sinTerm1, cosTerm1);
+
     const Dir ret(
-        std::cos(term1) * term2,
-        std::sin(term1) * term2,
+        cosTerm1 * term2,
+        sinTerm1 * term2,
         std::sqrt(aSamples.get(1)));
 
     if(oPdfW)
@@ -228,9 +238,12 @@ inline Dir SampleUniformSphereW(
     const float term1 = 2.f * PI_F * aSamples.get(0);
     const float term2 = 2.f * std::sqrt(aSamples.get(1) - aSamples.get(1) * aSamples.get(1));
 
+    float sinTerm1, cosTerm1;
+    FastMath::sincos(term1, sinTerm1, cosTerm1);
+
     const Dir ret(
-        std::cos(term1) * term2,
-        std::sin(term1) * term2,
+        cosTerm1 * term2,
+        sinTerm1 * term2,
         1.f - 2.f * aSamples.get(1));
 
     if(oPdfSA)
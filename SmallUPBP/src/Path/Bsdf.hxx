@@ -464,7 +464,7 @@ private:
         const Rgb rho = aMaterial.mPhongReflectance *
             (aMaterial.mPhongExponent + 2.f) * 0.5f * INV_PI_F;
 
-        return rho * std::pow(dot_R_Wi, aMaterial.mPhongExponent);
+        return rho * FastMath::pow(dot_R_Wi, aMaterial.mPhongExponent);
     }
 
     Rgb SampleReflect(
@@ -580,7 +580,7 @@ private:
         if(dot_R_Wi <= EPS_PHONG)
             return Rgb(0.f);
 
-		float pow = std::pow(dot_R_Wi, aMaterial.mPhongExponent);
+		float pow = FastMath::pow(dot_R_Wi, aMaterial.mPhongExponent);
 		if (!Float::isPositive(pow))
 			return Rgb(0.f);
 
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+#ifndef __CONNECTIONQUEUE_HXX__
+#define __CONNECTIONQUEUE_HXX__
+
+#include <vector>
+#include <cmath>
+
+#include "..\Misc\Rng.hxx"
+#include "..\Misc\Utils2.hxx"
+#include "..\Scene\Scene.hxx"
+
+// Queue of deferred vertex connections. Renderers first evaluate BSDFs, geometry terms and PDFs of all
+// connections of a vertex and push them here, then cull the queue, trace shadow rays of the surviving
+// connections in packets (all of them start at the same vertex, so the traversal stays coherent), and
+// only then resolve their contributions. TConnection must have members
+//   Dir   mDirection        - from the vertex to the connected one
+//   float mDistance         - distance between the vertices
+//   uint  mRaySamplingFlags - flags for the occlusion test
+//   Rgb   mUnoccluded       - contribution without attenuation and MIS weight, applied when resolving
+//   float mCullWeight       - set by Cull, 0 for culled connections, inverse survival probability otherwise
+template<typename TConnection>
+class ConnectionQueue
+{
+public:
+
+	ConnectionQueue()
+	{
+		mConnections.reserve(64);
+	}
+
+	void Clear()
+	{
+		mConnections.clear();
+	}
+
+	// Adds a new connection and returns it to be filled in
+	TConnection& Push()
+	{
+		mConnections.push_back(TConnection());
+		return mConnections.back();
+	}
+
+	bool IsEmpty() const
+	{
+		return mConnections.empty();
+	}
+
+	int Size() const
+	{
+		return (int)mConnections.size();
+	}
+
+	TConnection& operator[](int aIdx)
+	{
+		return mConnections[aIdx];
+	}
+
+	const TConnection& operator[](int aIdx) const
+	{
+		return mConnections[aIdx];
+	}
+
+	// Culls connections with negligible contribution by Russian roulette. Connections whose luminance
+	// is below aRelativeThreshold times the largest one in the queue survive with probability proportional
+	// to their luminance and survivors are reweighted, so the result stays unbiased. Connections with zero
+	// contribution are always culled. Returns number of surviving connections.
+	int Cull(Rng &aRng, const float aRelativeThreshold)
+	{
+		float maxLuminance = 0;
+		for (int i = 0; i < (int)mConnections.size(); i++)
+			maxLuminance = std::max(maxLuminance, Luminance(mConnections[i].mUnoccluded));
+
+		const float threshold = aRelativeThreshold * maxLuminance;
+
+		int survived = 0;
+		for (int i = 0; i < (int)mConnections.size(); i++)
+		{
+			TConnection &connection = mConnections[i];
+			const float luminance = Luminance(connection.mUnoccluded);
+
+			if (luminance <= 0)
+				connection.mCullWeight = 0;
+			else if (luminance >= threshold)
+				connection.mCullWeight = 1.f;
+			else
+			{
+				const float survivalProb = luminance / threshold;
+				connection.mCullWeight = (aRng.GetFloat() < survivalProb) ? 1.f / survivalProb : 0;
+			}
+
+			if (connection.mCullWeight > 0)
+				++survived;
+		}
+
+		return survived;
+	}
+
+	// Traces shadow rays of connections that survived Cull from aOrigin as packets of 4 rays and culls those
+	// occluded by a real surface (see Scene::OccludedMask4). The rest still has to be tested by Scene::Occluded,
+	// which walks the media boundaries and returns the volume segments the renderers need
+	void CullOccluded(
+		const Scene         &aScene,
+		const Pos           &aOrigin,
+		const BoundaryStack &aBoundaryStack)
+	{
+		int   indices[4];
+		Dir   directions[4];
+		float distances[4];
+		uint  flags[4];
+		int   count = 0;
+
+		const int size = (int)mConnections.size();
+		for (int i = 0; i <= size; i++)
+		{
+			if (i < size && mConnections[i].mCullWeight > 0)
+			{
+				indices[count]    = i;
+				directions[count] = mConnections[i].mDirection;
+				distances[count]  = mConnections[i].mDistance;
+				flags[count]      = mConnections[i].mRaySamplingFlags;
+				++count;
+			}
+
+			// A single ray is left to the full test
+			if (count < 4 && (i < size || count < 2))
+				continue;
+
+			for (int j = count; j < 4; j++)
+			{
+				directions[j] = directions[0];
+				distances[j]  = 0;
+				flags[j]      = 0;
+			}
+
+			const int occluded = aScene.OccludedMask4(aOrigin, directions, distances, flags, aBoundaryStack);
+			for (int j = 0; j < count; j++)
+				if (occluded & (1 << j))
+					mConnections[indices[j]].mCullWeight = 0;
+
+			count = 0;
+		}
+	}
+
+private:
+
+	std::vector<TConnection> mConnections;
+};
+
+#endif //__CONNECTIONQUEUE_HXX__
@@ -29,7 +29,10 @@
 
 #include "UPBPLightVertex.hxx"
 
-// Accumulates PDF ratios of all sampling techniques along path originally sampled from camera
+// Accumulates PDF ratios of all sampling techniques along path originally sampled from camera.
+// TTechniques fixes estimator techniques at compile time, so branches of unused techniques
+// are removed; 0 means that aEstimatorTechniques is used instead
+template<uint TTechniques>
 static float AccumulateCameraPathWeight(
 	const int aPathLength, 
 	const float aLastRevPdfA,
@@ -42,6 +45,8 @@ static float AccumulateCameraPathWeight(
 	const uint  aEstimatorTechniques, 
 	const MisData *aCameraVerticesMisData)
 {
+	const uint techniques = TTechniques ? TTechniques : aEstimatorTechniques;
+
 	float weight = 0;
 	float product = 1.0f;
 	int lastIndex = aPathLength;
@@ -58,7 +63,7 @@ static float AccumulateCameraPathWeight(
 		const MisData& current = aCameraVerticesMisData[lastIndex - index];
 		const MisData& next = index < aPathLength - 1 ? aCameraVerticesMisData[lastIndex - index - 1] : current;
 
-		if ((aEstimatorTechniques & BB1D_PREVIOUS) && !current.mIsSpecular)
+		if ((techniques & BB1D_PREVIOUS) && !current.mIsSpecular)
 			weightBB1D = 0;
 
 		// Get reverse data
@@ -88,15 +93,15 @@ static float AccumulateCameraPathWeight(
 		bool currentUsable = index == 0 || !current.mIsSpecular;
 
 		// SURF
-		if ((aEstimatorTechniques & SURF) && currentUsable)
+		if ((techniques & SURF) && currentUsable)
 			weight += product * current.mSurfMisWeightFactor;
 
 		// PP3D
-		if (aEstimatorTechniques & PP3D)
+		if (techniques & PP3D)
 			weight += product * current.mPP3DMisWeightFactor;
 
 		// PB2D
-		if (aEstimatorTechniques & PB2D)
+		if (techniques & PB2D)
 		{
 			if (aQueryBeamType & LONG_BEAM)
 				weight += product * current.mPB2DMisWeightFactor * current.mRaySamplePdfInv;
@@ -105,9 +110,9 @@ static float AccumulateCameraPathWeight(
 		}
 
 		// BB1D
-		if (aEstimatorTechniques & BB1D && current.mInMediumWithBeams)
+		if (techniques & BB1D && current.mInMediumWithBeams)
 		{
-			if (aEstimatorTechniques & NO_SINE_IN_WEIGHTS) sinTheta = 1;
+			if (techniques & NO_SINE_IN_WEIGHTS) sinTheta = 1;
 			
 			if (aQueryBeamType & LONG_BEAM)
 			{
@@ -131,9 +136,9 @@ static float AccumulateCameraPathWeight(
 
 		product *= fwInv;
 
-		// BPT
-		if ((aEstimatorTechniques & BPT) && currentUsable && !next.mIsSpecular)
-			weight += product;
+		// BPT, connections of two inner vertices (not on light source or camera) are weighted by the factor of the camera vertex
+		if ((techniques & BPT) && currentUsable && !next.mIsSpecular)
+			weight += (index < aPathLength - 1 && !current.mIsOnLightSource) ? product * next.mConnectionMisFactor : product;
 
 		++index;
 	}
@@ -141,7 +146,36 @@ static float AccumulateCameraPathWeight(
 	return weight + weightBB1D;
 }
 
-// Accumulates PDF ratios of all sampling techniques along path originally sampled from light
+// Accumulates PDF ratios of all sampling techniques along path originally sampled from camera
+static INLINE float AccumulateCameraPathWeight(
+	const int aPathLength, 
+	const float aLastRevPdfA,
+	const float aLastSinTheta,
+	const float aLastRaySampleRevPdfInv,
+	const float aLastRaySampleRevPdfsRatio,
+	const float aNextToLastPartialRevPdfW,	
+	const uint  aQueryBeamType,
+	const uint  aPhotonBeamType,
+	const uint  aEstimatorTechniques, 
+	const MisData *aCameraVerticesMisData)
+{
+	return AccumulateCameraPathWeight<0>(aPathLength, aLastRevPdfA, aLastSinTheta, aLastRaySampleRevPdfInv, aLastRaySampleRevPdfsRatio, aNextToLastPartialRevPdfW, aQueryBeamType, aPhotonBeamType, aEstimatorTechniques, aCameraVerticesMisData);
+}
+
+// Light vertex at the given position in the path order, light vertices can be stored in a different
+// order given by aPathVertexIndices (NULL if stored in the path order)
+static INLINE const UPBPLightVertex& PathOrderedLightVertex(
+	const std::vector<UPBPLightVertex> *aLightVertices,
+	const std::vector<int> *aPathVertexIndices,
+	const int aPosition)
+{
+	return aPathVertexIndices ? aLightVertices->at(aPathVertexIndices->at(aPosition)) : aLightVertices->at(aPosition);
+}
+
+// Accumulates PDF ratios of all sampling techniques along path originally sampled from light.
+// TTechniques fixes estimator techniques at compile time, so branches of unused techniques
+// are removed; 0 means that aEstimatorTechniques is used instead
+template<uint TTechniques>
 static float AccumulateLightPathWeight(
 	const int   aPathIndex,
 	const int   aPathLength,
@@ -157,24 +191,27 @@ static float AccumulateLightPathWeight(
 	const bool  aCameraConnection,
 	const std::vector<int> *aPathEnds,
 	const std::vector<UPBPLightVertex> *aLightVertices,
-	const MisData* aBeamLightVertexMisData = NULL)
+	const MisData* aBeamLightVertexMisData = NULL,
+	const std::vector<int> *aPathVertexIndices = NULL)
 {
 	UPBP_ASSERT(aCurrentlyEvaluatedTechnique == BPT || aCurrentlyEvaluatedTechnique == SURF || aCurrentlyEvaluatedTechnique == PP3D || aCurrentlyEvaluatedTechnique == PB2D || aCurrentlyEvaluatedTechnique == BB1D);
 	UPBP_ASSERT(aCurrentlyEvaluatedTechnique != BB1D || aBeamLightVertexMisData);
 
+	const uint techniques = TTechniques ? TTechniques : aEstimatorTechniques;
+
 	float weight = 0;
 	float product = 1.0f;
 	int lastIndex = (aPathIndex == 0) ? aPathLength : aPathEnds->at(aPathIndex - 1) + aPathLength;
 	int index = 0;
 
 	// No technique for delta vertices
-	UPBP_ASSERT((aCurrentlyEvaluatedTechnique == BB1D && !aBeamLightVertexMisData->mIsDelta) || !aLightVertices->at(lastIndex).mMisData.mIsDelta);
+	UPBP_ASSERT((aCurrentlyEvaluatedTechnique == BB1D && !aBeamLightVertexMisData->mIsDelta) || !PathOrderedLightVertex(aLightVertices, aPathVertexIndices, lastIndex).mMisData.mIsDelta);
 
 	while (index <= aPathLength)
 	{
 		// Two vertices of the current path segment (same if already at light)
-		const MisData& current = (aCurrentlyEvaluatedTechnique == BB1D && index == 0) ? *aBeamLightVertexMisData : aLightVertices->at(lastIndex - index).mMisData;
-		const MisData& next = index < aPathLength ? aLightVertices->at(lastIndex - index - 1).mMisData : current;
+		const MisData& current = (aCurrentlyEvaluatedTechnique == BB1D && index == 0) ? *aBeamLightVertexMisData : PathOrderedLightVertex(aLightVertices, aPathVertexIndices, lastIndex - index).mMisData;
+		const MisData& next = index < aPathLength ? PathOrderedLightVertex(aLightVertices, aPathVertexIndices, lastIndex - index - 1).mMisData : current;
 
 		// Get reverse data
 		float rev = current.mRevPdfA;
@@ -213,15 +250,15 @@ static float AccumulateLightPathWeight(
 		if (index != 0 || aCurrentlyEvaluatedTechnique == BPT)
 		{
 			// SURF
-			if ((aEstimatorTechniques & SURF) && currentUsable)
+			if ((techniques & SURF) && currentUsable)
 				weight += product * current.mSurfMisWeightFactor;
 
 			// PP3D
-			if (aEstimatorTechniques & PP3D)
+			if (techniques & PP3D)
 				weight += product * current.mPP3DMisWeightFactor;
 
 			// PB2D
-			if (aEstimatorTechniques & PB2D)
+			if (techniques & PB2D)
 			{
 				if (aQueryBeamType & LONG_BEAM)
 					weight += product * current.mPB2DMisWeightFactor * rayRev;
@@ -230,9 +267,9 @@ static float AccumulateLightPathWeight(
 			}
 
 			// BB1D
-			if ((aEstimatorTechniques & BB1D) && (!(aEstimatorTechniques & BB1D_PREVIOUS) || (aCameraConnection && index == 0)) && current.mInMediumWithBeams)
+			if ((techniques & BB1D) && (!(techniques & BB1D_PREVIOUS) || (aCameraConnection && index == 0)) && current.mInMediumWithBeams)
 			{
-				if (aEstimatorTechniques & NO_SINE_IN_WEIGHTS) sinTheta = 1;
+				if (techniques & NO_SINE_IN_WEIGHTS) sinTheta = 1;
 				
 				if (aQueryBeamType & LONG_BEAM)
 				{
@@ -257,16 +294,38 @@ static float AccumulateLightPathWeight(
 
 		product *= fwInv;
 
-		// BPT
-		if ((aEstimatorTechniques & BPT) && currentUsable && !next.mIsSpecular)
-			weight += product;
+		// BPT, connections are weighted by the factor of the light vertex (1 on light source)
+		if ((techniques & BPT) && currentUsable && !next.mIsSpecular)
+			weight += (index < aPathLength) ? product * next.mConnectionMisFactor : product;
 
 		++index;
 
-		if (aEstimatorTechniques & PREVIOUS) break;
+		if (techniques & PREVIOUS) break;
 	}
 
 	return weight;
 }
 
+// Accumulates PDF ratios of all sampling techniques along path originally sampled from light
+static INLINE float AccumulateLightPathWeight(
+	const int   aPathIndex,
+	const int   aPathLength,
+	const float aLastRevPdfA,
+	const float aLastSinTheta,
+	const float aLastRaySampleRevPdfInv,
+	const float aLastRaySampleRevPdfsRatio,
+	const float aNextToLastPartialRevPdfW,
+	const uint  aCurrentlyEvaluatedTechnique,
+	const uint  aQueryBeamType,
+	const uint  aPhotonBeamType,
+	const uint  aEstimatorTechniques,
+	const bool  aCameraConnection,
+	const std::vector<int> *aPathEnds,
+	const std::vector<UPBPLightVertex> *aLightVertices,
+	const MisData* aBeamLightVertexMisData = NULL,
+	const std::vector<int> *aPathVertexIndices = NULL)
+{
+	return AccumulateLightPathWeight<0>(aPathIndex, aPathLength, aLastRevPdfA, aLastSinTheta, aLastRaySampleRevPdfInv, aLastRaySampleRevPdfsRatio, aNextToLastPartialRevPdfW, aCurrentlyEvaluatedTechnique, aQueryBeamType, aPhotonBeamType, aEstimatorTechniques, aCameraConnection, aPathEnds, aLightVertices, aBeamLightVertexMisData, aPathVertexIndices);
+}
+
 #endif //__PATHWEIGHT_HXX__
\ No newline at end of file
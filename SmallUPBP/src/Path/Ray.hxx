@@ -32,6 +32,7 @@
 #include <list>
 
 #include "StaticArray.hxx"
+#include "SmallArray.hxx"
 #include "..\Structs\Rgb.hxx"
 
 //////////////////////////////////////////////////////////////////////////
@@ -115,16 +116,20 @@ public:
 struct VolumeSegment;
 struct VolumeSegmentLite;
 
-#define USE_STATIC_ARRAYS
+#define USE_SMALL_ARRAYS
 
-#ifndef USE_STATIC_ARRAYS
-typedef std::list<Isect> Intersections;
-typedef std::vector<VolumeSegmentLite> LiteVolumeSegments;
-typedef std::vector<VolumeSegment> VolumeSegments;
-#else
+#if defined(USE_SMALL_ARRAYS)
+typedef SmallArray<VolumeSegmentLite, 4> LiteVolumeSegments;
+typedef SmallArray<VolumeSegment, 4> VolumeSegments;
+typedef SmallArray<Isect, 8> Intersections;
+#elif defined(USE_STATIC_ARRAYS)
 typedef StaticArray<VolumeSegmentLite, 30> LiteVolumeSegments;
 typedef StaticArray<VolumeSegment, 30> VolumeSegments;
 typedef StaticArray<Isect, 30> Intersections;
+#else
+typedef std::list<Isect> Intersections;
+typedef std::vector<VolumeSegmentLite> LiteVolumeSegments;
+typedef std::vector<VolumeSegment> VolumeSegments;
 #endif
 
 // Segment of a ray in one medium
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __SMALLARRAY_HXX__
+#define __SMALLARRAY_HXX__
+
+#include <algorithm> // For sorting
+
+#include "..\Misc\Defs.hxx"
+
+// Array with small buffer optimization. The first N elements are stored inline,
+// larger arrays spill to a heap buffer which is kept (and reused) after clear(),
+// so arrays owned by a renderer serve as persistent per-thread scratch with capacity
+// adapted to the deepest nesting seen so far. There is no compile-time size limit.
+template< typename T, size_t N = 4 >
+class SmallArray
+{
+public:
+
+	typedef T * iterator;
+	typedef const T * const_iterator;
+
+	INLINE SmallArray() :
+		mData(mElements), mCapacity(N), mBegin(0), mSize(0)
+	{
+	}
+
+	SmallArray(const SmallArray & aOther) :
+		mData(mElements), mCapacity(N), mBegin(0), mSize(0)
+	{
+		*this = aOther;
+	}
+
+	~SmallArray()
+	{
+		if (mData != mElements)
+			delete[] mData;
+	}
+
+	SmallArray & operator=(const SmallArray & aOther)
+	{
+		if (this != &aOther)
+		{
+			clear();
+			reserve(aOther.mSize);
+			std::copy(aOther.begin(), aOther.end(), mData);
+			mSize = aOther.mSize;
+		}
+		return *this;
+	}
+
+	/// Size of the array
+	INLINE size_t size() const
+	{
+		return mSize;
+	}
+
+	/// Is array empty?
+	INLINE bool empty() const
+	{
+		return mSize == 0;
+	}
+
+	/// Makes sure that at least aCapacity elements fit without reallocation
+	void reserve(size_t aCapacity)
+	{
+		if (mBegin + aCapacity <= mCapacity)
+			return;
+
+		if (aCapacity <= mCapacity)
+		{
+			// Enough space, only move elements to the beginning
+			std::copy(mData + mBegin, mData + mBegin + mSize, mData);
+			mBegin = 0;
+			return;
+		}
+
+		size_t capacity = 2 * mCapacity;
+		while (capacity < aCapacity) capacity *= 2;
+
+		T * data = new T[capacity];
+		std::copy(mData + mBegin, mData + mBegin + mSize, data);
+		if (mData != mElements)
+			delete[] mData;
+
+		mData = data;
+		mCapacity = capacity;
+		mBegin = 0;
+	}
+
+	/// Add element
+	INLINE void push_back(const T & aElem)
+	{
+		if (mBegin + mSize == mCapacity)
+			reserve(mSize + 1);
+		mData[mBegin + mSize++] = aElem;
+	}
+
+	/// Add element to start
+	INLINE void push_front(const T & aElem)
+	{
+		if (mBegin == 0)
+		{
+			if (mSize == mCapacity)
+				reserve(mSize + 1);
+			std::copy_backward(mData, mData + mSize, mData + mSize + 1);
+		}
+		else
+		{
+			--mBegin;
+		}
+		mData[mBegin] = aElem;
+		++mSize;
+	}
+
+	/// Remove element from back
+	INLINE void pop_back()
+	{
+		UPBP_ASSERT(mSize != 0);
+		--mSize;
+	}
+
+	/// Remove element from start
+	INLINE void pop_front()
+	{
+		UPBP_ASSERT(mSize != 0);
+		++mBegin;
+		--mSize;
+	}
+
+	/// Clear array, spilled buffer is kept for reuse
+	INLINE void clear()
+	{
+		mSize = 0;
+		mBegin = 0;
+	}
+
+	/// Access functions
+	INLINE T & operator[](int i)
+	{
+		UPBP_ASSERT(i >= 0 && (size_t)i < mSize);
+		return mData[mBegin + i];
+	}
+
+	INLINE const T & operator[](int i) const
+	{
+		UPBP_ASSERT(i >= 0 && (size_t)i < mSize);
+		return mData[mBegin + i];
+	}
+
+	INLINE T & front()
+	{
+		UPBP_ASSERT(mSize > 0);
+		return mData[mBegin];
+	}
+
+	INLINE const T & front() const
+	{
+		UPBP_ASSERT(mSize > 0);
+		return mData[mBegin];
+	}
+
+	INLINE T & back()
+	{
+		UPBP_ASSERT(mSize > 0);
+		return mData[mBegin + mSize - 1];
+	}
+
+	INLINE const T & back() const
+	{
+		UPBP_ASSERT(mSize > 0);
+		return mData[mBegin + mSize - 1];
+	}
+
+	/// Other functions
+	INLINE void sort()
+	{
+		std::sort(begin(), end());
+	}
+
+	/// Iterator functions
+	INLINE iterator begin() { return mData + mBegin; }
+	INLINE iterator end() { return mData + mBegin + mSize; }
+	INLINE const_iterator begin() const { return mData + mBegin; }
+	INLINE const_iterator end() const { return mData + mBegin + mSize; }
+	INLINE const_iterator cbegin() const { return mData + mBegin; }
+	INLINE const_iterator cend() const { return mData + mBegin + mSize; }
+
+private:
+	T mElements[N]; // Inline storage for the common case
+	T * mData;      // Either mElements or spilled heap buffer
+	size_t mCapacity;
+	size_t mBegin;  // Index of the first element (pop_front only moves it)
+	size_t mSize;
+};
+
+#endif //__SMALLARRAY_HXX__
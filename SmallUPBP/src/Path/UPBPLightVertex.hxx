@@ -45,6 +45,7 @@ struct MisData
 	float mPB2DMisWeightFactor;   // Weight factor of PB2D, nonzero only for vertices in media
 	float mBB1DMisWeightFactor;   // Weight factor of BB1D, nonzero only for vertices in media
 	float mBB1DBeamSelectionPdf;  // Probability of selecting a beam (in case of beam reduction)
+	float mConnectionMisFactor;   // Weight factor of vertex connections ending at the vertex (light vertex cache), 1 for vertices on light sources
 	bool  mIsDelta;               // Whether the vertex is on a delta surface
 	bool  mIsOnLightSource;       // Whether the vertex is on a light source
 	bool  mIsSpecular;            // Whether the event sampled at the vertex was specular
@@ -62,6 +63,7 @@ struct UPBPLightVertex
 	bool  mBehindSurf; // Vertex in participating medium behind real (not imaginary) surface
 	bool  mConnectable;// Whether this vertex can be used in vertex connection
 	bool  mIsFinite;   // Whether this vertex is not on infinite light source
+	float mMergeWeight;// Inverse probability of keeping the vertex for merging, 0 if culled (vertex is then used only in connections and MIS)
 	BSDF  mBSDF;       // Stores all required local information, including incoming direction
 
 	MisData mMisData;  // Data needed for MIS weights computation
@@ -73,7 +75,7 @@ struct UPBPLightVertex
 	}
 	const bool MatchesType(uint aType) const
 	{
-		return (mInMedium && aType == PP3D) || (!mInMedium && aType == SURF);
+		return mMergeWeight > 0 && ((mInMedium && aType == PP3D) || (!mInMedium && aType == SURF));
 	}
 };
 
@@ -47,12 +47,13 @@ public:
     virtual void RunIteration(int aIteration)
     {
         const int resX = int(mScene.mCamera.mResolution.get(0));
-        const int resY = int(mScene.mCamera.mResolution.get(1));
+        const int pixelCount = mScene.mCamera.GetCropPixelCount();
 
-        for(int pixID = 0; pixID < resX * resY; pixID++)
+        for(int cropIdx = 0; cropIdx < pixelCount; cropIdx++)
         {
             //////////////////////////////////////////////////////////////////////////
             // Generate ray
+            const int pixID = mScene.mCamera.GetCropPixelIndex(cropIdx);
             const int x = pixID % resX;
             const int y = pixID / resX;
 
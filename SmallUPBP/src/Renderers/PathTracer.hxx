@@ -51,10 +51,11 @@ public:
 		const float lightPickProb = 1.f / lightCount;
 
 		const int resX = int(mScene.mCamera.mResolution.get(0));
-		const int resY = int(mScene.mCamera.mResolution.get(1));
+		const int pixelCount = mScene.mCamera.GetCropPixelCount();
 
-		for(int pixID = 0; pixID < resX * resY; pixID++)
+		for(int cropIdx = 0; cropIdx < pixelCount; cropIdx++)
 		{
+			const int pixID = mScene.mCamera.GetCropPixelIndex(cropIdx);
 			const int x = pixID % resX;
 			const int y = pixID / resX;
 
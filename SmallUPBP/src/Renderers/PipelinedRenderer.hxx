@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __PIPELINEDRENDERER_HXX__
+#define __PIPELINEDRENDERER_HXX__
+
+#include <future>
+
+#include "Renderer.hxx"
+
+/**
+ * @brief	Overlaps the light phase of the next iteration with the camera phase of the current one.
+ *			
+ *			Owns two engines (renderers supporting phases) of the same configuration and alternates them,
+ *			while one traces camera sub-paths, the other traces light sub-paths and builds its structures
+ *			in a background thread. Each iteration is still run as a whole by one engine and seeded by its
+ *			index. Results match the non-pipelined run only for configurations without state carried between
+ *			iterations of an engine: query culling uses the regions queried by the engine's own previous
+ *			camera pass, and the estimator and iteration tuners adapt to the iterations each engine ran, so
+ *			with those options the two engines diverge (the result stays unbiased but not identical).
+ *			Engines need to know the next iteration in advance, it is given by SetNextIteration, without it
+ *			iterations are run without overlapping. Memory of per-iteration data is doubled.
+ */
+class PipelinedRenderer : public AbstractRenderer
+{
+public:
+
+	// Takes ownership of the engines
+	PipelinedRenderer(
+		const Scene&      aScene,
+		AbstractRenderer* aEngine0,
+		AbstractRenderer* aEngine1
+	) :
+		AbstractRenderer(aScene)
+	{
+		UPBP_ASSERT(aEngine0->SupportsPhases() && aEngine1->SupportsPhases());
+
+		mEngines[0] = aEngine0;
+		mEngines[1] = aEngine1;
+		mCurrentEngine = 0;
+		mPreparedIteration = -1;
+		mNextIteration = -1;
+	}
+
+	virtual ~PipelinedRenderer()
+	{
+		if (mPrepared.valid())
+			mPrepared.wait();
+
+		delete mEngines[0];
+		delete mEngines[1];
+	}
+
+	virtual void SetNextIteration(int aIteration)
+	{
+		mNextIteration = aIteration;
+	}
+
+	virtual size_t GetFramebufferMemory() const
+	{
+		return AbstractRenderer::GetFramebufferMemory() + mEngines[0]->GetFramebufferMemory() + mEngines[1]->GetFramebufferMemory();
+	}
+
+	virtual void RunIteration(int aIteration)
+	{
+		// Light phase of the iteration was possibly already run in the background
+		if (mPrepared.valid())
+		{
+			mPrepared.get();
+			mCurrentEngine = 1 - mCurrentEngine;
+
+			if (mPreparedIteration != aIteration)
+			{
+				// Prepared iteration is not run after all, its light tracing contribution is discarded
+				mEngines[mCurrentEngine]->GetFramebufferUnscaled().Clear();
+				for (int view = 0; view < GetViewCount(); ++view)
+					mEngines[mCurrentEngine]->GetViewFramebufferUnscaled(view).Clear();
+				mEngines[mCurrentEngine]->RunLightPhase(aIteration);
+			}
+		}
+		else
+			mEngines[mCurrentEngine]->RunLightPhase(aIteration);
+
+		AbstractRenderer* engine = mEngines[mCurrentEngine];
+
+		// Prepare the next iteration by the other engine
+		if (mNextIteration >= 0)
+		{
+			AbstractRenderer* other = mEngines[1 - mCurrentEngine];
+			const int next = mNextIteration;
+
+			mPreparedIteration = next;
+			mPrepared = std::async(std::launch::async, [other, next]() { other->RunLightPhase(next); });
+			mNextIteration = -1;
+		}
+
+		engine->RunCameraPhase(aIteration);
+
+		mFramebuffer.Add(engine->GetFramebufferUnscaled());
+		engine->GetFramebufferUnscaled().Clear();
+		for (int view = 0; view < GetViewCount(); ++view)
+		{
+			mViewFramebuffers[view].Add(engine->GetViewFramebufferUnscaled(view));
+			engine->GetViewFramebufferUnscaled(view).Clear();
+		}
+
+		mCameraTracingTime = mEngines[0]->mCameraTracingTime + mEngines[1]->mCameraTracingTime;
+		mIterations++;
+	}
+
+private:
+
+	AbstractRenderer* mEngines[2];
+	int               mCurrentEngine;     // Engine running the current iteration
+	int               mPreparedIteration; // Iteration whose light phase runs in the other engine
+	int               mNextIteration;     // Hint of the next iteration (negative for none)
+	std::future<void> mPrepared;          // Light phase of the prepared iteration
+};
+
+#endif //__PIPELINEDRENDERER_HXX__
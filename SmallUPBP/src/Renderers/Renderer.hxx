@@ -45,13 +45,35 @@ public:
         mMaxPathLength = 2;
 		mCameraTracingTime = 0;
         mIterations = 0;
-        mFramebuffer.Setup(aScene.mCamera.mResolution);
+        SetupFramebuffer(mFramebuffer, aScene.mCamera);
+
+		mViewFramebuffers.resize(aScene.mViews.size());
+		for (size_t i = 0; i < mViewFramebuffers.size(); ++i)
+			SetupFramebuffer(mViewFramebuffers[i], aScene.mViews[i]);
     }
 
+	// Setups a framebuffer of the camera image storing only the crop window of the camera
+	static void SetupFramebuffer(Framebuffer &oFramebuffer, const Camera &aCamera)
+	{
+		const Camera::Rect &window = aCamera.mCropWindow;
+		oFramebuffer.Setup(aCamera.mResolution, window.mMinX, window.mMinY, window.mMaxX, window.mMaxY);
+	}
+
     virtual ~AbstractRenderer(){}
 
     virtual void RunIteration(int aIteration) = 0;
 
+	// Renderers supporting it can run an iteration in two phases, the light phase (light sub-paths and
+	// structures built over them) and the camera phase, PipelinedRenderer overlaps them
+	virtual bool SupportsPhases() const { return false; }
+
+	virtual void RunLightPhase(int aIteration) {}
+
+	virtual void RunCameraPhase(int aIteration) { RunIteration(aIteration); }
+
+	// Hint of the iteration this renderer will run after the current one (negative for none)
+	virtual void SetNextIteration(int aIteration) {}
+
     void GetFramebuffer(Framebuffer& oFramebuffer)
     {
         oFramebuffer = mFramebuffer;
@@ -65,16 +87,18 @@ public:
 		return mFramebuffer;
 	}
 
-	// Setups internal debug images
-	void SetupDebugImages(DebugImages &debugImages)
+	// Number of additional views (Scene::mViews) rendered into their own framebuffers
+	int GetViewCount() const { return (int)mViewFramebuffers.size(); }
+
+	Framebuffer & GetViewFramebufferUnscaled(int aView)
 	{
-		mDebugImages.Setup(debugImages);
+		return mViewFramebuffers[aView];
 	}
 
-	// Accumulate debug images
-	void AccumulateDebugImages(DebugImages & aDebugImages)
+	// Setups internal debug images
+	void SetupDebugImages(DebugImages &debugImages)
 	{
-		aDebugImages.Accumulate(mDebugImages, mIterations);
+		mDebugImages.Setup(debugImages);
 	}
 
 	// Setup beam density
@@ -83,12 +107,24 @@ public:
 		mBeamDensity.Setup(aBeamDensType, aResolution, aBeamDensMax);
 	}
 
-	// Accumulate beam density
-	void AccumulateBeamDensity(BeamDensity & aBeamDensity)
+	// Internal debug images
+	const DebugImages & GetDebugImages() const { return mDebugImages; }
+
+	// Internal beam density
+	const BeamDensity & GetBeamDensity() const { return mBeamDensity; }
+
+	// Memory of framebuffers and debug images of this renderer
+	virtual size_t GetFramebufferMemory() const
 	{
-		aBeamDensity.Accumulate(mBeamDensity);
+		size_t size = mFramebuffer.GetMemorySize() + mDebugImages.GetMemorySize();
+		for (size_t i = 0; i < mViewFramebuffers.size(); ++i)
+			size += mViewFramebuffers[i].GetMemorySize();
+		return size;
 	}
 
+	//! Number of iterations run by this renderer
+	int GetIterations() const { return mIterations; }
+
     //! Whether this renderer was used at all
     bool WasUsed() const { return mIterations > 0; }
 
@@ -100,8 +136,31 @@ public:
 
 protected:
 
+	// Throughput based Russian roulette applied on top of the continuation probability of the vertex.
+	// The survival probability is the throughput relative to aReference (throughput at the subpath origin)
+	// divided by aThreshold. It depends on the whole subpath and cannot be evaluated for the reverse
+	// direction, so MIS weights keep using only the per vertex continuation probability (they remain
+	// functions of the path alone and still sum to one) and only the throughput is divided by it.
+	// Returns false for termination.
+	static bool ThroughputRoulette(Rgb &aoThroughput, const float aReference, const float aThreshold, Rng &aRng)
+	{
+		if (aThreshold <= 0 || aReference <= 0)
+			return true;
+
+		const float survivalProb = std::min(1.f, aoThroughput.max() / (aThreshold * aReference));
+		if (survivalProb >= 1.f)
+			return true;
+
+		if (aRng.GetFloat() >= survivalProb)
+			return false;
+
+		aoThroughput /= survivalProb;
+		return true;
+	}
+
     int          mIterations;
     Framebuffer  mFramebuffer;
+	std::vector<Framebuffer> mViewFramebuffers; // Framebuffers of additional views (Scene::mViews)
     const Scene& mScene;
 	DebugImages  mDebugImages;
 	BeamDensity  mBeamDensity;
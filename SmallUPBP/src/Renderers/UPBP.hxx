@@ -29,11 +29,20 @@
 
 #include <vector>
 #include <cmath>
+#include <future>
+#include <thread>
 
 #include "..\Beams\PhBeams.hxx"
 #include "..\Bre\Bre.hxx"
 #include "..\Misc\HashGrid.hxx"
+#include "..\Misc\MortonOrder.hxx"
+#include "..\Misc\QueryVolume.hxx"
+#include "..\Misc\QueryTruncation.hxx"
+#include "..\Misc\EstimatorTuner.hxx"
+#include "..\Misc\IterationTuner.hxx"
+#include "..\Misc\MemoryBudget.hxx"
 #include "..\Misc\Timer.hxx"
+#include "..\Path\ConnectionQueue.hxx"
 #include "..\Path\PathWeight.hxx"
 #include "Renderer.hxx"
 
@@ -53,13 +62,48 @@ class UPBP : public AbstractRenderer
 		uint  mSpecularPath : 1;   // All scattering events so far were specular 
 		bool  mLastSpecular;       // Last sampled event was specular
 		float mLastPdfWInv;        // PDF of the last sampled direction
+		float mRRReference;        // Throughput at the subpath origin (reference for Russian roulette)
 
 		BoundaryStack mBoundaryStack; // Stack of crossed boundaries		
 	};
 
+	// Vertex connection deferred until its shadow ray is traced, media attenuation and MIS weight
+	// depend on the traced volume segments and are evaluated afterwards
+	struct PendingConnection
+	{
+		const UPBPLightVertex *mLightVertex; // Connected light vertex
+		Dir   mDirection;         // From camera to light vertex
+		float mDistance;          // Distance between the vertices
+		uint  mRaySamplingFlags;  // Flags for occlusion test
+		float mCameraBsdfDirPdfA; // Area PDF of sampling the light vertex from the camera vertex
+		float mCameraBsdfRevPdfW; // Reverse solid angle PDF of the camera BSDF
+		float mSinThetaCamera;    // Sine of angle between connection and incoming direction at the camera vertex
+		float mLightBsdfDirPdfA;  // Area PDF of sampling the camera vertex from the light vertex
+		float mLightBsdfRevPdfW;  // Reverse solid angle PDF of the light BSDF
+		float mSinThetaLight;     // Sine of angle between connection and incoming direction at the light vertex
+		Rgb   mUnoccluded;        // Contribution multiplied by vertex throughputs without attenuation and MIS weight
+		float mCullWeight;        // Set by ConnectionQueue::Cull
+	};
+
+	// Light tracing contribution waiting for its MIS weight until the light vertex cache is built
+	struct DeferredCameraConnection
+	{
+		int   mView;                      // View whose framebuffer receives the splat
+		Vec2f mImagePos;                  // Raster position of the splat
+		Rgb   mContrib;                   // Contribution without the MIS weight
+		int   mLightPathIdx;              // Index of the light path
+		int   mPathLength;                // Length of the light path up to the connected vertex
+		float mLastRevPdfA;               // Reverse PDF of the connected vertex
+		float mLastSinTheta;              // Sine at the connected vertex (0 on surfaces)
+		float mLastRaySampleRevPdfInv;    // Inverse reverse ray sampling PDF of the camera connection (0 on surfaces)
+		float mLastRaySampleRevPdfsRatio; // Ratio of reverse ray sampling PDFs (0 on surfaces)
+		float mNextToLastPartialRevPdfW;  // Reverse BSDF PDF at the connected vertex
+	};
+
 	// Range query used for PPM, BPM, and UPBP. When HashGrid finds a vertex
 	// within range -- Process() is called and vertex
 	// merging is performed. BSDF of the camera vertex is used.
+	template<uint TTechniques, bool TDebugImages>
 	class RangeQuery
 	{
 	public:
@@ -119,17 +163,17 @@ class UPBP : public AbstractRenderer
 
 			// MIS weight
 			float misWeight = 1.0f;
-			if (mUPBP.mAlgorithm != kPPM)
+			if (TTechniques || mUPBP.mAlgorithm != kPPM)
 			{
 				const float misWeightFactorInv = 1.0f / (aLightVertex.mInMedium ? aLightVertex.mMisData.mPP3DMisWeightFactor : aLightVertex.mMisData.mSurfMisWeightFactor);
-				const float wCamera = mUPBP.AccumulateCameraPathWeight2(mCameraState.mPathLength, misWeightFactorInv, sinTheta, aLightVertex.mMisData.mRaySamplePdfInv, aLightVertex.mMisData.mRaySamplePdfsRatio, cameraBsdfRevPdfW);
-				const float wLight = mUPBP.AccumulateLightPathWeight2(aLightVertex.mPathIdx, aLightVertex.mPathLength, misWeightFactorInv, 0, 0, 0, cameraBsdfDirPdfW, aLightVertex.mInMedium ? PP3D : SURF, false);
+				const float wCamera = mUPBP.AccumulateCameraPathWeight2<TTechniques>(mCameraState.mPathLength, misWeightFactorInv, sinTheta, aLightVertex.mMisData.mRaySamplePdfInv, aLightVertex.mMisData.mRaySamplePdfsRatio, cameraBsdfRevPdfW);
+				const float wLight = mUPBP.AccumulateLightPathWeight2<TTechniques>(aLightVertex.mPathIdx, aLightVertex.mPathLength, misWeightFactorInv, 0, 0, 0, cameraBsdfDirPdfW, aLightVertex.mInMedium ? PP3D : SURF, false);
 				misWeight = 1.f / (wLight + wCamera);
 			}
 
-			const Rgb mult = cameraBsdfFactor * aLightVertex.mThroughput;
+			const Rgb mult = cameraBsdfFactor * aLightVertex.mThroughput * aLightVertex.mMergeWeight;
 			mContrib += misWeight * mult;
-			mDebugImages.accumRgbWeight(aLightVertex.mPathLength, aLightVertex.mInMedium ? DebugImages::PP3D : DebugImages::SURFACE_PHOTON_MAPPING, mult, misWeight);
+			if (TDebugImages) mDebugImages.accumRgbWeight(aLightVertex.mPathLength, aLightVertex.mInMedium ? DebugImages::PP3D : DebugImages::SURFACE_PHOTON_MAPPING, mult, misWeight);
 		}
 
 	private:
@@ -179,11 +223,26 @@ public:
 		const float             aBB1DBeamStorageFactor,
 		const float             aRefPathCountPerIter,
 		const float             aPathCountPerIter,
+		const int               aCameraPassCount,
 		const float             aMinDistToMed,
 		const size_t			aMaxMemoryPerThread,
+		const float             aRRThreshold,
+		const int               aLvcConnections,
+		const int               aLvcCandidates,
+		const float             aShadowCullThreshold,
+		const bool              aConcurrentBuilds,
+		const bool              aSortLightData,
+		const float             aQueryCullSurvivalProb,
+		const float             aQueryTruncationThreshold,
+		const int               aTunerIterations,
+		const float             aTargetTimeRatio,
+		const float             aTargetCellOccupancy,
+		const float             aTunerMaxPathCount,
+		const uint              aTunerMaxGridSize,
 		const int               aSeed = 1234,
 		const int               aBaseSeed = 1234,
 		const bool				aIgnoreFullySpecPaths = false,
+		LightPathCounter*       aLightPathCounter = NULL,
 		const bool              aVerbose = false) :
 		AbstractRenderer(aScene),
 		mPB2DEmbreeBre(aScene),
@@ -208,12 +267,35 @@ public:
 		mBB1DBeamStorageFactor(aBB1DBeamStorageFactor),
 		mRefPathCountPerIter(aRefPathCountPerIter),
 		mPathCountPerIter(aPathCountPerIter),
+		mCameraPassCount(std::max(1, aCameraPassCount)),
+		mBB1DUsedLightSubPathFraction(0),
+		mLightPathCounter(aLightPathCounter ? aLightPathCounter : &mOwnLightPathCounter),
+		mConnectionMisFactor(1.0f),
+		mDeferCameraConnections(false),
 		mMinDistToMed(aMinDistToMed),
 		mMaxMemoryPerThread(aMaxMemoryPerThread),
+		mRRThreshold(aRRThreshold),
+		mLvcConnections(aLvcConnections),
+		mLvcCandidates(aLvcCandidates),
+		mShadowCullThreshold(aShadowCullThreshold),
+		mConcurrentBuilds(aConcurrentBuilds),
+		mSortLightData(aSortLightData),
+		mQueryCullSurvivalProb(aQueryCullSurvivalProb),
+		mQueryTruncationThreshold(aQueryTruncationThreshold),
+		mTunerIterations(aTunerIterations),
+		mTargetTimeRatio(aTargetTimeRatio),
+		mTargetCellOccupancy(aTargetCellOccupancy),
+		mTunerMaxPathCount(aTunerMaxPathCount),
+		mTunerMaxGridSize(aTunerMaxGridSize),
 		mIgnoreFullySpecPaths(aIgnoreFullySpecPaths),
+		mView(0),
 		mRng(aSeed),
 		mBaseSeed(aBaseSeed),
-		mVerbose(aVerbose)
+		mVerbose(aVerbose),
+		mLightPassTime(0),
+		mIterationCameraTime(0),
+		mBB1DCellOccupancy(0),
+		mLightDataMemory(MemoryBudget::kLightData)
 	{				
 		if (mSurfRadiusInitial < 0)
 			mSurfRadiusInitial = -mSurfRadiusInitial * mScene.mSceneSphere.mSceneRadius;
@@ -395,10 +477,117 @@ public:
 			mMergeWithLightVerticesPB2D = false;
 			mMergeWithLightVerticesBB1D = false;
 		}
+
+		// Common technique sets without any other settings get kernels specialized at compile time
+		mIterationKernel = &UPBP::RunIterationKernel<0, false>;
+		if (mAlgorithm == kBPT || mAlgorithm == kVCM || mAlgorithm == kCustom)
+		{
+			switch (mEstimatorTechniques)
+			{
+			case BPT:
+				mIterationKernel = &UPBP::RunIterationKernel<BPT, false>;
+				break;
+			case BPT | SURF:
+				mIterationKernel = &UPBP::RunIterationKernel<BPT | SURF, false>;
+				break;
+			case BB1D:
+				mIterationKernel = &UPBP::RunIterationKernel<BB1D, false>;
+				break;
+			case PB2D | BB1D:
+				mIterationKernel = &UPBP::RunIterationKernel<PB2D | BB1D, false>;
+				break;
+			case BPT | SURF | PP3D | PB2D | BB1D:
+				mIterationKernel = &UPBP::RunIterationKernel<BPT | SURF | PP3D | PB2D | BB1D, false>;
+				break;
+			}
+		}
 	}
 
 	virtual void RunIteration(int aIteration)
 	{
+		RunPhases(aIteration, kLightPhase | kCameraPhase);
+	}
+
+	virtual bool SupportsPhases() const { return true; }
+
+	virtual void RunLightPhase(int aIteration)
+	{
+		RunPhases(aIteration, kLightPhase);
+	}
+
+	virtual void RunCameraPhase(int aIteration)
+	{
+		RunPhases(aIteration, kCameraPhase);
+	}
+
+private:
+
+	// Phases of an iteration, the camera phase of an iteration must follow its light phase
+	enum IterationPhase
+	{
+		kLightPhase  = 1, // Light sub-paths and structures built over them
+		kCameraPhase = 2, // Camera sub-paths, ends the iteration
+		kViewPhase   = 4  // Camera sub-paths of the additional view mView, precedes the camera phase
+	};
+
+	void RunPhases(int aIteration, uint aPhases)
+	{
+		// Additional views reuse light sub-paths and structures of the iteration, the camera phase of
+		// the main camera is the last one, as it ends the iteration
+		if ((aPhases & kCameraPhase) && GetViewCount() > 0)
+		{
+			if (aPhases & kLightPhase)
+				RunKernel(aIteration, kLightPhase);
+
+			for (mView = 1; mView <= GetViewCount(); ++mView)
+				RunKernel(aIteration, kViewPhase);
+
+			mView = 0;
+			aPhases = kCameraPhase;
+		}
+
+		RunKernel(aIteration, aPhases);
+	}
+
+	void RunKernel(int aIteration, uint aPhases)
+	{
+		if (mDebugImages.IsUsed())
+			RunIterationKernel<0, true>(aIteration, aPhases);
+		else
+			(this->*mIterationKernel)(aIteration, aPhases);
+	}
+
+	// Camera of the given view, 0 is the main camera, others are Scene::mViews
+	const Camera& ViewCamera(const int aView) const
+	{
+		return aView ? mScene.mViews[aView - 1] : mScene.mCamera;
+	}
+
+	Framebuffer& ViewFramebuffer(const int aView)
+	{
+		return aView ? mViewFramebuffers[aView - 1] : mFramebuffer;
+	}
+
+	// Iteration kernel, TTechniques fixes estimator techniques at compile time (0 for generic kernel),
+	// debug images are collected only by kernels with TDebugImages set
+	typedef void (UPBP::*IterationKernel)(int aIteration, uint aPhases);
+
+	template<uint TTechniques, bool TDebugImages>
+	void RunIterationKernel(int aIteration, uint aPhases)
+	{
+		// In specialized kernels these are compile-time constants and the code of unused techniques is removed
+		const uint techniques                  = TTechniques ? TTechniques : mEstimatorTechniques;
+		const bool traceLightPaths             = TTechniques ? true : mTraceLightPaths;
+		const bool traceCameraPaths            = TTechniques ? true : mTraceCameraPaths;
+		const bool connectToCamera             = TTechniques ? (TTechniques & BPT) != 0 : mConnectToCamera;
+		const bool connectToCameraFromSurf     = TTechniques ? true : mConnectToCameraFromSurf;
+		const bool connectToLightSource        = TTechniques ? (TTechniques & BPT) != 0 : mConnectToLightSource;
+		const bool connectToLightVertices      = TTechniques ? (TTechniques & BPT) != 0 : mConnectToLightVertices;
+		const bool mergeWithLightVerticesSurf  = TTechniques ? (TTechniques & SURF) != 0 : mMergeWithLightVerticesSurf;
+		const bool mergeWithLightVerticesPP3D  = TTechniques ? (TTechniques & PP3D) != 0 : mMergeWithLightVerticesPP3D;
+		const bool mergeWithLightVerticesPB2D  = TTechniques ? (TTechniques & PB2D) != 0 : mMergeWithLightVerticesPB2D;
+		const bool mergeWithLightVerticesBB1D  = TTechniques ? (TTechniques & BB1D) != 0 : mMergeWithLightVerticesBB1D;
+
 		// Get path count, one path for each pixel
 		const int resX = int(mScene.mCamera.mResolution.get(0));
 		const int resY = int(mScene.mCamera.mResolution.get(1));
@@ -410,17 +599,41 @@ public:
 		mScreenPixelCount = float(pathCountC);
 		mLightSubPathCount = mPathCountPerIter;
 
-		if (!(mEstimatorTechniques & SPECULAR_ONLY))
+		if ((aPhases & kLightPhase) && !(techniques & SPECULAR_ONLY))
 		{
 			// To make list of photons and beams same in previous and compatible mode
 			mRng = Rng(mBaseSeed + aIteration);
 			mBB1DPhotonBeams.mSeed = mBaseSeed + aIteration;
 
-			if (mBB1DUsedLightSubPathCount < 0)
-				mBB1DUsedLightSubPathCount = std::floor(-mBB1DUsedLightSubPathCount * mLightSubPathCount);
+			if ((mTargetTimeRatio > 0 || mTargetCellOccupancy > 0) && !mIterationTuner.IsSetup())
+			{
+				// Paths are bounded also by the light vertices reserved for them (the arrays would grow beyond)
+				float maxPathCount = (float)mMaxMemoryPerThread / (sizeof(UPBPLightVertex) * std::min((int)mMaxPathLength, UPBP_LIGHT_AVGVERTS));
+				if (mTunerMaxPathCount > 0)
+					maxPathCount = std::min(maxPathCount, mTunerMaxPathCount);
+				mIterationTuner.Setup(mTargetTimeRatio, mTargetCellOccupancy, mPathCountPerIter, mVerbose, std::max(1.0f, maxPathCount), mTunerMaxGridSize);
+			}
 
-			// Radius reduction (1st iteration has aIteration == 0, thus offset)
-			const float effectiveIteration = 1 + aIteration * mLightSubPathCount / mRefPathCountPerIter;
+			// MIS weights of vertex connections to the light vertex cache depend on the cache size, so light
+			// tracing contributions wait for their weights until all light paths of this iteration are traced
+			mConnectionMisFactor = 1.0f;
+			mDeferCameraConnections = connectToLightVertices && mLvcConnections > 0 && connectToCamera;
+			mDeferredCameraConnections.clear();
+
+			mLightPassTimer.Start();
+
+			// Negative count is a fraction of light paths, kept as the path count may be tuned
+			if (mBB1DUsedLightSubPathCount < 0)
+				mBB1DUsedLightSubPathFraction = -mBB1DUsedLightSubPathCount;
+			if (mBB1DUsedLightSubPathFraction > 0)
+				mBB1DUsedLightSubPathCount = std::floor(mBB1DUsedLightSubPathFraction * mLightSubPathCount);
+			else
+				mBB1DUsedLightSubPathCount = std::min(mBB1DUsedLightSubPathCount, mLightSubPathCount);
+
+			// Radius reduction (1st iteration has aIteration == 0, thus offset). Iterations count in mean
+			// path counts of the light passes of all renderers so far, equal to the current ones unless tuned
+			mLightPathCounter->AddPass(mLightSubPathCount, mBB1DUsedLightSubPathCount);
+			const float effectiveIteration = 1 + aIteration * mLightPathCounter->GetMeanPathCount() / mRefPathCountPerIter;
 			// SURF
 			float radiusSurf = mSurfRadiusInitial * std::pow(effectiveIteration, (mSurfRadiusAlpha - 1) * 0.5f);
 			radiusSurf = std::max(radiusSurf, 1e-7f); // Purely for numeric stability
@@ -434,7 +647,7 @@ public:
 			radiusPB2D = std::max(radiusPB2D, 1e-7f); // Purely for numeric stability
 			const float radiusPB2DSqr = Utils::sqr(radiusPB2D);
 			// BB1D
-			float radiusBB1D = mBB1DRadiusInitial * std::pow(1 + aIteration * mBB1DUsedLightSubPathCount / mRefPathCountPerIter, mBB1DRadiusAlpha - 1);
+			float radiusBB1D = mBB1DRadiusInitial * std::pow(1 + aIteration * mLightPathCounter->GetMeanBB1DPathCount() / mRefPathCountPerIter, mBB1DRadiusAlpha - 1);
 			radiusBB1D = std::max(radiusBB1D, 1e-7f); // Purely for numeric stability
 
 			// Constant for decision whether to store beams or not
@@ -466,6 +679,8 @@ public:
 			// Because of static mCameraVerticesMisData size
 			UPBP_ASSERT(mMaxPathLength < UPBP_CAMERA_MAXVERTS);
 
+			// Thread memory limit caps the reservation. When more vertices or beams are traced the arrays grow beyond it,
+			// which is safe since beams refer to vertices by index, and the grown capacity is tracked by mLightDataMemory
 			const float maxLightVerts = std::min(mLightSubPathCount * std::min((int)mMaxPathLength, UPBP_LIGHT_AVGVERTS), (float)mMaxMemoryPerThread / sizeof(UPBPLightVertex));
 			const float maxBeams = std::min(mBB1DUsedLightSubPathCount * std::min((int)mMaxPathLength, UPBP_LIGHT_AVGVERTS), (float)mMaxMemoryPerThread / sizeof(UPBPLightVertex));
 			
@@ -474,6 +689,7 @@ public:
 			
 			// Remove all light vertices and reserve space for some		
 			mLightVertices.clear();
+			mPathVertexIndices.clear();
 			mLightVertices.reserve((int)maxLightVerts);
 			
 			if (mVerbose)
@@ -488,6 +704,12 @@ public:
 			mLightVerticesOnSurfaceCount = 0;
 			mLightVerticesInMediumCount = 0;
 
+			if (mQueryCullSurvivalProb > 0 && !mQueryVolume.IsSetup())
+				mQueryVolume.Setup(mScene.mSceneSphere.mSceneCenter, mScene.mSceneSphere.mSceneRadius, 64);
+
+			if (mTunerIterations > 0 && !mEstimatorTuner.IsSetup())
+				mEstimatorTuner.Setup(mScene.mMedia, mEstimatorTechniques, mTunerIterations, mVerbose);
+
 			//////////////////////////////////////////////////////////////////////////
 			// Generate light paths
 			//////////////////////////////////////////////////////////////////////////
@@ -498,7 +720,7 @@ public:
 			mTimer.Start();
 
 			// If pure path tracing is used, there are no lights or only one path segment is allowed, light tracing step is skipped
-			if (mTraceLightPaths && mScene.GetLightCount() > 0 && mMaxPathLength > 1)
+			if (traceLightPaths && mScene.GetLightCount() > 0 && mMaxPathLength > 1)
 			for (int pathIdx = 0; pathIdx < pathCountL; pathIdx++)
 			{
 				// Generate light path origin and direction
@@ -529,9 +751,9 @@ public:
 					bool intersected = mScene.Intersect(ray, originInMedium ? AbstractMedium::kOriginInMedium : 0, mRng, isect, lightState.mBoundaryStack, mVolumeSegments, mLiteVolumeSegments);
 
 					// Store beam if required
-					if (mMergeWithLightVerticesBB1D && pathIdx < mBB1DUsedLightSubPathCount)
+					if (mergeWithLightVerticesBB1D && pathIdx < mBB1DUsedLightSubPathCount)
 					{
-						AddBeams(ray, lightState.mThroughput, &mLightVertices.back(), originInMedium ? AbstractMedium::kOriginInMedium : 0, lightState.mLastPdfWInv);
+						AddBeams(ray, lightState.mThroughput, (int)mLightVertices.size() - 1, originInMedium ? AbstractMedium::kOriginInMedium : 0, lightState.mLastPdfWInv);
 					}
 
 					if (!intersected)
@@ -580,6 +802,7 @@ public:
 						lightVertex.mInMedium = originInMedium;
 						lightVertex.mConnectable = !bsdf.IsDelta();
 						lightVertex.mIsFinite = true;
+						lightVertex.mMergeWeight = QueryCullingWeight(hitPoint);
 						lightVertex.mBSDF = bsdf;
 
 						// Determine whether the vertex is in medium behind real geometry
@@ -606,14 +829,15 @@ public:
 						lightVertex.mMisData.mSinTheta = 0.0f;
 						lightVertex.mMisData.mCosThetaOut = 0.0f;
 						lightVertex.mMisData.mSurfMisWeightFactor = bsdf.IsOnSurface() ? mSurfMisWeightFactor : 0;
-						lightVertex.mMisData.mPP3DMisWeightFactor = bsdf.IsOnSurface() ? 0 : mPP3DMisWeightFactor;
-						lightVertex.mMisData.mPB2DMisWeightFactor = bsdf.IsOnSurface() ? 0 : mPB2DMisWeightFactor;
+						lightVertex.mMisData.mPP3DMisWeightFactor = (bsdf.IsOnSurface() || !(MediumTechniques(bsdf.GetMedium()) & PP3D)) ? 0 : mPP3DMisWeightFactor;
+						lightVertex.mMisData.mPB2DMisWeightFactor = (bsdf.IsOnSurface() || !(MediumTechniques(bsdf.GetMedium()) & PB2D)) ? 0 : mPB2DMisWeightFactor;
 						lightVertex.mMisData.mBB1DMisWeightFactor = bsdf.IsOnSurface() ? 0 : mBB1DMisWeightFactor;
 						lightVertex.mMisData.mBB1DBeamSelectionPdf = bsdf.IsOnSurface() ? 0 : 1;
+						lightVertex.mMisData.mConnectionMisFactor = mConnectionMisFactor;
 						lightVertex.mMisData.mIsDelta = bsdf.IsDelta();
 						lightVertex.mMisData.mIsOnLightSource = false;
 						lightVertex.mMisData.mIsSpecular = false;
-						lightVertex.mMisData.mInMediumWithBeams = bsdf.IsOnSurface() ? false : (!mMergeWithLightVerticesPB2D || bsdf.GetMedium()->GetMeanFreePath(hitPoint) > mBB1DMinMFP);
+						lightVertex.mMisData.mInMediumWithBeams = bsdf.IsOnSurface() ? false : MediumUsesBeams(bsdf.GetMedium(), hitPoint, mergeWithLightVerticesPB2D);
 
 						lightVertex.mMisData.mRaySamplePdfsRatio = 0.0f;
 						lightVertex.mMisData.mRaySampleRevPdfsRatio = 0.0f;
@@ -650,15 +874,15 @@ public:
 						else
 							mLightVerticesOnSurfaceCount++;
 
-						UPBP_ASSERT(mLightVertices.size() < mLightVertices.capacity());
 						mLightVertices.push_back(lightVertex);
 					}
 
 					// Connect to camera, unless scattering function is purely specular or we are not allowed to connect from surface
-					if (mConnectToCamera && !bsdf.IsDelta() && (bsdf.IsInMedium() || mConnectToCameraFromSurf))
+					if (connectToCamera && !bsdf.IsDelta() && (bsdf.IsInMedium() || connectToCameraFromSurf))
 					{
 						if (lightState.mPathLength + 1 >= mMinPathLength)
-							ConnectToCamera(pathIdx, lightState, hitPoint, bsdf, mLightVertices.back().mMisData.mRaySamplePdfsRatio);
+							for (int view = 0; view <= GetViewCount(); ++view)
+								ConnectToCamera<TTechniques, TDebugImages>(view, pathIdx, lightState, hitPoint, bsdf, mLightVertices.back().mMisData.mRaySamplePdfsRatio);
 					}
 
 					// Terminate if the path would become too long after scattering
@@ -677,59 +901,111 @@ public:
 			if (mVerbose)
 				std::cout << "    - light sub-path tracing done in " << mTimer.GetLastElapsedTime() << " sec. " << std::endl;
 
+			// Reorder light vertices and beams along the Morton curve for merging
+			if (mSortLightData && mMaxPathLength > 1)
+				SortLightData();
+
+			// Collect connectable vertices of all light paths into the light vertex cache
+			mLightVertexCache.clear();
+			if (connectToLightVertices && mLvcConnections > 0)
+			{
+				for (int i = 0; i < (int)mLightVertices.size(); i++)
+					if (mLightVertices[i].mConnectable)
+						mLightVertexCache.push_back(i);
+
+				// Vertex connections to the cache are weighted as if selected uniformly: BPT connects to every
+				// vertex of one light path, the cache to mLvcConnections of all vertices
+				if (!mLightVertexCache.empty())
+					mConnectionMisFactor = mLvcConnections * mLightSubPathCount / mLightVertexCache.size();
+				for (std::vector<UPBPLightVertex>::iterator it = mLightVertices.begin(); it != mLightVertices.end(); ++it)
+					if (!it->mMisData.mIsOnLightSource)
+						it->mMisData.mConnectionMisFactor = mConnectionMisFactor;
+			}
+
+			// Light tracing contributions can be weighted now
+			for (std::vector<DeferredCameraConnection>::const_iterator it = mDeferredCameraConnections.cbegin(); it != mDeferredCameraConnections.cend(); ++it)
+			{
+				const float wLight = AccumulateLightPathWeight2<TTechniques>(it->mLightPathIdx, it->mPathLength, it->mLastRevPdfA, it->mLastSinTheta, it->mLastRaySampleRevPdfInv, it->mLastRaySampleRevPdfsRatio, it->mNextToLastPartialRevPdfW, BPT, true) / mScreenPixelCount;
+				const float misWeight = 1.0f / (1.f + wLight);
+				if (TDebugImages) mDebugImages.addSample(0, it->mPathLength + 1, DebugImages::BPT, it->mImagePos, it->mContrib, it->mContrib * misWeight, misWeight);
+				ViewFramebuffer(it->mView).AddColor(it->mImagePos, it->mContrib * misWeight);
+			}
+
+			mLightDataMemory.Set(mLightVertices.capacity() * sizeof(UPBPLightVertex) + mPhotonBeamsArray.capacity() * sizeof(PhotonBeam) +
+				(mPathEnds.capacity() + mPathVertexIndices.capacity() + mLightVertexCache.capacity()) * sizeof(int) +
+				mDeferredCameraConnections.capacity() * sizeof(DeferredCameraConnection));
+
 			int photons = 0;
 
 			if (mMaxPathLength > 1)
 			{
+				// The structures only read positions and types of light vertices and beams, so with
+				// mConcurrentBuilds the builds of SURF, PP3D and PB2D run as tasks while this thread builds BB1D
+				std::vector<std::future<void>> builds;
+
 				if (!mLightVertices.empty())
 				{
 					//////////////////////////////////////////////////////////////////////////
 					// Build acceleration structure for SURF
 					//////////////////////////////////////////////////////////////////////////
-					if (mMergeWithLightVerticesSurf && mLightVerticesOnSurfaceCount)
+					if (mergeWithLightVerticesSurf && mLightVerticesOnSurfaceCount)
 					{
 						// The number of cells is somewhat arbitrary, but seems to work ok
-						mSurfHashGrid.Reserve(pathCountL);
-						mSurfHashGrid.Build(mLightVertices, radiusSurf, SURF);
+						RunBuild(builds, [&]() {
+							mSurfHashGrid.Reserve(pathCountL);
+							mSurfHashGrid.Build(mLightVertices, radiusSurf, SURF);
+						});
 					}
 
 					//////////////////////////////////////////////////////////////////////////
 					// Build acceleration structure for PP3D
 					//////////////////////////////////////////////////////////////////////////
-					if (mMergeWithLightVerticesPP3D && mLightVerticesInMediumCount)
+					if (mergeWithLightVerticesPP3D && mLightVerticesInMediumCount)
 					{
 						// The number of cells is somewhat arbitrary, but seems to work ok
-						mPP3DHashGrid.Reserve(pathCountL);
-						mPP3DHashGrid.Build(mLightVertices, radiusPP3D, PP3D);
+						RunBuild(builds, [&]() {
+							mPP3DHashGrid.Reserve(pathCountL);
+							mPP3DHashGrid.Build(mLightVertices, radiusPP3D, PP3D);
+						});
 					}
 
 					//////////////////////////////////////////////////////////////////////////
 					// Build acceleration structure for PB2D
 					//////////////////////////////////////////////////////////////////////////
-					if (mMergeWithLightVerticesPB2D)
+					if (mergeWithLightVerticesPB2D)
 					{
-						photons = mPB2DEmbreeBre.build(&mLightVertices[0], (int)mLightVertices.size(), mPB2DRadiusCalculation, radiusPB2D, mPB2DRadiusKNN, mVerbose);
+						RunBuild(builds, [&]() {
+							photons = mPB2DEmbreeBre.build(&mLightVertices[0], (int)mLightVertices.size(), mPB2DRadiusCalculation, radiusPB2D, mPB2DRadiusKNN, mVerbose);
+						});
 					}
 				}
 
 				//////////////////////////////////////////////////////////////////////////
 				// Build acceleration structure for BB1D
 				//////////////////////////////////////////////////////////////////////////
-				if (mMergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty())
+				mBB1DCellOccupancy = 0;
+				if (mergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty())
 				{
 					mBB1DPhotonBeams.build(mPhotonBeamsArray, mBB1DRadiusCalculation, radiusBB1D, mBB1DRadiusKNN, mVerbose);
+					mBB1DCellOccupancy = mBB1DPhotonBeams.getMeanCellOccupancy();
 
-					// Set beam selection PDFs according to the built structure
-					if (mBB1DPhotonBeams.sMaxBeamsInCell)
-					for (std::vector<UPBPLightVertex>::iterator i = mLightVertices.begin(); i != mLightVertices.end(); ++i)
-					{
-						if (i->mBSDF.IsInMedium())
-							i->mMisData.mBB1DBeamSelectionPdf = mBB1DPhotonBeams.getBeamSelectionPdf(i->mHitpoint);
-					}
+					// Set beam selection PDFs according to the built structure (writes only the MIS data,
+					// which are not read by the other builds)
+					if (mBB1DPhotonBeams.mMaxBeamsInCell)
+						SetBeamSelectionPdfs();
 				}
+
+				for (std::vector<std::future<void>>::iterator i = builds.begin(); i != builds.end(); ++i)
+					i->get();
 			}
+
+			mLightPassTimer.Stop();
+			mLightPassTime = mLightPassTimer.GetLastElapsedTime();
 		}
 
+		if (!(aPhases & (kCameraPhase | kViewPhase)))
+			return;
+
 		//////////////////////////////////////////////////////////////////////////
 		// Generate camera paths
 		//////////////////////////////////////////////////////////////////////////
@@ -738,10 +1014,22 @@ public:
 			std::cout << " + tracing camera sub-paths..." << std::endl;
 		mTimer.Start();
 
+		// Each pixel is sampled mCameraPassCount times with the same light vertices and beams. Every camera
+		// pass is an estimator on its own (MIS weights do not change), so the passes are averaged, while
+		// contributions of light tracing above are added once.
+		// Camera paths are traced only through pixels of the crop rectangles of the camera
+		const Camera &camera = ViewCamera(mView);
+		const int cropPixelCount = camera.GetCropPixelCount();
+		const int cameraSampleCount = cropPixelCount * mCameraPassCount;
+		const float cameraPassWeight = 1.f / mCameraPassCount;
+		if (TDebugImages) mDebugImages.SetSampleScale(cameraPassWeight);
+
 		// Unless rendering with traditional light tracing
-		if (mTraceCameraPaths)
-		for (int pathIdx = 0; pathIdx < pathCountC; ++pathIdx)
+		if (traceCameraPaths)
+		for (int cameraSampleIdx = 0; cameraSampleIdx < cameraSampleCount; ++cameraSampleIdx)
 		{
+			const int pathIdx = camera.GetCropPixelIndex(cameraSampleIdx % cropPixelCount);
+
 			// Generate camera path origin and direction			
 			SubPathState cameraState;
 			const Vec2f screenSample = GenerateCameraSample(pathIdx, cameraState);
@@ -753,7 +1041,7 @@ public:
 			// Medium of the previous vertex
 			const AbstractMedium* lastMedium = NULL;
 
-			bool onlySpecSurf = (mEstimatorTechniques & (PREVIOUS | COMPATIBLE)) != 0;
+			bool onlySpecSurf = (techniques & (PREVIOUS | COMPATIBLE)) != 0;
 			bool stopBB1D = false;
 
 			//////////////////////////////////////////////////////////////////////
@@ -771,30 +1059,39 @@ public:
 				{
 					//UPBP_ASSERT(!mScene.GetGlobalMediumPtr()->HasScattering());			
 
+					if (mQueryCullSurvivalProb > 0 && (mergeWithLightVerticesPB2D || mergeWithLightVerticesBB1D))
+						RecordQuerySegments(ray);
+
 					// Vertex merging: point x beam 2D
-					if (mMergeWithLightVerticesPB2D && !mLightVertices.empty())
+					if (mergeWithLightVerticesPB2D && !mLightVertices.empty())
 					{
-						mDebugImages.ResetAccum();
-						uint estimatorTechniques = mEstimatorTechniques;
+						if (TDebugImages) mDebugImages.ResetAccum();
+						uint estimatorTechniques = techniques;
 						//if (!cameraState.mSpecularPath) estimatorTechniques |= BEAM_REDUCTION;
-						embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, (mMergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty()) ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, &mDebugImages);
+						embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, (mergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty()) ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, TDebugImages ? &mDebugImages : NULL);
+						data.mPathVertexIndices = (void*)PathVertexIndices();
+						data.mQueryTruncation = (void*)ActiveQueryTruncation();
+						data.mEstimatorTuner = (void*)ActiveEstimatorTuner(Luminance(cameraState.mThroughput) * mPB2DNormalization);
 						const Rgb contrib = mPB2DEmbreeBre.evalBre(mQueryBeamType, ray, mVolumeSegments, estimatorTechniques, originInMedium ? AbstractMedium::kOriginInMedium : 0, &data);
 						const Rgb mult = cameraState.mThroughput * mPB2DNormalization;
 						color += mult * contrib;
-						mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::PB2D, screenSample, mult);
+						if (TDebugImages) mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::PB2D, screenSample, mult);
 					}
 
 					// Vertex merging: beam x beam 1D
-					if (mMergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty() && !stopBB1D)
+					if (mergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty() && !stopBB1D)
 					{
-						mDebugImages.ResetAccum();
-						uint estimatorTechniques = mEstimatorTechniques;
+						if (TDebugImages) mDebugImages.ResetAccum();
+						uint estimatorTechniques = techniques;
 						//if (!cameraState.mSpecularPath) estimatorTechniques |= BEAM_REDUCTION;
-						embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, !mPhotonBeamsArray.empty() ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mBB1DUsedLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, &mDebugImages);
+						embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, !mPhotonBeamsArray.empty() ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mBB1DUsedLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, TDebugImages ? &mDebugImages : NULL);
+						data.mPathVertexIndices = (void*)PathVertexIndices();
+						data.mQueryTruncation = (void*)ActiveQueryTruncation();
+						data.mEstimatorTuner = (void*)ActiveEstimatorTuner(Luminance(cameraState.mThroughput) * mBB1DNormalization);
 						const Rgb contrib = mBB1DPhotonBeams.evalBeamBeamEstimate(mQueryBeamType, ray, mVolumeSegments, estimatorTechniques, originInMedium ? AbstractMedium::kOriginInMedium : 0, &data);
 						const Rgb mult = cameraState.mThroughput * mBB1DNormalization;
 						color += mult * contrib;
-						mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::BB1D, screenSample, mult);
+						if (TDebugImages) mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::BB1D, screenSample, mult);
 					}
 
 					// We cannot end yet
@@ -811,7 +1108,7 @@ public:
 						break;
 
 					// Stop if we are in the light sampling mode and could have sampled this light last time in the next event estimation
-					if (mAlgorithm == kPTls && cameraState.mPathLength > 1 && !cameraState.mLastSpecular)
+					if (!TTechniques && mAlgorithm == kPTls && cameraState.mPathLength > 1 && !cameraState.mLastSpecular)
 						break;
 
 					// Attenuate by intersected media (if any)
@@ -848,6 +1145,7 @@ public:
 					mCameraVerticesMisData[cameraState.mPathLength].mPB2DMisWeightFactor = 0.0f;
 					mCameraVerticesMisData[cameraState.mPathLength].mBB1DMisWeightFactor = 0.0f;
 					mCameraVerticesMisData[cameraState.mPathLength].mBB1DBeamSelectionPdf = 0.0f;
+					mCameraVerticesMisData[cameraState.mPathLength].mConnectionMisFactor = 1.0f;
 					mCameraVerticesMisData[cameraState.mPathLength].mIsDelta = false;
 					mCameraVerticesMisData[cameraState.mPathLength].mIsOnLightSource = true;
 					mCameraVerticesMisData[cameraState.mPathLength].mIsSpecular = false;
@@ -863,51 +1161,63 @@ public:
 						mCameraVerticesMisData[cameraState.mPathLength - 1].mRaySampleRevPdfsRatio = firstSegmentRayOverSampleRevPdf / firstSegmentRayInSampleRevPdf;
 					}
 
-					mDebugImages.ResetTemp();
+					if (TDebugImages) mDebugImages.ResetTemp();
 					// Accumulate contribution
 					color += cameraState.mThroughput *
-						GetLightRadiance(mScene.GetBackground(), cameraState, Pos(0));
-					const Rgb debugRgb = cameraState.mThroughput * mDebugImages.getTempRGB();
-					mDebugImages.addSample(cameraState.mPathLength, 0, DebugImages::BPT, screenSample, debugRgb, debugRgb * mDebugImages.getTempMisWeight(), mDebugImages.getTempMisWeight());
+						GetLightRadiance<TTechniques, TDebugImages>(mScene.GetBackground(), cameraState, Pos(0));
+					if (TDebugImages)
+					{
+						const Rgb debugRgb = cameraState.mThroughput * mDebugImages.getTempRGB();
+						mDebugImages.addSample(cameraState.mPathLength, 0, DebugImages::BPT, screenSample, debugRgb, debugRgb * mDebugImages.getTempMisWeight(), mDebugImages.getTempMisWeight());
+					}
 					break;
 				}
 
 				UPBP_ASSERT(isect.IsValid());
 
+				if (mQueryCullSurvivalProb > 0 && (mergeWithLightVerticesPB2D || mergeWithLightVerticesBB1D))
+					RecordQuerySegments(ray);
+
 				////////////////////////////////////////////////////////////////
 				// Vertex merging: point x beam 2D
-				if (mMergeWithLightVerticesPB2D && !mLightVertices.empty())
+				if (mergeWithLightVerticesPB2D && !mLightVertices.empty())
 				{
-					mDebugImages.ResetAccum();
+					if (TDebugImages) mDebugImages.ResetAccum();
 					Rgb contrib(0);
-					uint estimatorTechniques = mEstimatorTechniques;
+					uint estimatorTechniques = techniques;
 					//if (!cameraState.mSpecularPath) estimatorTechniques |= BEAM_REDUCTION;
-					embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, (mMergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty()) ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, &mDebugImages);
+					embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, (mergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty()) ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, TDebugImages ? &mDebugImages : NULL);
+					data.mPathVertexIndices = (void*)PathVertexIndices();
+					data.mQueryTruncation = (void*)ActiveQueryTruncation();
+					data.mEstimatorTuner = (void*)ActiveEstimatorTuner(Luminance(cameraState.mThroughput) * mPB2DNormalization);
 					if (isect.IsOnSurface() || mQueryBeamType == SHORT_BEAM)
 						contrib = mPB2DEmbreeBre.evalBre(mQueryBeamType, ray, mVolumeSegments, estimatorTechniques, originInMedium ? AbstractMedium::kOriginInMedium : 0, &data);
 					else
 						contrib = mPB2DEmbreeBre.evalBre(mQueryBeamType, ray, mLiteVolumeSegments, estimatorTechniques, originInMedium ? AbstractMedium::kOriginInMedium : 0, &data);
 					const Rgb mult = cameraState.mThroughput * mPB2DNormalization;
 					color += mult * contrib;
-					mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::PB2D, screenSample, mult);
+					if (TDebugImages) mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::PB2D, screenSample, mult);
 				}
 
 				////////////////////////////////////////////////////////////////
 				// Vertex merging: beam x beam 1D
-				if (mMergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty() && !stopBB1D)
+				if (mergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty() && !stopBB1D)
 				{
-					mDebugImages.ResetAccum();
+					if (TDebugImages) mDebugImages.ResetAccum();
 					Rgb contrib(0);
-					uint estimatorTechniques = mEstimatorTechniques;
+					uint estimatorTechniques = techniques;
 					//if (!cameraState.mSpecularPath) estimatorTechniques |= BEAM_REDUCTION;
-					embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, !mPhotonBeamsArray.empty() ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mBB1DUsedLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, &mDebugImages);
+					embree::AdditionalRayDataForMis data(&mLightVertices, &mPathEnds, &mCameraVerticesMisData, cameraState.mPathLength, mMinPathLength, mMaxPathLength, mQueryBeamType, mPhotonBeamType, cameraState.mLastPdfWInv, mSurfMisWeightFactor, mPP3DMisWeightFactor, mPB2DMisWeightFactor, mBB1DMisWeightFactor, !mPhotonBeamsArray.empty() ? &mBB1DPhotonBeams : NULL, mBB1DMinMFP, mBB1DUsedLightSubPathCount, mMinDistToMed, 0.0f, 0.0f, 0, TDebugImages ? &mDebugImages : NULL);
+					data.mPathVertexIndices = (void*)PathVertexIndices();
+					data.mQueryTruncation = (void*)ActiveQueryTruncation();
+					data.mEstimatorTuner = (void*)ActiveEstimatorTuner(Luminance(cameraState.mThroughput) * mBB1DNormalization);
 					if (isect.IsOnSurface() || mQueryBeamType == SHORT_BEAM)
 						contrib = mBB1DPhotonBeams.evalBeamBeamEstimate(mQueryBeamType, ray, mVolumeSegments, estimatorTechniques, originInMedium ? AbstractMedium::kOriginInMedium : 0, &data);
 					else
 						contrib = mBB1DPhotonBeams.evalBeamBeamEstimate(mQueryBeamType, ray, mLiteVolumeSegments, estimatorTechniques, originInMedium ? AbstractMedium::kOriginInMedium : 0, &data);
 					const Rgb mult = cameraState.mThroughput * mBB1DNormalization;
 					color += mult * contrib;
-					mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::BB1D, screenSample, mult);
+					if (TDebugImages) mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::BB1D, screenSample, mult);
 				}
 
 				// Attenuate by intersected media (if any)
@@ -952,14 +1262,15 @@ public:
 					mCameraVerticesMisData[cameraState.mPathLength].mSinTheta = 0.0f;
 					mCameraVerticesMisData[cameraState.mPathLength].mCosThetaOut = 0.0f;
 					mCameraVerticesMisData[cameraState.mPathLength].mSurfMisWeightFactor = bsdf.IsOnSurface() ? (isect.mLightID >= 0 ? 0.0f : mSurfMisWeightFactor) : 0.0f;
-					mCameraVerticesMisData[cameraState.mPathLength].mPP3DMisWeightFactor = bsdf.IsOnSurface() ? 0.0f : mPP3DMisWeightFactor;
-					mCameraVerticesMisData[cameraState.mPathLength].mPB2DMisWeightFactor = bsdf.IsOnSurface() ? 0.0f : mPB2DMisWeightFactor;
+					mCameraVerticesMisData[cameraState.mPathLength].mPP3DMisWeightFactor = (bsdf.IsOnSurface() || !(MediumTechniques(bsdf.GetMedium()) & PP3D)) ? 0.0f : mPP3DMisWeightFactor;
+					mCameraVerticesMisData[cameraState.mPathLength].mPB2DMisWeightFactor = (bsdf.IsOnSurface() || !(MediumTechniques(bsdf.GetMedium()) & PB2D)) ? 0.0f : mPB2DMisWeightFactor;
 					mCameraVerticesMisData[cameraState.mPathLength].mBB1DMisWeightFactor = bsdf.IsOnSurface() ? 0.0f : mBB1DMisWeightFactor;
-					mCameraVerticesMisData[cameraState.mPathLength].mBB1DBeamSelectionPdf = bsdf.IsOnSurface() ? 0.0f : ((mMergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty() && mBB1DPhotonBeams.sMaxBeamsInCell) ? mBB1DPhotonBeams.getBeamSelectionPdf(hitPoint) : 1.0f);
+					mCameraVerticesMisData[cameraState.mPathLength].mBB1DBeamSelectionPdf = bsdf.IsOnSurface() ? 0.0f : ((mergeWithLightVerticesBB1D && !mPhotonBeamsArray.empty() && mBB1DPhotonBeams.mMaxBeamsInCell) ? mBB1DPhotonBeams.getBeamSelectionPdf(hitPoint) : 1.0f);
+					mCameraVerticesMisData[cameraState.mPathLength].mConnectionMisFactor = isect.mLightID >= 0 ? 1.0f : mConnectionMisFactor;
 					mCameraVerticesMisData[cameraState.mPathLength].mIsDelta = isect.mLightID >= 0 ? false : bsdf.IsDelta();
 					mCameraVerticesMisData[cameraState.mPathLength].mIsOnLightSource = isect.mLightID >= 0;
 					mCameraVerticesMisData[cameraState.mPathLength].mIsSpecular = false;
-					mCameraVerticesMisData[cameraState.mPathLength].mInMediumWithBeams = bsdf.IsOnSurface() ? false : (!mMergeWithLightVerticesPB2D || bsdf.GetMedium()->GetMeanFreePath(hitPoint) > mBB1DMinMFP);
+					mCameraVerticesMisData[cameraState.mPathLength].mInMediumWithBeams = bsdf.IsOnSurface() ? false : MediumUsesBeams(bsdf.GetMedium(), hitPoint, mergeWithLightVerticesPB2D);
 
 					mCameraVerticesMisData[cameraState.mPathLength].mRaySamplePdfsRatio = 0.0f;
 					mCameraVerticesMisData[cameraState.mPathLength].mRaySampleRevPdfsRatio = 0.0f;
@@ -1000,7 +1311,7 @@ public:
 						break;
 
 					// Stop if we are in the light sampling mode and could have sampled this light last time in the next event estimation
-					if (mAlgorithm == kPTls && cameraState.mPathLength > 1 && !cameraState.mLastSpecular)
+					if (!TTechniques && mAlgorithm == kPTls && cameraState.mPathLength > 1 && !cameraState.mLastSpecular)
 						break;
 
 					// Get hit light
@@ -1008,12 +1319,15 @@ public:
 					UPBP_ASSERT(light);
 
 					// Add its contribution
-					mDebugImages.ResetTemp();
+					if (TDebugImages) mDebugImages.ResetTemp();
 					const Rgb contrib = cameraState.mThroughput *
-						GetLightRadiance(light, cameraState, hitPoint);
+						GetLightRadiance<TTechniques, TDebugImages>(light, cameraState, hitPoint);
 					color += contrib;
-					const Rgb debugRgb = cameraState.mThroughput * mDebugImages.getTempRGB();
-					mDebugImages.addSample(cameraState.mPathLength, 0, DebugImages::BPT, screenSample, debugRgb, debugRgb * mDebugImages.getTempMisWeight(), mDebugImages.getTempMisWeight());
+					if (TDebugImages)
+					{
+						const Rgb debugRgb = cameraState.mThroughput * mDebugImages.getTempRGB();
+						mDebugImages.addSample(cameraState.mPathLength, 0, DebugImages::BPT, screenSample, debugRgb, debugRgb * mDebugImages.getTempMisWeight(), mDebugImages.getTempMisWeight());
+					}
 					break;
 				}
 
@@ -1026,18 +1340,21 @@ public:
 				{
 					////////////////////////////////////////////////////////////////
 					// Vertex connection: Connect to a light source
-					if (mConnectToLightSource && !bsdf.IsDelta() && cameraState.mPathLength + 1 >= mMinPathLength && mScene.GetLightCount() > 0 && (bsdf.IsInMedium() || !onlySpecSurf))
+					if (connectToLightSource && !bsdf.IsDelta() && cameraState.mPathLength + 1 >= mMinPathLength && mScene.GetLightCount() > 0 && (bsdf.IsInMedium() || !onlySpecSurf))
 					{
-						mDebugImages.ResetTemp();
+						if (TDebugImages) mDebugImages.ResetTemp();
 						color += cameraState.mThroughput *
-							DirectIllumination(cameraState, hitPoint, bsdf);
-						const Rgb debugRgb = cameraState.mThroughput * mDebugImages.getTempRGB();
-						mDebugImages.addSample(cameraState.mPathLength + 1, 0, DebugImages::BPT, screenSample, debugRgb, debugRgb * mDebugImages.getTempMisWeight(), mDebugImages.getTempMisWeight());
+							DirectIllumination<TTechniques, TDebugImages>(cameraState, hitPoint, bsdf);
+						if (TDebugImages)
+						{
+							const Rgb debugRgb = cameraState.mThroughput * mDebugImages.getTempRGB();
+							mDebugImages.addSample(cameraState.mPathLength + 1, 0, DebugImages::BPT, screenSample, debugRgb, debugRgb * mDebugImages.getTempMisWeight(), mDebugImages.getTempMisWeight());
+						}
 					}
 
 					////////////////////////////////////////////////////////////////
 					// Vertex connection: Connect to light vertices
-					if (mConnectToLightVertices && !bsdf.IsDelta() && !mLightVertices.empty() && (bsdf.IsInMedium() || !onlySpecSurf))
+					if (connectToLightVertices && !bsdf.IsDelta() && !mLightVertices.empty() && (bsdf.IsInMedium() || !onlySpecSurf))
 					{
 						// Determine whether the vertex is in medium behind real geometry
 						bool behindSurf = false;
@@ -1052,73 +1369,81 @@ public:
 							}
 						}
 
-						int pathIdxMod = mRng.GetUint() % pathCountL;
+						if (mLvcConnections > 0)
+							ConnectToLightVertexCache(bsdf, hitPoint, cameraState, behindSurf);
+						else
+						{
+							int pathIdxMod = mRng.GetUint() % pathCountL;
+
+							// For VC, each light sub-path is assigned to a particular eye
+							// sub-path, as in traditional BPT. It is also possible to
+							// connect to vertices from any light path, but MIS should
+							// be revisited.
+							const Vec2i range(
+								(pathIdxMod == 0) ? 0 : mPathEnds[pathIdxMod - 1],
+								mPathEnds[pathIdxMod]);
 
-						// For VC, each light sub-path is assigned to a particular eye
-						// sub-path, as in traditional BPT. It is also possible to
-						// connect to vertices from any light path, but MIS should
-						// be revisited.
-						const Vec2i range(
-							(pathIdxMod == 0) ? 0 : mPathEnds[pathIdxMod - 1],
-							mPathEnds[pathIdxMod]);
+							for (int i = range[0]; i < range[1]; i++)
+							{
+								const UPBPLightVertex &lightVertex = PathOrderedLightVertex(&mLightVertices, PathVertexIndices(), i);
 
-						for (int i = range[0]; i < range[1]; i++)
-						{
-							const UPBPLightVertex &lightVertex = mLightVertices[i];
-
-							if (lightVertex.mPathLength + 1 +
-								cameraState.mPathLength < mMinPathLength)
-								continue;
-
-							// Light vertices are stored in increasing path length
-							// order; once we go above the max path length, we can
-							// skip the rest
-							if (lightVertex.mPathLength + 1 +
-								cameraState.mPathLength > mMaxPathLength)
-								break;
-
-							// We store all light vertices in order to compute MIS weights but not all can be used for VC
-							if (!lightVertex.mConnectable)
-								continue;
-
-							// Don't try connect vertices in different media with real geometry
-							if (lightVertex.mBSDF.IsInMedium() && bsdf.IsInMedium() && lightVertex.mBSDF.GetMedium() != bsdf.GetMedium()
-								&& (lightVertex.mBehindSurf || behindSurf))
-								continue;
-
-							const Rgb mult = cameraState.mThroughput * lightVertex.mThroughput;
-							mDebugImages.ResetTemp();
-							color += mult * ConnectVertices(lightVertex, bsdf, hitPoint, cameraState);
-							const Rgb debugRgb = mult * mDebugImages.getTempRGB();
-							mDebugImages.addSample(cameraState.mPathLength + 1, lightVertex.mPathLength, DebugImages::BPT, screenSample, debugRgb, debugRgb * mDebugImages.getTempMisWeight(), mDebugImages.getTempMisWeight());
+								if (lightVertex.mPathLength + 1 +
+									cameraState.mPathLength < mMinPathLength)
+									continue;
+
+								// Light vertices are stored in increasing path length
+								// order; once we go above the max path length, we can
+								// skip the rest
+								if (lightVertex.mPathLength + 1 +
+									cameraState.mPathLength > mMaxPathLength)
+									break;
+
+								// We store all light vertices in order to compute MIS weights but not all can be used for VC
+								if (!lightVertex.mConnectable)
+									continue;
+
+								// Don't try connect vertices in different media with real geometry
+								if (lightVertex.mBSDF.IsInMedium() && bsdf.IsInMedium() && lightVertex.mBSDF.GetMedium() != bsdf.GetMedium()
+									&& (lightVertex.mBehindSurf || behindSurf))
+									continue;
+
+								QueueConnection(cameraState.mThroughput * lightVertex.mThroughput, lightVertex, bsdf, hitPoint, cameraState);
+							}
 						}
+
+						color += ResolveConnections<TTechniques, TDebugImages>(bsdf, hitPoint, cameraState, screenSample);
 					}
 
 					////////////////////////////////////////////////////////////////
 					// Vertex merging: surface photon mapping
-					if (mMergeWithLightVerticesSurf && bsdf.IsOnSurface() && !bsdf.IsDelta() && mLightVerticesOnSurfaceCount > 0 && !onlySpecSurf)
+					if (mergeWithLightVerticesSurf && bsdf.IsOnSurface() && !bsdf.IsDelta() && mLightVerticesOnSurfaceCount > 0 && !onlySpecSurf)
 					{
-						mDebugImages.ResetAccum();
-						RangeQuery query(*this, hitPoint, bsdf, cameraState, mDebugImages);
+						if (TDebugImages) mDebugImages.ResetAccum();
+						if (mQueryCullSurvivalProb > 0) mQueryVolume.RecordPoint(hitPoint);
+						RangeQuery<TTechniques, TDebugImages> query(*this, hitPoint, bsdf, cameraState, mDebugImages);
 						mSurfHashGrid.Process(mLightVertices, query);
 						const Rgb mult = cameraState.mThroughput * mSurfNormalization;
 						color += mult * query.GetContrib();
-						mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::SURFACE_PHOTON_MAPPING, screenSample, mult);
+						if (TDebugImages) mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::SURFACE_PHOTON_MAPPING, screenSample, mult);
 
 						// PPM merges only at the first non-specular surface from camera
-						if (mAlgorithm == kPPM) break;
+						if (!TTechniques && mAlgorithm == kPPM) break;
 					}
 
 					////////////////////////////////////////////////////////////////
 					// Vertex merging: point x point 3D
-					if (mMergeWithLightVerticesPP3D && bsdf.IsInMedium() && !bsdf.IsDelta() && mLightVerticesInMediumCount > 0)
+					if (mergeWithLightVerticesPP3D && bsdf.IsInMedium() && !bsdf.IsDelta() && mLightVerticesInMediumCount > 0 && (MediumTechniques(bsdf.GetMedium()) & PP3D))
 					{
-						mDebugImages.ResetAccum();
-						RangeQuery query(*this, hitPoint, bsdf, cameraState, mDebugImages);
+						if (TDebugImages) mDebugImages.ResetAccum();
+						if (mQueryCullSurvivalProb > 0) mQueryVolume.RecordPoint(hitPoint);
+						const bool tune = mEstimatorTuner.IsCollecting();
+						if (tune) mEstimatorTuner.StartQuery();
+						RangeQuery<TTechniques, TDebugImages> query(*this, hitPoint, bsdf, cameraState, mDebugImages);
 						mPP3DHashGrid.Process(mLightVertices, query);
 						const Rgb mult = cameraState.mThroughput * mPP3DNormalization;
+						if (tune) mEstimatorTuner.EndQuery(bsdf.GetMedium(), PP3D, mult * query.GetContrib());
 						color += mult * query.GetContrib();
-						mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::PP3D, screenSample, mult);
+						if (TDebugImages) mDebugImages.addAccumulatedLightSample(cameraState.mPathLength, DebugImages::PP3D, screenSample, mult);
 					}
 				}
 
@@ -1130,10 +1455,10 @@ public:
 				{
 					if (!cameraState.mLastSpecular)
 					{
-						if (onlySpecSurf || (mEstimatorTechniques & SPECULAR_ONLY))
+						if (onlySpecSurf || (techniques & SPECULAR_ONLY))
 							break;
 
-						if (mEstimatorTechniques & BB1D_PREVIOUS)
+						if (techniques & BB1D_PREVIOUS)
 							stopBB1D = true;
 					}
 
@@ -1141,41 +1466,60 @@ public:
 				}
 				else
 				{
-					if (mEstimatorTechniques & SPECULAR_ONLY)
+					if (techniques & SPECULAR_ONLY)
 						break;
 
 					if (onlySpecSurf)
 					{
-						if (mEstimatorTechniques & COMPATIBLE)
+						if (techniques & COMPATIBLE)
 							onlySpecSurf = false;
 						else
 							break;
 					}
 
-					if (mEstimatorTechniques & BB1D_PREVIOUS)
+					if (techniques & BB1D_PREVIOUS)
 						stopBB1D = true;
 
 					lastMedium = bsdf.GetMedium();
 				}
 			}
 
-			mFramebuffer.AddColor(screenSample, color);
+			ViewFramebuffer(mView).AddColor(screenSample, color * cameraPassWeight);
 		}
 
+		if (TDebugImages) mDebugImages.SetSampleScale(1.0f);
+
 		mTimer.Stop();
 		if (mVerbose)
 			std::cout << std::setprecision(3) << "   - camera sub-path tracing done in " << mTimer.GetLastElapsedTime() << " sec. " << std::endl;
 
 		mCameraTracingTime += mTimer.GetLastElapsedTime();
+		mIterationCameraTime += mTimer.GetLastElapsedTime();
+
+		if (aPhases & kViewPhase)
+			return;
+
+		// Queries of this camera pass steer culling in the next light pass
+		if (mQueryCullSurvivalProb > 0)
+			mQueryVolume.EndPass();
+
+		if (mEstimatorTuner.IsSetup())
+			mEstimatorTuner.EndIteration();
+
+		// Parameters of the next iteration of this renderer (the structures of this one are built already)
+		if (mIterationTuner.IsSetup())
+			mIterationTuner.Update(mLightPassTime, mIterationCameraTime, mBB1DCellOccupancy,
+				mPathCountPerIter, mBB1DPhotonBeams.mGridSize, mBB1DPhotonBeams.mMaxBeamsInCell);
+		mIterationCameraTime = 0;
 
 		// Delete stored photons
-		if (mMergeWithLightVerticesPB2D && mMaxPathLength > 1 && !mLightVertices.empty())
+		if (mergeWithLightVerticesPB2D && mMaxPathLength > 1 && !mLightVertices.empty())
 		{
 			mPB2DEmbreeBre.destroy();
 		}
 
 		// Delete stored photon beams
-		if (mMergeWithLightVerticesBB1D && mMaxPathLength > 1 && !mPhotonBeamsArray.empty())
+		if (mergeWithLightVerticesBB1D && mMaxPathLength > 1 && !mPhotonBeamsArray.empty())
 		{
 			mBB1DPhotonBeams.destroy();
 		}
@@ -1183,7 +1527,86 @@ public:
 		mIterations++;
 	}
 
-private:
+	// Runs the given build of an acceleration structure, as a concurrent task with mConcurrentBuilds
+	template<typename TBuild>
+	void RunBuild(
+		std::vector<std::future<void>> &aoBuilds,
+		const TBuild                   &aBuild)
+	{
+		if (mConcurrentBuilds)
+			aoBuilds.push_back(std::async(std::launch::async, aBuild));
+		else
+			aBuild();
+	}
+
+	// Sets beam selection PDFs of light vertices in media according to the built BB1D structure,
+	// with mConcurrentBuilds split among tasks over contiguous ranges of vertices
+	void SetBeamSelectionPdfs()
+	{
+		const int vertexCount = (int)mLightVertices.size();
+		const int taskCount = mConcurrentBuilds ? std::max(1, std::min((int)std::thread::hardware_concurrency(), vertexCount / 1024)) : 1;
+
+		std::vector<std::future<void>> tasks;
+		for (int t = 0; t < taskCount; ++t)
+		{
+			const int begin = int((long long)vertexCount * t / taskCount);
+			const int end = int((long long)vertexCount * (t + 1) / taskCount);
+
+			RunBuild(tasks, [this, begin, end]() {
+				for (int i = begin; i < end; ++i)
+				{
+					UPBPLightVertex &lightVertex = mLightVertices[i];
+					if (lightVertex.mBSDF.IsInMedium())
+						lightVertex.mMisData.mBB1DBeamSelectionPdf = mBB1DPhotonBeams.getBeamSelectionPdf(lightVertex.mHitpoint);
+				}
+			});
+		}
+
+		for (std::vector<std::future<void>>::iterator i = tasks.begin(); i != tasks.end(); ++i)
+			i->get();
+	}
+
+	// Reorders light vertices and photon beams (by midpoints) along the Morton curve, so that merging
+	// estimators access spatially close vertices and beams in close memory. Light paths are no longer
+	// contiguous, their vertices are reached in the path order through mPathVertexIndices.
+	void SortLightData()
+	{
+		std::vector<int> order;
+
+		if (!mLightVertices.empty())
+		{
+			MortonOrder::computeOrder(mLightVertices, LightVertexPosition(), order);
+
+			mPathVertexIndices.resize(order.size());
+			for (int i = 0; i < (int)order.size(); i++)
+				mPathVertexIndices[order[i]] = i;
+
+			// Beams refer to their origin vertices by storage index
+			for (PhotonBeamsArray::iterator i = mPhotonBeamsArray.begin(); i != mPhotonBeamsArray.end(); ++i)
+			{
+				UPBP_ASSERT(i->mLightVertexIdx >= 0 && i->mLightVertexIdx < (int)mLightVertices.size());
+				i->mLightVertexIdx = mPathVertexIndices[i->mLightVertexIdx];
+			}
+
+			MortonOrder::apply(mLightVertices, order);
+		}
+
+		if (!mPhotonBeamsArray.empty())
+		{
+			MortonOrder::computeOrder(mPhotonBeamsArray, PhotonBeamMidpoint(), order);
+			MortonOrder::apply(mPhotonBeamsArray, order);
+		}
+	}
+
+	struct LightVertexPosition
+	{
+		Pos operator()(const UPBPLightVertex &aVertex) const { return aVertex.mHitpoint; }
+	};
+
+	struct PhotonBeamMidpoint
+	{
+		Pos operator()(const PhotonBeam &aBeam) const { return aBeam.mRay.target(0.5f * aBeam.mLength); }
+	};
 
 	//////////////////////////////////////////////////////////////////////////
 	// Camera tracing methods
@@ -1194,7 +1617,7 @@ private:
 		const int    aPixelIndex,
 		SubPathState &oCameraState)
 	{
-		const Camera &camera = mScene.mCamera;
+		const Camera &camera = ViewCamera(mView);
 		const int resX = int(camera.mResolution.get(0));
 		const int resY = int(camera.mResolution.get(1));
 		
@@ -1222,6 +1645,7 @@ private:
 		oCameraState.mOrigin = primaryRay.origin;
 		oCameraState.mDirection = primaryRay.direction;
 		oCameraState.mThroughput = Rgb(1);
+		oCameraState.mRRReference = 1.0f;
 		oCameraState.mPathLength = 1;
 		oCameraState.mSpecularPath = 1;
 		oCameraState.mLastSpecular = true;
@@ -1236,6 +1660,7 @@ private:
 
 	// Returns the radiance of a light source when hit by a random ray,
 	// multiplied by MIS weight. Can be used for both Background and Area lights.
+	template<uint TTechniques, bool TDebugImages>
 	Rgb GetLightRadiance(
 		const AbstractLight *aLight,
 		const SubPathState  &aCameraState,
@@ -1257,14 +1682,15 @@ private:
 		// If we see light source directly from camera, no weighting is required
 		if (aCameraState.mPathLength == 1)
 		{
-			mDebugImages.setTempRgbWeight(radiance, 1.0f);
+			if (TDebugImages) mDebugImages.setTempRgbWeight(radiance, 1.0f);
 			return radiance;
 		}
 
 		// When using only vertex merging, we want purely specular paths
 		// to give radiance (cannot get it otherwise). Rest is handled
 		// by merging and we should return 0.
-		if (mEstimatorTechniques && !(mEstimatorTechniques & BPT))
+		const uint techniques = TTechniques ? TTechniques : mEstimatorTechniques;
+		if (techniques && !(techniques & BPT))
 			return aCameraState.mSpecularPath ? radiance : Rgb(0);
 
 		directPdfA *= lightPickProb;
@@ -1275,25 +1701,26 @@ private:
 
 		// MIS weight
 		float misWeight = 1.f;
-		if (mConnectToLightVertices)
+		if (TTechniques ? (TTechniques & BPT) != 0 : mConnectToLightVertices)
 		{
 			UPBP_ASSERT(directPdfA > 0);
-			const float wCamera = AccumulateCameraPathWeight2(aCameraState.mPathLength, directPdfA, 0, 0, 0, emissionPdfW / directPdfA);
+			const float wCamera = AccumulateCameraPathWeight2<TTechniques>(aCameraState.mPathLength, directPdfA, 0, 0, 0, emissionPdfW / directPdfA);
 			misWeight = 1.0f / (wCamera + 1.f);
 		}
-		else if (mAlgorithm == kPTmis && !aCameraState.mLastSpecular)
+		else if (!TTechniques && mAlgorithm == kPTmis && !aCameraState.mLastSpecular)
 		{
 			const float wCamera = directPdfA * mCameraVerticesMisData[aCameraState.mPathLength].mPdfAInv;
 			misWeight = 1.0f / (wCamera + 1.f);
 		}
 
-		mDebugImages.setTempRgbWeight(radiance,misWeight);
+		if (TDebugImages) mDebugImages.setTempRgbWeight(radiance,misWeight);
 		return misWeight * radiance;
 	}
 
 	// Connects camera vertex to randomly chosen light point.
 	// Returns emitted radiance multiplied by path MIS weight.
 	// Has to be called AFTER updating the MIS quantities.
+	template<uint TTechniques, bool TDebugImages>
 	Rgb DirectIllumination(
 		const SubPathState  &aCameraState,
 		const Pos           &aHitpoint,
@@ -1373,7 +1800,7 @@ private:
 
 			// MIS weight
 			float misWeight = 1.f;
-			if (mConnectToLightVertices)
+			if (TTechniques ? (TTechniques & BPT) != 0 : mConnectToLightVertices)
 			{
 				float lastSinTheta = 0;
 				float lastRaySampleRevPdfInv = 0;
@@ -1404,7 +1831,7 @@ private:
 				// Also note that both emissionPdfW and directPdfW should be
 				// multiplied by lightPickProb, so it cancels out.
 				UPBP_ASSERT(nextRaySampleRevPdf * emissionPdfW * cosToLight / (directPdfW * cosAtLight) > 0);
-				const float wCamera = AccumulateCameraPathWeight2(aCameraState.mPathLength, nextRaySampleRevPdf * emissionPdfW * cosToLight / (directPdfW * cosAtLight), lastSinTheta, lastRaySampleRevPdfInv, lastRaySampleRevPdfsRatio, bsdfRevPdfW);
+				const float wCamera = AccumulateCameraPathWeight2<TTechniques>(aCameraState.mPathLength, nextRaySampleRevPdf * emissionPdfW * cosToLight / (directPdfW * cosAtLight), lastSinTheta, lastRaySampleRevPdfInv, lastRaySampleRevPdfsRatio, bsdfRevPdfW);
 
 				// Note that wLight is a ratio of area PDFs. But since both are on the
 				// light source, their distance^2 and cosine terms cancel out.
@@ -1413,27 +1840,118 @@ private:
 				const float wLight = light->IsDelta() ? 0 : (nextRaySamplePdf * bsdfDirPdfW) / (directPdfW * lightPickProb);
 				misWeight = 1.0f / (wCamera + 1.f + wLight);
 			}
-			else if (mAlgorithm != kPTls && !light->IsDelta())
+			else if ((TTechniques || mAlgorithm != kPTls) && !light->IsDelta())
 				misWeight = Mis2(lightPickProb * directPdfW, bsdfDirPdfW * nextRaySamplePdf);
 
 			contrib = (cosToLight / (lightPickProb * directPdfW)) * (radiance * nextAttenuation * bsdfFactor);
-			mDebugImages.setTempRgbWeight(contrib, misWeight);
+			if (TDebugImages) mDebugImages.setTempRgbWeight(contrib, misWeight);
 			contrib *= misWeight;
 		}
 
 		if (contrib.isBlackOrNegative())
 		{
-			mDebugImages.ResetTemp();
+			if (TDebugImages) mDebugImages.ResetTemp();
 			return Rgb(0);
 		}
 
 		return contrib;
 	}
 
-	// Connects an eye and a light vertex. Result multiplied by MIS weight, but
-	// not multiplied by vertex throughputs. Has to be called AFTER updating MIS
-	// constants. 'direction' is FROM eye TO light vertex.
-	Rgb ConnectVertices(
+	// Queues connections of camera vertex to mLvcConnections vertices from the light vertex cache (connectable
+	// vertices of all light paths). Each one is selected by resampled importance sampling from mLvcCandidates
+	// uniformly chosen candidates with unoccluded contribution as the target function. Queued throughputs include
+	// the camera throughput and the normalization by the number of light paths, the MIS weights applied in
+	// ResolveConnections treat the selection as uniform (see mConnectionMisFactor).
+	void ConnectToLightVertexCache(
+		const BSDF         &aCameraBSDF,
+		const Pos          &aCameraHitpoint,
+		const SubPathState &aCameraState,
+		const bool         aBehindSurf)
+	{
+		const int cacheSize = (int)mLightVertexCache.size();
+		if (cacheSize == 0)
+			return;
+
+		for (int k = 0; k < mLvcConnections; k++)
+		{
+			// Select one candidate with probability proportional to its target function (streaming resampling)
+			int   selected       = -1;
+			float selectedTarget = 0;
+			float targetSum      = 0;
+			for (int j = 0; j < mLvcCandidates; j++)
+			{
+				const int candidate = std::min(int(mRng.GetFloat() * cacheSize), cacheSize - 1);
+				const float target = LightVertexCacheTarget(mLightVertices[mLightVertexCache[candidate]], aCameraBSDF, aCameraHitpoint, aCameraState, aBehindSurf);
+				if (target <= 0)
+					continue;
+
+				targetSum += target;
+				if (mRng.GetFloat() * targetSum < target)
+				{
+					selected       = candidate;
+					selectedTarget = target;
+				}
+			}
+
+			if (selected < 0)
+				continue;
+
+			// Resampling weight, candidates were chosen with PDF 1 / cacheSize; the cache contains vertices
+			// of all light paths while BPT connects to one of them
+			const float risWeight = targetSum * cacheSize / (selectedTarget * mLvcCandidates * mLvcConnections * mLightSubPathCount);
+
+			const UPBPLightVertex &lightVertex = mLightVertices[mLightVertexCache[selected]];
+			QueueConnection(aCameraState.mThroughput * lightVertex.mThroughput * risWeight, lightVertex, aCameraBSDF, aCameraHitpoint, aCameraState);
+		}
+	}
+
+	// Target function for selecting vertices from the light vertex cache: luminance of the connection
+	// contribution without visibility, media attenuation and MIS weight. Zero for vertices the connection
+	// loop over a light path would skip.
+	float LightVertexCacheTarget(
+		const UPBPLightVertex &aLightVertex,
+		const BSDF            &aCameraBSDF,
+		const Pos             &aCameraHitpoint,
+		const SubPathState    &aCameraState,
+		const bool            aBehindSurf) const
+	{
+		if (aLightVertex.mPathLength + 1 + aCameraState.mPathLength < mMinPathLength ||
+			aLightVertex.mPathLength + 1 + aCameraState.mPathLength > mMaxPathLength)
+			return 0;
+
+		// Don't try connect vertices in different media with real geometry
+		if (aLightVertex.mBSDF.IsInMedium() && aCameraBSDF.IsInMedium() && aLightVertex.mBSDF.GetMedium() != aCameraBSDF.GetMedium()
+			&& (aLightVertex.mBehindSurf || aBehindSurf))
+			return 0;
+
+		Dir direction     = aLightVertex.mHitpoint - aCameraHitpoint;
+		const float dist2 = direction.square();
+		if (dist2 <= 0)
+			return 0;
+		direction /= std::sqrt(dist2);
+
+		float cosCamera, cosLight;
+		const Rgb cameraBsdfFactor = aCameraBSDF.Evaluate(direction, cosCamera);
+		if (cameraBsdfFactor.isBlackOrNegative())
+			return 0;
+
+		const Rgb lightBsdfFactor = aLightVertex.mBSDF.Evaluate(-direction, cosLight);
+		if (lightBsdfFactor.isBlackOrNegative())
+			return 0;
+
+		const float geometryTerm = cosLight * cosCamera / dist2;
+		if (geometryTerm <= 0)
+			return 0;
+
+		return Luminance(aLightVertex.mThroughput * cameraBsdfFactor * lightBsdfFactor) * geometryTerm;
+	}
+
+	// Evaluates connection of an eye and a light vertex and adds it to the
+	// connection queue, its shadow ray is traced in ResolveConnections. Result
+	// multiplied by aThroughput. Has to be called AFTER updating MIS constants.
+	// 'direction' is FROM eye TO light vertex.
+	void QueueConnection(
+		const Rgb            &aThroughput,
 		const UPBPLightVertex &aLightVertex,
 		const BSDF           &aCameraBSDF,
 		const Pos            &aCameraHitpoint,
@@ -1452,7 +1970,7 @@ private:
 			&cameraBsdfRevPdfW, &sinThetaCamera);
 
 		if (cameraBsdfFactor.isBlackOrNegative())
-			return Rgb(0);
+			return;
 
 		// Camera continuation probability (for Russian roulette)
 		const float cameraCont = aCameraBSDF.ContinuationProb();
@@ -1468,7 +1986,7 @@ private:
 			&lightBsdfRevPdfW, &sinThetaLight);
 
 		if (lightBsdfFactor.isBlackOrNegative())
-			return Rgb(0);
+			return;
 
 		// Light continuation probability (for Russian roulette)
 		const float lightCont = aLightVertex.mBSDF.ContinuationProb();
@@ -1480,7 +1998,7 @@ private:
 		// Compute geometry term
 		const float geometryTerm = cosLight * cosCamera / dist2;
 		if (geometryTerm < 0)
-			return Rgb(0);
+			return;
 
 		// Convert PDFs to area PDF
 		const float cameraBsdfDirPdfA = PdfWtoA(cameraBsdfDirPdfW, distance, cosLight);
@@ -1492,87 +2010,133 @@ private:
 		if (aCameraBSDF.IsInMedium()) raySamplingFlags |= AbstractMedium::kOriginInMedium;
 		if (aLightVertex.mInMedium)   raySamplingFlags |= AbstractMedium::kEndInMedium;
 
-		// Test occlusion
-		mVolumeSegments.clear();
-		if (mScene.Occluded(aCameraHitpoint, direction, distance, aCameraState.mBoundaryStack, raySamplingFlags, mVolumeSegments))
-			return Rgb(0);
+		const Rgb contrib = geometryTerm * cameraBsdfFactor * lightBsdfFactor;
+		if (contrib.isBlackOrNegative())
+			return;
 
-		// Attenuate by intersected media (if any)
-		float raySamplePdf(1.0f);
-		float raySampleRevPdf(1.0f);
-		Rgb mediaAttenuation(1.0f);
-		if (!mVolumeSegments.empty())
+		PendingConnection &connection = mConnections.Push();
+		connection.mLightVertex       = &aLightVertex;
+		connection.mDirection         = direction;
+		connection.mDistance          = distance;
+		connection.mRaySamplingFlags  = raySamplingFlags;
+		connection.mCameraBsdfDirPdfA = cameraBsdfDirPdfA;
+		connection.mCameraBsdfRevPdfW = cameraBsdfRevPdfW;
+		connection.mSinThetaCamera    = sinThetaCamera;
+		connection.mLightBsdfDirPdfA  = lightBsdfDirPdfA;
+		connection.mLightBsdfRevPdfW  = lightBsdfRevPdfW;
+		connection.mSinThetaLight     = sinThetaLight;
+		connection.mUnoccluded        = aThroughput * contrib;
+	}
+
+	// Culls queued connections, traces shadow rays of the surviving ones one after another and
+	// returns the sum of their contributions multiplied by media attenuation and MIS weights.
+	// Clears the queue.
+	template<uint TTechniques, bool TDebugImages>
+	Rgb ResolveConnections(
+		const BSDF         &aCameraBSDF,
+		const Pos          &aCameraHitpoint,
+		const SubPathState &aCameraState,
+		const Vec2f        &aScreenSample)
+	{
+		Rgb result(0);
+		if (mConnections.IsEmpty())
+			return result;
+
+		mConnections.Cull(mRng, mShadowCullThreshold);
+		mConnections.CullOccluded(mScene, aCameraHitpoint, aCameraState.mBoundaryStack);
+
+		for (int i = 0; i < mConnections.Size(); i++)
 		{
-			// PDF
-			raySamplePdf = VolumeSegment::AccumulatePdf(mVolumeSegments);
-			UPBP_ASSERT(raySamplePdf > 0);
-
-			// Reverse PDF
-			raySampleRevPdf = VolumeSegment::AccumulateRevPdf(mVolumeSegments);
-			UPBP_ASSERT(raySampleRevPdf > 0);
-
-			// Attenuation (without PDF!)
-			mediaAttenuation = VolumeSegment::AccumulateAttenuationWithoutPdf(mVolumeSegments);
-			if (!mediaAttenuation.isPositive())
-				return Rgb(0);
-		}
+			const PendingConnection &connection = mConnections[i];
+			if (connection.mCullWeight == 0)
+				continue;
 
-		// MIS weight
+			const UPBPLightVertex &lightVertex = *connection.mLightVertex;
+			const Dir &direction = connection.mDirection;
+
+			// Test occlusion
+			mVolumeSegments.clear();
+			if (mScene.Occluded(aCameraHitpoint, direction, connection.mDistance, aCameraState.mBoundaryStack, connection.mRaySamplingFlags, mVolumeSegments))
+				continue;
+
+			// Attenuate by intersected media (if any)
+			float raySamplePdf(1.0f);
+			float raySampleRevPdf(1.0f);
+			Rgb mediaAttenuation(1.0f);
+			if (!mVolumeSegments.empty())
+			{
+				// PDF
+				raySamplePdf = VolumeSegment::AccumulatePdf(mVolumeSegments);
+				UPBP_ASSERT(raySamplePdf > 0);
+
+				// Reverse PDF
+				raySampleRevPdf = VolumeSegment::AccumulateRevPdf(mVolumeSegments);
+				UPBP_ASSERT(raySampleRevPdf > 0);
+
+				// Attenuation (without PDF!)
+				mediaAttenuation = VolumeSegment::AccumulateAttenuationWithoutPdf(mVolumeSegments);
+				if (!mediaAttenuation.isPositive())
+					continue;
+			}
+
+			// MIS weight
 		
-		// Camera part
-		float lastSinThetaCamera = 0;
-		float lastRaySampleRevPdfInvCamera = 0;
-		float lastRaySampleRevPdfsRatioCamera = 0;
-		if (aCameraBSDF.IsInMedium())
-		{
-			lastSinThetaCamera = sinThetaCamera;
-			lastRaySampleRevPdfInvCamera = 1.0f / raySampleRevPdf;
-			lastRaySampleRevPdfsRatioCamera = mCameraVerticesMisData[aCameraState.mPathLength].mRaySamplePdfsRatio;
-			if (!aCameraBSDF.GetMedium()->IsHomogeneous())
+			// Camera part
+			float lastSinThetaCamera = 0;
+			float lastRaySampleRevPdfInvCamera = 0;
+			float lastRaySampleRevPdfsRatioCamera = 0;
+			if (aCameraBSDF.IsInMedium())
 			{
-				float firstSegmentRayOverSampleRevPdf;
-				aCameraBSDF.GetMedium()->RaySamplePdf(Ray(aCameraState.mOrigin, aCameraState.mDirection), mVolumeSegments.front().mDistMin, mVolumeSegments.front().mDistMax, 0, &firstSegmentRayOverSampleRevPdf);
-				const float firstSegmentRayInSampleRevPdf = mVolumeSegments.front().mRaySampleRevPdf; // We are in medium -> we know we have insampled
-				lastRaySampleRevPdfsRatioCamera = firstSegmentRayOverSampleRevPdf / firstSegmentRayInSampleRevPdf;
+				lastSinThetaCamera = connection.mSinThetaCamera;
+				lastRaySampleRevPdfInvCamera = 1.0f / raySampleRevPdf;
+				lastRaySampleRevPdfsRatioCamera = mCameraVerticesMisData[aCameraState.mPathLength].mRaySamplePdfsRatio;
+				if (!aCameraBSDF.GetMedium()->IsHomogeneous())
+				{
+					float firstSegmentRayOverSampleRevPdf;
+					aCameraBSDF.GetMedium()->RaySamplePdf(Ray(aCameraState.mOrigin, aCameraState.mDirection), mVolumeSegments.front().mDistMin, mVolumeSegments.front().mDistMax, 0, &firstSegmentRayOverSampleRevPdf);
+					const float firstSegmentRayInSampleRevPdf = mVolumeSegments.front().mRaySampleRevPdf; // We are in medium -> we know we have insampled
+					lastRaySampleRevPdfsRatioCamera = firstSegmentRayOverSampleRevPdf / firstSegmentRayInSampleRevPdf;
+				}
 			}
-		}
-		UPBP_ASSERT(raySampleRevPdf * lightBsdfDirPdfA > 0);
-		const float wCamera = AccumulateCameraPathWeight2(aCameraState.mPathLength, raySampleRevPdf * lightBsdfDirPdfA, lastSinThetaCamera, lastRaySampleRevPdfInvCamera, lastRaySampleRevPdfsRatioCamera, cameraBsdfRevPdfW);
+			UPBP_ASSERT(raySampleRevPdf * connection.mLightBsdfDirPdfA > 0);
+			const float wCamera = AccumulateCameraPathWeight2<TTechniques>(aCameraState.mPathLength, raySampleRevPdf * connection.mLightBsdfDirPdfA, lastSinThetaCamera, lastRaySampleRevPdfInvCamera, lastRaySampleRevPdfsRatioCamera, connection.mCameraBsdfRevPdfW);
 		
-		// Light part
-		float lastSinThetaLight = 0;
-		float lastRaySampleRevPdfInvLight = 0;
-		float lastRaySampleRevPdfsRatioLight = 0;
-		if (aLightVertex.mInMedium)
-		{
-			lastSinThetaLight = sinThetaLight;
-			lastRaySampleRevPdfInvLight = 1.0f / raySamplePdf;
-			lastRaySampleRevPdfsRatioLight = aLightVertex.mMisData.mRaySamplePdfsRatio;
-			if (!aLightVertex.mBSDF.GetMedium()->IsHomogeneous())
+			// Light part
+			float lastSinThetaLight = 0;
+			float lastRaySampleRevPdfInvLight = 0;
+			float lastRaySampleRevPdfsRatioLight = 0;
+			if (lightVertex.mInMedium)
 			{
-				const float lastSegmentRayOverSamplePdf = aLightVertex.mBSDF.GetMedium()->RaySamplePdf(Ray(aCameraState.mOrigin, aCameraState.mDirection), mVolumeSegments.back().mDistMin, mVolumeSegments.back().mDistMax, 0);
-				const float lastSegmentRayInSamplePdf = mVolumeSegments.back().mRaySamplePdf; // We are in medium -> we know we have insampled
-				lastRaySampleRevPdfsRatioLight = lastSegmentRayOverSamplePdf / lastSegmentRayInSamplePdf;
+				lastSinThetaLight = connection.mSinThetaLight;
+				lastRaySampleRevPdfInvLight = 1.0f / raySamplePdf;
+				lastRaySampleRevPdfsRatioLight = lightVertex.mMisData.mRaySamplePdfsRatio;
+				if (!lightVertex.mBSDF.GetMedium()->IsHomogeneous())
+				{
+					const float lastSegmentRayOverSamplePdf = lightVertex.mBSDF.GetMedium()->RaySamplePdf(Ray(aCameraState.mOrigin, aCameraState.mDirection), mVolumeSegments.back().mDistMin, mVolumeSegments.back().mDistMax, 0);
+					const float lastSegmentRayInSamplePdf = mVolumeSegments.back().mRaySamplePdf; // We are in medium -> we know we have insampled
+					lastRaySampleRevPdfsRatioLight = lastSegmentRayOverSamplePdf / lastSegmentRayInSamplePdf;
+				}
 			}
-		}
-		UPBP_ASSERT(raySamplePdf * cameraBsdfDirPdfA > 0);
-		const float wLight = AccumulateLightPathWeight2(aLightVertex.mPathIdx, aLightVertex.mPathLength, raySamplePdf * cameraBsdfDirPdfA, lastSinThetaLight, lastRaySampleRevPdfInvLight, lastRaySampleRevPdfsRatioLight, lightBsdfRevPdfW, BPT, false);
-		const float misWeight = 1.f / (wCamera + 1.f + wLight);
+			UPBP_ASSERT(raySamplePdf * connection.mCameraBsdfDirPdfA > 0);
+			const float wLight = AccumulateLightPathWeight2<TTechniques>(lightVertex.mPathIdx, lightVertex.mPathLength, raySamplePdf * connection.mCameraBsdfDirPdfA, lastSinThetaLight, lastRaySampleRevPdfInvLight, lastRaySampleRevPdfsRatioLight, connection.mLightBsdfRevPdfW, BPT, false);
+			const float misWeight = mConnectionMisFactor / (wCamera + mConnectionMisFactor + wLight);
 
-		Rgb contrib = (geometryTerm) * cameraBsdfFactor * lightBsdfFactor * mediaAttenuation;
-		mDebugImages.setTempRgbWeight(contrib, misWeight);
-		contrib *= misWeight;
+			const Rgb contrib = connection.mCullWeight * connection.mUnoccluded * mediaAttenuation;
+			if (TDebugImages)
+				mDebugImages.addSample(aCameraState.mPathLength + 1, lightVertex.mPathLength, DebugImages::BPT, aScreenSample, contrib, contrib * misWeight, misWeight);
 
-		if (contrib.isBlackOrNegative())
-		{
-			mDebugImages.ResetTemp();
-			return Rgb(0);
+			if (contrib.isBlackOrNegative())
+				continue;
+
+			result += contrib * misWeight;
 		}
 
-		return contrib;
+		mConnections.Clear();
+		return result;
 	}
 
 	// Accumulates PDF ratios of all sampling techniques along path originally sampled from camera
+	template<uint TTechniques>
 	inline float AccumulateCameraPathWeight2(
 		const int   aPathLength, 
 		const float aLastRevPdfA,
@@ -1581,7 +2145,7 @@ private:
 		const float aLastRaySampleRevPdfsRatio,
 		const float aNextToLastPartialRevPdfW) const
 	{
-		return AccumulateCameraPathWeight(aPathLength, aLastRevPdfA, aLastSinTheta, aLastRaySampleRevPdfInv, aLastRaySampleRevPdfsRatio, aNextToLastPartialRevPdfW, mQueryBeamType, mPhotonBeamType, mEstimatorTechniques, mCameraVerticesMisData);
+		return AccumulateCameraPathWeight<TTechniques>(aPathLength, aLastRevPdfA, aLastSinTheta, aLastRaySampleRevPdfInv, aLastRaySampleRevPdfsRatio, aNextToLastPartialRevPdfW, mQueryBeamType, mPhotonBeamType, mEstimatorTechniques, mCameraVerticesMisData);
 	}
 
 	//////////////////////////////////////////////////////////////////////////
@@ -1623,6 +2187,7 @@ private:
 		lightVertex.mInMedium = false;
 		lightVertex.mConnectable = false;
 		lightVertex.mIsFinite = light->IsFinite();
+		lightVertex.mMergeWeight = 1.0f;
 
 		lightVertex.mMisData.mPdfAInv = 1.0f / directPdfA;
 		lightVertex.mMisData.mRevPdfA = light->IsDelta() ? 0.0f : (light->IsFinite() ? cosLight : 1.f);
@@ -1638,6 +2203,7 @@ private:
 		lightVertex.mMisData.mPB2DMisWeightFactor = 0.0f;
 		lightVertex.mMisData.mBB1DMisWeightFactor = 0.0f;
 		lightVertex.mMisData.mBB1DBeamSelectionPdf = 0.0f;
+		lightVertex.mMisData.mConnectionMisFactor = 1.0f;
 		lightVertex.mMisData.mIsDelta = light->IsDelta();
 		lightVertex.mMisData.mIsOnLightSource = true;
 		lightVertex.mMisData.mIsSpecular = false;
@@ -1649,6 +2215,7 @@ private:
 		// Complete light path state initialization
 
 		oLightState.mThroughput /= emissionPdfW;
+		oLightState.mRRReference = oLightState.mThroughput.max();
 		oLightState.mPathLength = 1;
 		oLightState.mIsFiniteLight = light->IsFinite() ? 1 : 0;
 		oLightState.mLastSpecular = false;
@@ -1659,9 +2226,11 @@ private:
 		if (light->mMatID != -1 && light->mMedID != -1) mScene.AddToBoundaryStack(light->mMatID, light->mMedID, oLightState.mBoundaryStack);
 	}
 
-	// Computes contribution of light sample to camera by splatting is onto the
+	// Computes contribution of light sample to camera of the given view by splatting is onto its
 	// framebuffer. Multiplies by throughput (obviously, as nothing is returned).
+	template<uint TTechniques, bool TDebugImages>
 	void ConnectToCamera(
+		const int          aView,
 		const int          aLightPathIdx,
 		const SubPathState &aLightState,
 		const Pos          &aHitpoint,
@@ -1669,7 +2238,7 @@ private:
 		const float        aRaySampleRevPdfsRatio)
 	{
 		// Get camera and direction to it
-		const Camera &camera = mScene.mCamera;
+		const Camera &camera = ViewCamera(aView);
 		Dir directionToCamera = camera.mOrigin - aHitpoint;
 
 		// Check point is in front of camera
@@ -1737,9 +2306,18 @@ private:
 					return;
 			}
 
+			// We divide the contribution by surfaceToImageFactor to convert the (already
+			// divided) PDF from surface area to image plane area, w.r.t. which the
+			// pixel integral is actually defined. We also divide by the number of samples
+			// this technique makes, which is equal to the number of light sub-paths
+			Rgb contrib = aLightState.mThroughput * bsdfFactor * mediaAttenuation / (mLightSubPathCount * surfaceToImageFactor);			
+
+			if (contrib.isBlackOrNegative())
+				return;
+
 			// Compute MIS weight if not doing LT
 			float misWeight = 1.f;
-			if (mAlgorithm != kLT)
+			if (TTechniques || mAlgorithm != kLT)
 			{
 				float lastSinTheta = 0;
 				float lastRaySampleRevPdfInv = 0;
@@ -1758,38 +2336,81 @@ private:
 					}
 				}
 				UPBP_ASSERT(raySampleRevPdf * cameraPdfA > 0);
-				const float wLight = AccumulateLightPathWeight2(aLightPathIdx, aLightState.mPathLength, raySampleRevPdf * cameraPdfA, lastSinTheta, lastRaySampleRevPdfInv, lastRaySampleRevPdfsRatio, bsdfRevPdfW, BPT, true) / mScreenPixelCount;
-				misWeight = 1.0f / (1.f + wLight);
-			}
 
-			// We divide the contribution by surfaceToImageFactor to convert the (already
-			// divided) PDF from surface area to image plane area, w.r.t. which the
-			// pixel integral is actually defined. We also divide by the number of samples
-			// this technique makes, which is equal to the number of light sub-paths
-			Rgb contrib = aLightState.mThroughput * bsdfFactor * mediaAttenuation / (mLightSubPathCount * surfaceToImageFactor);			
+				// The weight depends on the light vertex cache, wait until it is built
+				if (mDeferCameraConnections)
+				{
+					DeferredCameraConnection deferred;
+					deferred.mView                      = aView;
+					deferred.mImagePos                  = imagePos;
+					deferred.mContrib                   = contrib;
+					deferred.mLightPathIdx              = aLightPathIdx;
+					deferred.mPathLength                = aLightState.mPathLength;
+					deferred.mLastRevPdfA               = raySampleRevPdf * cameraPdfA;
+					deferred.mLastSinTheta              = lastSinTheta;
+					deferred.mLastRaySampleRevPdfInv    = lastRaySampleRevPdfInv;
+					deferred.mLastRaySampleRevPdfsRatio = lastRaySampleRevPdfsRatio;
+					deferred.mNextToLastPartialRevPdfW  = bsdfRevPdfW;
+					mDeferredCameraConnections.push_back(deferred);
+					return;
+				}
 
-			if (contrib.isBlackOrNegative())
-				return;
+				const float wLight = AccumulateLightPathWeight2<TTechniques>(aLightPathIdx, aLightState.mPathLength, raySampleRevPdf * cameraPdfA, lastSinTheta, lastRaySampleRevPdfInv, lastRaySampleRevPdfsRatio, bsdfRevPdfW, BPT, true) / mScreenPixelCount;
+				misWeight = 1.0f / (1.f + wLight);
+			}
 
-			mDebugImages.addSample(0, aLightState.mPathLength + 1, DebugImages::BPT, imagePos, contrib, contrib * misWeight, misWeight);
+			if (TDebugImages) mDebugImages.addSample(0, aLightState.mPathLength + 1, DebugImages::BPT, imagePos, contrib, contrib * misWeight, misWeight);
 
 			contrib *= misWeight;
 
-			mFramebuffer.AddColor(imagePos, contrib);
+			ViewFramebuffer(aView).AddColor(imagePos, contrib);
 		}
 	}
 
+	// Weight of a photon given by query culling, in regions not queried by the previous camera pass
+	// it is kept with probability mQueryCullSurvivalProb and weighted by its inverse (0 if culled)
+	float QueryCullingWeight(const Pos &aPoint)
+	{
+		if (mQueryCullSurvivalProb <= 0 || !mQueryVolume.HasHistory() || mQueryVolume.WasQueried(aPoint))
+			return 1.0f;
+
+		return QueryCullingRoulette();
+	}
+
+	// Weight of a beam given by query culling, see above
+	float QueryCullingWeight(const PhotonBeam &aBeam)
+	{
+		if (mQueryCullSurvivalProb <= 0 || !mQueryVolume.HasHistory() || mQueryVolume.WasQueried(aBeam.mRay, 0, aBeam.mLength))
+			return 1.0f;
+
+		return QueryCullingRoulette();
+	}
+
+	float QueryCullingRoulette()
+	{
+		return mRng.GetFloat() < mQueryCullSurvivalProb ? 1.0f / mQueryCullSurvivalProb : 0.0f;
+	}
+
+	// Records the media segments of the ray, along which PB2D and BB1D queries are evaluated
+	void RecordQuerySegments(const Ray &aRay)
+	{
+		for (VolumeSegments::const_iterator it = mVolumeSegments.cbegin(); it != mVolumeSegments.cend(); ++it)
+			mQueryVolume.RecordSegment(aRay, it->mDistMin, it->mDistMax);
+		for (LiteVolumeSegments::const_iterator it = mLiteVolumeSegments.cbegin(); it != mLiteVolumeSegments.cend(); ++it)
+			mQueryVolume.RecordSegment(aRay, it->mDistMin, it->mDistMax);
+	}
+
 	// Adds beams to beams array
 	void AddBeams(
 		const Ray &aRay,
 		const Rgb &aThroughput,
-		UPBPLightVertex *aLightVertex,
+		const int aLightVertexIdx,
 		const uint aRaySamplingFlags,
 		const float aLastPdfWInv
 		)
 	{
 		UPBP_ASSERT(aRaySamplingFlags == 0 || aRaySamplingFlags == AbstractMedium::kOriginInMedium);
-		UPBP_ASSERT(aLightVertex);
+		UPBP_ASSERT(aLightVertexIdx >= 0);
 		
 		Rgb throughput = aThroughput;
 		float raySamplePdf = 1.0f;
@@ -1802,7 +2423,7 @@ private:
 				UPBP_ASSERT(it->mMediumID >= 0);
 				PhotonBeam beam;
 				beam.mMedium = mScene.mMedia[it->mMediumID];
-				if (beam.mMedium->HasScattering() && (!mMergeWithLightVerticesPB2D || beam.mMedium->GetMeanFreePath(aRay.origin) > mBB1DMinMFP))
+				if (beam.mMedium->HasScattering() && MediumUsesBeams(beam.mMedium, aRay.origin, mMergeWithLightVerticesPB2D))
 				{
 					beam.mRay = Ray(aRay.origin + aRay.direction * it->mDistMin, aRay.direction);
 					beam.mLength = it->mDistMax - it->mDistMin;
@@ -1814,10 +2435,14 @@ private:
 						beam.mRaySamplingFlags |= aRaySamplingFlags;
 					beam.mLastPdfWInv = aLastPdfWInv;
 					beam.mThroughputAtOrigin = throughput;
-					beam.mLightVertex = aLightVertex;
+					beam.mLightVertexIdx = aLightVertexIdx;
 					
-					UPBP_ASSERT(mPhotonBeamsArray.size() < mPhotonBeamsArray.capacity());
-					mPhotonBeamsArray.push_back(beam);
+					const float mergeWeight = QueryCullingWeight(beam);
+					if (mergeWeight > 0)
+					{
+						beam.mThroughputAtOrigin *= mergeWeight;
+						mPhotonBeamsArray.push_back(beam);
+					}
 				}
 				throughput *= it->mAttenuation / it->mRaySamplePdf;
 				raySamplePdf *= it->mRaySamplePdf;
@@ -1832,7 +2457,7 @@ private:
 				UPBP_ASSERT(it->mMediumID >= 0);
 				PhotonBeam beam;
 				beam.mMedium = mScene.mMedia[it->mMediumID];
-				if (beam.mMedium->HasScattering() && (!mMergeWithLightVerticesPB2D || beam.mMedium->GetMeanFreePath(aRay.origin) > mBB1DMinMFP))
+				if (beam.mMedium->HasScattering() && MediumUsesBeams(beam.mMedium, aRay.origin, mMergeWithLightVerticesPB2D))
 				{
 					beam.mRay = Ray(aRay.origin + aRay.direction * it->mDistMin, aRay.direction);
 					beam.mLength = it->mDistMax - it->mDistMin;
@@ -1844,10 +2469,14 @@ private:
 						beam.mRaySamplingFlags |= aRaySamplingFlags;
 					beam.mLastPdfWInv = aLastPdfWInv;
 					beam.mThroughputAtOrigin = throughput;
-					beam.mLightVertex = aLightVertex;
+					beam.mLightVertexIdx = aLightVertexIdx;
 
-					UPBP_ASSERT(mPhotonBeamsArray.size() < mPhotonBeamsArray.capacity());
-					mPhotonBeamsArray.push_back(beam);
+					const float mergeWeight = QueryCullingWeight(beam);
+					if (mergeWeight > 0)
+					{
+						beam.mThroughputAtOrigin *= mergeWeight;
+						mPhotonBeamsArray.push_back(beam);
+					}
 				}
 				if (beam.mMedium->IsHomogeneous())
 				{
@@ -1870,6 +2499,7 @@ private:
 	}
 
 	// Accumulates PDF ratios of all sampling techniques along path originally sampled from light
+	template<uint TTechniques>
 	inline float AccumulateLightPathWeight2(
 		const int   aPathIndex,
 		const int   aPathLength,
@@ -1881,7 +2511,43 @@ private:
 		const uint  aCurrentlyEvaluatedTechnique,
 		const bool  aCameraConnection) const
 	{
-		return AccumulateLightPathWeight(aPathIndex, aPathLength, aLastRevPdfA, aLastSinTheta, aLastRaySampleRevPdfInv, aLastRaySampleRevPdfsRatio, aNextToLastPartialRevPdfW, aCurrentlyEvaluatedTechnique, mQueryBeamType, mPhotonBeamType, mEstimatorTechniques, aCameraConnection, &mPathEnds, &mLightVertices);
+		return AccumulateLightPathWeight<TTechniques>(aPathIndex, aPathLength, aLastRevPdfA, aLastSinTheta, aLastRaySampleRevPdfInv, aLastRaySampleRevPdfsRatio, aNextToLastPartialRevPdfW, aCurrentlyEvaluatedTechnique, mQueryBeamType, mPhotonBeamType, mEstimatorTechniques, aCameraConnection, &mPathEnds, &mLightVertices, NULL, PathVertexIndices());
+	}
+
+	// Storage indices of light vertices in the path order, NULL if they are stored in the path order
+	const std::vector<int>* PathVertexIndices() const
+	{
+		return mPathVertexIndices.empty() ? NULL : &mPathVertexIndices;
+	}
+
+	// Volumetric merging techniques (PP3D, PB2D, BB1D) enabled in the given medium
+	uint MediumTechniques(const AbstractMedium *aMedium) const
+	{
+		return mEstimatorTuner.IsSetup() ? mEstimatorTuner.MediumTechniques(aMedium) : (PP3D | PB2D | BB1D);
+	}
+
+	// Whether photon beams are stored in the given medium at the given position
+	bool MediumUsesBeams(const AbstractMedium *aMedium, const Pos &aPos, const bool aMergeWithLightVerticesPB2D) const
+	{
+		return (MediumTechniques(aMedium) & BB1D) && (!aMergeWithLightVerticesPB2D || aMedium->GetMeanFreePath(aPos) > mBB1DMinMFP);
+	}
+
+	// Tuner for a new BB1D or PB2D query with contributions scaled by the given factor, NULL if disabled
+	EstimatorTuner* ActiveEstimatorTuner(const float aScale)
+	{
+		if (!mEstimatorTuner.IsSetup())
+			return NULL;
+		mEstimatorTuner.SetScale(aScale);
+		return &mEstimatorTuner;
+	}
+
+	// Truncation of the traversal of a new BB1D or PB2D query, NULL if disabled
+	QueryTruncation* ActiveQueryTruncation()
+	{
+		if (mQueryTruncationThreshold <= 0)
+			return NULL;
+		mQueryTruncation.Setup(mQueryTruncationThreshold, mRng);
+		return &mQueryTruncation;
 	}
 
 	//////////////////////////////////////////////////////////////////////////
@@ -1948,10 +2614,14 @@ private:
 
 		const float bsdfDirPdfWInv = 1.0f / bsdfDirPdfW;
 
+		Rgb throughput = aoState.mThroughput * bsdfFactor * (cosThetaOut * bsdfDirPdfWInv);
+		if (!ThroughputRoulette(throughput, aoState.mRRReference, mRRThreshold, mRng))
+			return false;
+
 		// Update path state
 
 		aoState.mOrigin = aHitPoint;
-		aoState.mThroughput *= bsdfFactor * (cosThetaOut * bsdfDirPdfWInv);
+		aoState.mThroughput = throughput;
 		aoState.mSpecularPath &= specular ? 1 : 0;
 		aoState.mLastPdfWInv = bsdfDirPdfWInv;
 		aoState.mLastSpecular = specular;
@@ -2029,6 +2699,12 @@ private:
 	float mLightSubPathCount;        // Number of light sub-paths
 	float mRefPathCountPerIter;      // Reference number of paths per iteration
 	float mPathCountPerIter;         // Number of paths per iteration
+	int   mCameraPassCount;          // Number of camera passes per light pass
+	bool  mConcurrentBuilds;         // Whether independent per-iteration acceleration structures are built by concurrent tasks
+
+	float  mBB1DUsedLightSubPathFraction; // Fraction of light paths generating photon beams (0 if mBB1DUsedLightSubPathCount is absolute)
+	LightPathCounter  mOwnLightPathCounter; // Counter used when no shared one is given
+	LightPathCounter* mLightPathCounter;    // Light passes of all renderers (radius reduction with tuned counts)
 
 	size_t mLightVerticesOnSurfaceCount; // Number of light vertices located on surface
 	size_t mLightVerticesInMediumCount;  // Number of light vertices located in medium
@@ -2038,15 +2714,65 @@ private:
 	PhotonBeamsArray mPhotonBeamsArray;	                  // Stored photon beams
 
 	VolumeSegments mVolumeSegments;         // Path segments intersecting media (up to scattering point)
+	ConnectionQueue<PendingConnection> mConnections; // Connections of the current camera vertex
+	float mRRThreshold;         // Relative throughput below which throughput based Russian roulette starts (0 = disabled)
+	float mShadowCullThreshold; // Fraction of the largest connection of a vertex below which connections are culled by Russian roulette (0 = only zero ones)
 	LiteVolumeSegments mLiteVolumeSegments; // Lite path segments intersecting media (up to intersection with solid surface)
 
 	// For light path belonging to pixel index [x] it stores
 	// where it's light vertices end (begin is at [x-1])
 	std::vector<int> mPathEnds;	
 
+	// Storage indices of light vertices in the path order, empty if they are stored in the path order,
+	// positions given by mPathEnds index this array then
+	std::vector<int> mPathVertexIndices;
+	bool mSortLightData; // Whether light vertices and beams are reordered along the Morton curve before building structures over them
+
+	// Light vertex cache: storage indices of connectable light vertices of all light paths (mLvcConnections > 0)
+	std::vector<int> mLightVertexCache;
+	int   mLvcConnections;      // Number of connections of each camera vertex to the light vertex cache (0 = connect to one light path as BPT)
+	int   mLvcCandidates;       // Number of candidates for resampled selection of each connected cache vertex
+	float mConnectionMisFactor; // MIS factor of vertex connections relative to BPT in the current iteration
+
+	// Light tracing contributions of the current iteration waiting for the light vertex cache (mLvcConnections > 0)
+	std::vector<DeferredCameraConnection> mDeferredCameraConnections;
+	bool mDeferCameraConnections;
+
+	// Regions queried by merging in the last camera pass, used for query culling
+	QueryVolume mQueryVolume;
+	float mQueryCullSurvivalProb; // Probability of keeping photons and beams in regions not queried by the previous camera pass (0 = no culling)
+
+	// Roulette state of the BB1D or PB2D query being evaluated
+	QueryTruncation mQueryTruncation;
+	float mQueryTruncationThreshold; // Attenuation below which BB1D and PB2D query traversal continues by Russian roulette (0 = disabled)
+
+	// Selection of volumetric techniques per medium
+	EstimatorTuner mEstimatorTuner;
+	int mTunerIterations; // Number of iterations measuring volumetric techniques before selecting them per medium (0 = no selection)
+
+	// Feedback control of paths per iteration and BB1D grid parameters
+	IterationTuner mIterationTuner;
+	float  mTargetTimeRatio;     // Target ratio of light to camera pass times steering paths per iteration (0 = fixed)
+	float  mTargetCellOccupancy; // Target mean number of beams in non-empty grid cells steering grid resolution (0 = fixed)
+	float  mTunerMaxPathCount;   // Upper limit of tuned paths per iteration given by the memory budget (0 = tuner default)
+	uint   mTunerMaxGridSize;    // Upper limit of tuned grid resolution given by the memory budget (0 = tuner default)
+	Timer  mLightPassTimer;      // Measures light tracing and builds for mIterationTuner
+	double mLightPassTime;       // Duration of the last light pass
+	double mIterationCameraTime; // Duration of camera passes of all views of the current iteration
+	float  mBB1DCellOccupancy;   // Mean number of beams in non-empty cells of the last BB1D grid
+
+	// Reported memory of light vertices, photon beams and their indices
+	MemoryBudget::Tracker mLightDataMemory;
+
 	// Used algorithm
 	AlgorithmType mAlgorithm;
 
+	// Kernel run in each iteration (specialized one for common technique sets)
+	IterationKernel mIterationKernel;
+
+	// View of the current camera pass (0 is the main camera, others index Scene::mViews from 1)
+	int mView;
+
 	// Random number generator
 	Rng mRng;
 
@@ -32,6 +32,7 @@
 
 #include "..\Misc\HashGrid.hxx"
 #include "..\Path\Bsdf.hxx"
+#include "..\Path\ConnectionQueue.hxx"
 #include "Renderer.hxx"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -103,6 +104,17 @@ class VertexCM : public AbstractRenderer
 		}
     };
 
+	// Vertex connection deferred until its shadow ray is traced
+	struct PendingConnection
+	{
+		Dir   mDirection;        // From camera to light vertex
+		float mDistance;         // Distance between the vertices
+		uint  mRaySamplingFlags; // Flags for occlusion test (always 0, media are ignored)
+		Rgb   mUnoccluded;       // Contribution multiplied by vertex throughputs without MIS weight
+		float mMisWeight;        // MIS weight of the connection
+		float mCullWeight;       // Set by ConnectionQueue::Cull
+	};
+
     // Range query used for PPM, BPT, and VCM. When HashGrid finds a vertex
     // within range -- Process() is called and vertex
     // merging is performed. BSDF of the camera vertex is used.
@@ -210,9 +222,15 @@ public:
         AlgorithmType aAlgorithm,
         const float   aRadiusFactor,
         const float   aRadiusAlpha,
+        const float   aRefPathCountPerIter,
+        const float   aPathCountPerIter,
+        const float   aShadowCullThreshold,
         int           aSeed = 1234
     ) :
         AbstractRenderer(aScene),
+        mRefPathCountPerIter(aRefPathCountPerIter),
+        mPathCountPerIter(aPathCountPerIter),
+        mShadowCullThreshold(aShadowCullThreshold),
         mRng(aSeed),
         mLightTraceOnly(false),
         mUseVC(false),
@@ -283,17 +301,20 @@ public:
 
     virtual void RunIteration(int aIteration)
     {
-        // While we have the same number of pixels (camera paths)
-        // and light paths, we do keep them separate for clarity reasons
+        // Number of light paths is independent of the number of pixels (camera paths)
         const int resX = int(mScene.mCamera.mResolution.get(0));
         const int resY = int(mScene.mCamera.mResolution.get(1));
-        const int pathCount = resX * resY;
-        mScreenPixelCount = float(resX * resY);
-        mLightSubPathCount   = float(resX * resY);
-
-        // Setup our radius, 1st iteration has aIteration == 0, thus offset
+        const int pathCountC = resX * resY;
+        const int pathCountL = int(mPathCountPerIter);
+        mScreenPixelCount = float(pathCountC);
+        mLightSubPathCount   = mPathCountPerIter;
+
+        // Setup our radius, 1st iteration has aIteration == 0, thus offset.
+        // Iterations are counted in multiples of the reference path count,
+        // so the radius reduction does not depend on the path count per iteration
+        const float effectiveIteration = 1 + aIteration * mLightSubPathCount / mRefPathCountPerIter;
         float radius = mBaseRadius;
-        radius /= std::pow(float(aIteration + 1), 0.5f * (1 - mRadiusAlpha));
+        radius /= std::pow(effectiveIteration, 0.5f * (1 - mRadiusAlpha));
         // Purely for numeric stability
         radius = std::max(radius, 1e-7f);
         const float radiusSqr = Utils::sqr(radius);
@@ -308,17 +329,17 @@ public:
         mMisVcWeightFactor = mUseVC ? Mis(1.f / etaVCM) : 0.f;
 
         // Clear path ends, nothing ends anywhere
-        mPathEnds.resize(pathCount);
+        mPathEnds.resize(pathCountL);
         memset(&mPathEnds[0], 0, mPathEnds.size() * sizeof(int));
 
         // Remove all light vertices and reserve space for some
-        mLightVertices.reserve(pathCount);
+        mLightVertices.reserve(pathCountL);
         mLightVertices.clear();
 
         //////////////////////////////////////////////////////////////////////////
         // Generate light paths
         //////////////////////////////////////////////////////////////////////////
-		for(int pathIdx = 0; (pathIdx < pathCount) &&  mScene.GetLightCount() > 0 && mMaxPathLength > 1; pathIdx++)
+		for(int pathIdx = 0; (pathIdx < pathCountL) &&  mScene.GetLightCount() > 0 && mMaxPathLength > 1; pathIdx++)
         {			
 			SubPathState lightState;
             GenerateLightSample(lightState);
@@ -398,7 +419,7 @@ public:
         if(mUseVM)
         {
             // The number of cells is somewhat arbitrary, but seems to work ok
-            mHashGrid.Reserve(pathCount);
+            mHashGrid.Reserve(pathCountL);
             mHashGrid.Build(mLightVertices, radius);
         }
 
@@ -407,8 +428,11 @@ public:
         //////////////////////////////////////////////////////////////////////////
 
         // Unless rendering with traditional light tracing
-        for(int pathIdx = 0; (pathIdx < pathCount) && (!mLightTraceOnly); ++pathIdx)
+        // Camera paths are traced only through pixels of the crop rectangles, pathIdx is the pixel index
+        const int cropPixelCount = mScene.mCamera.GetCropPixelCount();
+        for(int cropIdx = 0; (cropIdx < cropPixelCount) && (!mLightTraceOnly); ++cropIdx)
         {			
+            const int pathIdx = mScene.mCamera.GetCropPixelIndex(cropIdx);
 			SubPathState cameraState;
             const Vec2f screenSample = GenerateCameraSample(pathIdx, cameraState);
             Rgb color(0);
@@ -489,10 +513,12 @@ public:
                     // For VC, each light sub-path is assigned to a particular eye
                     // sub-path, as in traditional BPT. It is also possible to
                     // connect to vertices from any light path, but MIS should
-                    // be revisited.
+                    // be revisited. When the path counts differ, the light
+                    // sub-path is picked randomly.
+                    const int lightPathIdx = (pathCountL == pathCountC) ? pathIdx : int(mRng.GetUint() % pathCountL);
                     const Vec2i range(
-                        (pathIdx == 0) ? 0 : mPathEnds[pathIdx-1],
-                        mPathEnds[pathIdx]);
+                        (lightPathIdx == 0) ? 0 : mPathEnds[lightPathIdx-1],
+                        mPathEnds[lightPathIdx]);
 
                     for(int i = range[0]; i < range[1]; i++)
                     {
@@ -509,9 +535,11 @@ public:
                            cameraState.mPathLength > mMaxPathLength)
                             break;
 
-                        color += cameraState.mThroughput * lightVertex.mThroughput *
-                            ConnectVertices(lightVertex, bsdf, hitPoint, cameraState);
+                        QueueConnection(cameraState.mThroughput * lightVertex.mThroughput,
+                            lightVertex, bsdf, hitPoint, cameraState);
                     }
+
+                    color += ResolveConnections(hitPoint, cameraState);
                 }
 
                 ////////////////////////////////////////////////////////////////
@@ -728,14 +756,16 @@ private:
         return contrib;
     }
 
-    // Connects an eye and a light vertex. Result multiplied by MIS weight, but
-    // not multiplied by vertex throughputs. Has to be called AFTER updating MIS
-    // constants. 'direction' is FROM eye TO light vertex.
-    Rgb ConnectVertices(
+    // Evaluates connection of an eye and a light vertex and adds it to the
+    // connection queue, its shadow ray is traced in ResolveConnections. Result
+    // multiplied by MIS weight and aThroughput. Has to be called AFTER updating
+    // MIS constants. 'direction' is FROM eye TO light vertex.
+    void QueueConnection(
+        const Rgb          &aThroughput,
         const PathVertex   &aLightVertex,
         const BSDF         &aCameraBSDF,
         const Pos          &aCameraHitpoint,
-        const SubPathState &aCameraState) const
+        const SubPathState &aCameraState)
     {
         // Get the connection
         Dir direction     = aLightVertex.mHitpoint - aCameraHitpoint;
@@ -750,7 +780,7 @@ private:
             &cameraBsdfRevPdfW);
 
         if(cameraBsdfFactor.isBlackOrNegative())
-            return Rgb(0);
+            return;
 
         // Camera continuation probability (for Russian roulette)
         const float cameraCont = aCameraBSDF.ContinuationProb();
@@ -764,7 +794,7 @@ private:
             &lightBsdfRevPdfW);
 
         if(lightBsdfFactor.isBlackOrNegative())
-            return Rgb(0);
+            return;
 
         // Light continuation probability (for Russian roulette)
         const float lightCont = aLightVertex.mBSDF.ContinuationProb();
@@ -774,7 +804,7 @@ private:
         // Compute geometry term
         const float geometryTerm = cosLight * cosCamera / dist2;
         if(geometryTerm < 0)
-            return Rgb(0);
+            return;
 
         // Convert PDFs to area PDF
         const float cameraBsdfDirPdfA = PdfWtoA(cameraBsdfDirPdfW, distance, cosLight);
@@ -791,12 +821,44 @@ private:
         // Full path MIS weight [tech. rep. (37)]
         const float misWeight = 1.f / (wLight + 1.f + wCamera);
 
-        const Rgb contrib = (misWeight * geometryTerm) * cameraBsdfFactor * lightBsdfFactor;
+        const Rgb contrib = geometryTerm * cameraBsdfFactor * lightBsdfFactor;
 
-        if(contrib.isBlackOrNegative() || mScene.Occluded(aCameraHitpoint, direction, distance, aCameraState.mBoundaryStack))
-            return Rgb(0);
+        if(contrib.isBlackOrNegative() || misWeight <= 0)
+            return;
 
-        return contrib;
+        PendingConnection &connection = mConnections.Push();
+        connection.mDirection        = direction;
+        connection.mDistance         = distance;
+        connection.mRaySamplingFlags = 0;
+        connection.mUnoccluded       = aThroughput * contrib;
+        connection.mMisWeight        = misWeight;
+    }
+
+    // Culls queued connections, traces shadow rays of the surviving ones in
+    // packets and returns the sum of their contributions. Clears the queue.
+    Rgb ResolveConnections(
+        const Pos          &aCameraHitpoint,
+        const SubPathState &aCameraState)
+    {
+        Rgb result(0);
+        if(mConnections.IsEmpty())
+            return result;
+
+        mConnections.Cull(mRng, mShadowCullThreshold);
+        mConnections.CullOccluded(mScene, aCameraHitpoint, aCameraState.mBoundaryStack);
+
+        for(int i = 0; i < mConnections.Size(); i++)
+        {
+            const PendingConnection &connection = mConnections[i];
+            if(connection.mCullWeight == 0)
+                continue;
+
+            if(!mScene.Occluded(aCameraHitpoint, connection.mDirection, connection.mDistance, aCameraState.mBoundaryStack))
+                result += connection.mUnoccluded * (connection.mMisWeight * connection.mCullWeight);
+        }
+
+        mConnections.Clear();
+        return result;
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -1013,6 +1075,8 @@ private:
     float mMisVcWeightFactor; // Weight of vertex connection (used in VM)
     float mScreenPixelCount;  // Number of pixels
     float mLightSubPathCount; // Number of light sub-paths
+    float mRefPathCountPerIter; // Reference number of paths per iteration
+    float mPathCountPerIter;    // Number of paths per iteration
     float mVmNormalization;   // 1 / (Pi * radius^2 * light_path_count)
 
     std::vector<PathVertex> mLightVertices; //!< Stored light vertices
@@ -1022,6 +1086,9 @@ private:
     std::vector<int> mPathEnds;
     HashGrid         mHashGrid;
 
+    ConnectionQueue<PendingConnection> mConnections; // Connections of the current camera vertex
+    float            mShadowCullThreshold; // Fraction of the largest connection of a vertex below which connections are culled by Russian roulette (0 = only zero ones)
+
     Rng              mRng;
 };
 
@@ -31,6 +31,7 @@
 #include <cmath>
 
 #include "..\Path\Bsdf.hxx"
+#include "..\Path\ConnectionQueue.hxx"
 #include "Renderer.hxx"
 
 class VolBidirPT : public AbstractRenderer
@@ -55,6 +56,7 @@ class VolBidirPT : public AbstractRenderer
         uint  mIsFiniteLight :  1; // Just generated by finite light
 		bool  mLastSpecular;       // Last sampled event was specular
 		float mLastPdfWInv;        // PDF of the last sampled direction
+		float mRRReference;        // Throughput at the subpath origin (reference for Russian roulette)
 
 		BoundaryStack mBoundaryStack; // Stack of crossed boundaries		
     };
@@ -72,6 +74,41 @@ class VolBidirPT : public AbstractRenderer
 		MisData mMisData;  // Data needed for MIS weights computation
     };
 
+	// Vertex connection deferred until its shadow ray is traced, media attenuation and MIS weight
+	// depend on the traced volume segments and are evaluated afterwards
+	struct PendingConnection
+	{
+		int              mPathIdx;           // Index of the light path of the light vertex
+		const PathVertex *mLightVertex;      // Connected light vertex
+		Dir              mDirection;         // From camera to light vertex
+		float            mDistance;          // Distance between the vertices
+		uint             mRaySamplingFlags;  // Flags for occlusion test
+		float            mCameraBsdfDirPdfA; // Area PDF of sampling the light vertex from the camera vertex
+		float            mCameraBsdfRevPdfW; // Reverse solid angle PDF of the camera BSDF
+		float            mLightBsdfDirPdfA;  // Area PDF of sampling the camera vertex from the light vertex
+		float            mLightBsdfRevPdfW;  // Reverse solid angle PDF of the light BSDF
+		Rgb              mUnoccluded;        // Contribution without attenuation and MIS weight
+		float            mCullWeight;        // Set by ConnectionQueue::Cull
+	};
+
+	// Connectable vertex in the light vertex cache
+	struct CachedVertex
+	{
+		int mVertexIdx; // Index of the vertex in mLightVertices
+		int mPathIdx;   // Index of the light path the vertex belongs to
+	};
+
+	// Light tracing contribution waiting for its MIS weight until the light vertex cache is built
+	struct DeferredCameraConnection
+	{
+		Vec2f mImagePos;                 // Raster position of the splat
+		Rgb   mContrib;                  // Contribution without the MIS weight
+		int   mLightPathIdx;             // Index of the light path
+		int   mPathLength;               // Length of the light path up to the connected vertex
+		float mLastRevPdfA;              // Reverse PDF of the connected vertex
+		float mNextToLastPartialRevPdfW; // Reverse BSDF PDF at the connected vertex
+	};
+
 public:
 
 	enum AlgorithmType
@@ -86,10 +123,22 @@ public:
     VolBidirPT(
         const Scene&  aScene,
 		AlgorithmType aAlgorithm,
+		const float   aPathCountPerIter,
+		const float   aRRThreshold,
+		const int     aLvcConnections,
+		const int     aLvcCandidates,
+		const float   aShadowCullThreshold,
         int           aSeed = 1234
     ) :
         AbstractRenderer(aScene),
 		mAlgorithm(aAlgorithm),
+		mPathCountPerIter(aPathCountPerIter),
+		mRRThreshold(aRRThreshold),
+		mLvcConnections(aLvcConnections),
+		mLvcCandidates(aLvcCandidates),
+		mShadowCullThreshold(aShadowCullThreshold),
+		mConnectionMisFactor(1.0f),
+		mDeferCameraConnections(false),
         mRng(aSeed)
 	{
 		// Because of static mCameraVerticesMisData size
@@ -98,22 +147,27 @@ public:
 
     virtual void RunIteration(int aIteration)
     {
-		// Get path count, one path for each pixel
+		// Get path counts, one camera path for each pixel, number of light paths is independent of it
         const int resX = int(mScene.mCamera.mResolution.get(0));
         const int resY = int(mScene.mCamera.mResolution.get(1));
-        const int pathCount = resX * resY;
+        const int pathCountC = resX * resY;
+        const int pathCountL = int(mPathCountPerIter);
+
+        mScreenPixelCount  = float(pathCountC);
+        mLightSubPathCount = mPathCountPerIter;
 
-		// While we have the same number of pixels (camera paths)
-        // and light paths, we do keep them separate for clarity reasons
-        mScreenPixelCount  = float(pathCount);
-        mLightSubPathCount = float(pathCount);
+		// MIS weights of connections to the light vertex cache depend on the cache size, so light tracing
+		// contributions wait for their weights until all light paths of this iteration are traced
+		mConnectionMisFactor = 1.0f;
+		mDeferCameraConnections = mAlgorithm == kBPT && mLvcConnections > 0;
+		mDeferredCameraConnections.clear();
 
         // Clear path ends, nothing ends anywhere
-        mPathEnds.resize(pathCount);
+        mPathEnds.resize(pathCountL);
         memset(&mPathEnds[0], 0, mPathEnds.size() * sizeof(int));
 
         // Remove all light vertices and reserve space for some		
-		mLightVertices.reserve(pathCount * mMaxPathLength);
+		mLightVertices.reserve(pathCountL * mMaxPathLength);
         mLightVertices.clear();
 
         //////////////////////////////////////////////////////////////////////////
@@ -122,7 +176,7 @@ public:
 		
 		// If there are no lights, only one path segment is allowed or pure path tracing is used, light tracing step is skipped
 		if (mScene.GetLightCount() > 0 && mMaxPathLength > 1 && (mAlgorithm == kLT || mAlgorithm == kBPT))
-			for (int pathIdx = 0; pathIdx < pathCount; pathIdx++)
+			for (int pathIdx = 0; pathIdx < pathCountL; pathIdx++)
         {			
 			// Generate light path origin and direction
 			SubPathState lightState;
@@ -225,14 +279,48 @@ public:
             mPathEnds[pathIdx] = (int)mLightVertices.size();
         }
 
+		// Collect connectable vertices of all light paths into the light vertex cache
+		mLightVertexCache.clear();
+		if (mAlgorithm == kBPT && mLvcConnections > 0)
+		{
+			for (int pathIdx = 0, vertexIdx = 0; pathIdx < (int)mPathEnds.size(); pathIdx++)
+			{
+				for (; vertexIdx < mPathEnds[pathIdx]; vertexIdx++)
+				{
+					if (!mLightVertices[vertexIdx].mConnectable)
+						continue;
+
+					CachedVertex cached;
+					cached.mVertexIdx = vertexIdx;
+					cached.mPathIdx   = pathIdx;
+					mLightVertexCache.push_back(cached);
+				}
+			}
+
+			// MIS weights treat the selection as uniform. BPT connects each camera vertex to every vertex
+			// of one light path, the cache mode to mLvcConnections of all cached vertices
+			if (!mLightVertexCache.empty())
+				mConnectionMisFactor = mLvcConnections * mLightSubPathCount / mLightVertexCache.size();
+		}
+
+		// Light tracing contributions can be weighted now
+		for (std::vector<DeferredCameraConnection>::const_iterator it = mDeferredCameraConnections.cbegin(); it != mDeferredCameraConnections.cend(); ++it)
+		{
+			const float wLight = AccumulateLightPathWeight(it->mLightPathIdx, it->mPathLength, 1, it->mLastRevPdfA, it->mNextToLastPartialRevPdfW) / mLightSubPathCount;
+			mFramebuffer.AddColor(it->mImagePos, it->mContrib / (1.f + wLight));
+		}
+
         //////////////////////////////////////////////////////////////////////////
         // Generate camera paths
         //////////////////////////////////////////////////////////////////////////
 
         // Unless rendering with traditional light tracing
 		if (mAlgorithm != kLT)
-			for (int pathIdx = 0; pathIdx < pathCount; ++pathIdx)
+			for (int cropIdx = 0; cropIdx < mScene.mCamera.GetCropPixelCount(); ++cropIdx)
         {
+			// Camera paths are traced only through pixels of the crop rectangles, pathIdx is the pixel index
+			const int pathIdx = mScene.mCamera.GetCropPixelIndex(cropIdx);
+
 			// Generate camera path origin and direction			
 			SubPathState cameraState;
             const Vec2f screenSample = GenerateCameraSample(pathIdx, cameraState);
@@ -387,15 +475,21 @@ public:
 
                 ////////////////////////////////////////////////////////////////
                 // Vertex connection: Connect to light vertices
-				if (mAlgorithm == kBPT && !bsdf.IsDelta())
+				if (mAlgorithm == kBPT && !bsdf.IsDelta() && mLvcConnections > 0)
+				{
+					// Connect to vertices from any light path selected from the light vertex cache
+					color += cameraState.mThroughput * ConnectToLightVertexCache(bsdf, hitPoint, cameraState);
+				}
+				else if (mAlgorithm == kBPT && !bsdf.IsDelta())
                 {
                     // For VC, each light sub-path is assigned to a particular eye
-                    // sub-path, as in traditional BPT. It is also possible to
-                    // connect to vertices from any light path, but MIS should
-                    // be revisited.
+                    // sub-path, as in traditional BPT. Connections to vertices
+                    // from any light path are done by the light vertex cache above.
+                    // When the path counts differ, the light sub-path is picked randomly.
+                    const int lightPathIdx = (pathCountL == pathCountC) ? pathIdx : int(mRng.GetUint() % pathCountL);
                     const Vec2i range(
-                        (pathIdx == 0) ? 0 : mPathEnds[pathIdx-1],
-                        mPathEnds[pathIdx]);
+                        (lightPathIdx == 0) ? 0 : mPathEnds[lightPathIdx-1],
+                        mPathEnds[lightPathIdx]);
 
                     for (int i = range[0]; i < range[1]; i++)
                     {
@@ -416,8 +510,10 @@ public:
 						if (!lightVertex.mConnectable)
 							continue;
 
-						color += cameraState.mThroughput * lightVertex.mThroughput * ConnectVertices(pathIdx, lightVertex, bsdf, hitPoint, cameraState);
+						QueueConnection(cameraState.mThroughput * lightVertex.mThroughput, lightPathIdx, lightVertex, bsdf, hitPoint, cameraState);
                     }
+
+					color += ResolveConnections(hitPoint, cameraState);
                 }
 
 				// Continue random walk
@@ -470,6 +566,7 @@ private:
         oCameraState.mOrigin       = primaryRay.origin;
         oCameraState.mDirection    = primaryRay.direction;
         oCameraState.mThroughput   = Rgb(1);		
+        oCameraState.mRRReference  = 1.0f;
         oCameraState.mPathLength   = 1;
 		oCameraState.mLastSpecular = true;
 		oCameraState.mLastPdfWInv  = mLightSubPathCount / cameraPdfW;
@@ -514,7 +611,7 @@ private:
 		if (mAlgorithm == kBPT)
 		{
 			UPBP_ASSERT(directPdfA > 0);
-			const float wCamera = AccumulateCameraPathWeight(aCameraState.mPathLength, directPdfA, emissionPdfW / directPdfA);
+			const float wCamera = AccumulateCameraPathWeight(aCameraState.mPathLength, 0, directPdfA, emissionPdfW / directPdfA);
 			misWeight = 1.0f / (wCamera + 1.f);
 		}
 		else if (mAlgorithm == kPTmis && !aCameraState.mLastSpecular)
@@ -622,7 +719,7 @@ private:
 				// Also note that both emissionPdfW and directPdfW should be
 				// multiplied by lightPickProb, so it cancels out.
 				UPBP_ASSERT(nextRaySampleRevPdf * emissionPdfW * cosToLight / (directPdfW * cosAtLight) > 0);
-				const float wCamera = AccumulateCameraPathWeight(aCameraState.mPathLength, nextRaySampleRevPdf * emissionPdfW * cosToLight / (directPdfW * cosAtLight), bsdfRevPdfW);
+				const float wCamera = AccumulateCameraPathWeight(aCameraState.mPathLength, 1, nextRaySampleRevPdf * emissionPdfW * cosToLight / (directPdfW * cosAtLight), bsdfRevPdfW);
 				
 				// Note that wLight is a ratio of area PDFs. But since both are on the
 				// light source, their distance^2 and cosine terms cancel out.
@@ -643,10 +740,12 @@ private:
 		return contrib;
     }
 
-    // Connects an eye and a light vertex. Result multiplied by MIS weight, but
-    // not multiplied by vertex throughputs. Has to be called AFTER updating MIS
-    // constants. 'direction' is FROM eye TO light vertex.
-    Rgb ConnectVertices(
+    // Evaluates connection of an eye and a light vertex and adds it to the
+    // connection queue, its shadow ray is traced in ResolveConnections. Result
+    // multiplied by aThroughput. Has to be called AFTER updating MIS constants.
+    // 'direction' is FROM eye TO light vertex.
+    void QueueConnection(
+		const Rgb          &aThroughput,
         const int          aPathIdx,
 		const PathVertex   &aLightVertex,
         const BSDF         &aCameraBSDF,
@@ -666,7 +765,7 @@ private:
             &cameraBsdfRevPdfW);
 
         if(cameraBsdfFactor.isBlackOrNegative())
-            return Rgb(0);
+            return;
 
         // Camera continuation probability (for Russian roulette)
         const float cameraCont = aCameraBSDF.ContinuationProb();
@@ -682,7 +781,7 @@ private:
             &lightBsdfRevPdfW);
 
         if(lightBsdfFactor.isBlackOrNegative())
-            return Rgb(0);
+            return;
 
         // Light continuation probability (for Russian roulette)
         const float lightCont = aLightVertex.mBSDF.ContinuationProb();
@@ -694,7 +793,7 @@ private:
         // Compute geometry term
         const float geometryTerm = cosLight * cosCamera / dist2;
         if(geometryTerm < 0)
-            return Rgb(0);
+            return;
 
         // Convert PDFs to area PDF
         const float cameraBsdfDirPdfA = PdfWtoA(cameraBsdfDirPdfW, distance, cosLight);
@@ -706,53 +805,190 @@ private:
 		if (aCameraBSDF.IsInMedium()) raySamplingFlags |= AbstractMedium::kOriginInMedium;
 		if (aLightVertex.mInMedium)   raySamplingFlags |= AbstractMedium::kEndInMedium;
 
-		// Test occlusion
-		mVolumeSegments.clear();
-		if (mScene.Occluded(aCameraHitpoint, direction, distance, aCameraState.mBoundaryStack, raySamplingFlags, mVolumeSegments))									  
-            return Rgb(0);
+		const Rgb contrib = geometryTerm * cameraBsdfFactor * lightBsdfFactor;
+		if (contrib.isBlackOrNegative())
+			return;
+
+		PendingConnection &connection = mConnections.Push();
+		connection.mPathIdx           = aPathIdx;
+		connection.mLightVertex       = &aLightVertex;
+		connection.mDirection         = direction;
+		connection.mDistance          = distance;
+		connection.mRaySamplingFlags  = raySamplingFlags;
+		connection.mCameraBsdfDirPdfA = cameraBsdfDirPdfA;
+		connection.mCameraBsdfRevPdfW = cameraBsdfRevPdfW;
+		connection.mLightBsdfDirPdfA  = lightBsdfDirPdfA;
+		connection.mLightBsdfRevPdfW  = lightBsdfRevPdfW;
+		connection.mUnoccluded        = aThroughput * contrib;
+	}
+
+	// Culls queued connections, traces shadow rays of the surviving ones one after another and
+	// returns the sum of their contributions multiplied by media attenuation and MIS weights.
+	// Clears the queue.
+	Rgb ResolveConnections(
+		const Pos          &aCameraHitpoint,
+		const SubPathState &aCameraState)
+	{
+		Rgb result(0);
+		if (mConnections.IsEmpty())
+			return result;
+
+		mConnections.Cull(mRng, mShadowCullThreshold);
+		mConnections.CullOccluded(mScene, aCameraHitpoint, aCameraState.mBoundaryStack);
 
-		// Attenuate by intersected media (if any)
-		float raySamplePdf(1.0f);
-		float raySampleRevPdf(1.0f);
-		Rgb mediaAttenuation(1.0f);
-		if (!mVolumeSegments.empty())
+		for (int i = 0; i < mConnections.Size(); i++)
 		{
-			// PDF
-			raySamplePdf = VolumeSegment::AccumulatePdf(mVolumeSegments);
-			UPBP_ASSERT(raySamplePdf > 0);
-
-			// Reverse PDF
-			raySampleRevPdf = VolumeSegment::AccumulateRevPdf(mVolumeSegments);
-			UPBP_ASSERT(raySampleRevPdf > 0);
-
-			// Attenuation (without PDF!)
-			mediaAttenuation = VolumeSegment::AccumulateAttenuationWithoutPdf(mVolumeSegments);
-			if (!mediaAttenuation.isPositive())
-				return Rgb(0);
+			const PendingConnection &connection = mConnections[i];
+			if (connection.mCullWeight == 0)
+				continue;
+
+			const PathVertex &lightVertex = *connection.mLightVertex;
+
+			// Test occlusion
+			mVolumeSegments.clear();
+			if (mScene.Occluded(aCameraHitpoint, connection.mDirection, connection.mDistance, aCameraState.mBoundaryStack, connection.mRaySamplingFlags, mVolumeSegments))
+				continue;
+
+			// Attenuate by intersected media (if any)
+			float raySamplePdf(1.0f);
+			float raySampleRevPdf(1.0f);
+			Rgb mediaAttenuation(1.0f);
+			if (!mVolumeSegments.empty())
+			{
+				// PDF
+				raySamplePdf = VolumeSegment::AccumulatePdf(mVolumeSegments);
+				UPBP_ASSERT(raySamplePdf > 0);
+
+				// Reverse PDF
+				raySampleRevPdf = VolumeSegment::AccumulateRevPdf(mVolumeSegments);
+				UPBP_ASSERT(raySampleRevPdf > 0);
+
+				// Attenuation (without PDF!)
+				mediaAttenuation = VolumeSegment::AccumulateAttenuationWithoutPdf(mVolumeSegments);
+				if (!mediaAttenuation.isPositive())
+					continue;
+			}
+
+			// MIS weight
+			UPBP_ASSERT(raySampleRevPdf * connection.mLightBsdfDirPdfA > 0);
+			const float wCamera = AccumulateCameraPathWeight(aCameraState.mPathLength, lightVertex.mPathLength + 1, raySampleRevPdf * connection.mLightBsdfDirPdfA, connection.mCameraBsdfRevPdfW);
+			UPBP_ASSERT(raySamplePdf * connection.mCameraBsdfDirPdfA > 0);
+			const float wLight = AccumulateLightPathWeight(connection.mPathIdx, lightVertex.mPathLength, aCameraState.mPathLength + 1, raySamplePdf * connection.mCameraBsdfDirPdfA, connection.mLightBsdfRevPdfW);
+			const float misWeight = 1.f / (wCamera + 1.f + wLight);
+
+			const Rgb contrib = (misWeight * connection.mCullWeight) * connection.mUnoccluded * mediaAttenuation;
+			if (contrib.isBlackOrNegative())
+				continue;
+
+			result += contrib;
 		}
 
-		// MIS weight
-		UPBP_ASSERT(raySampleRevPdf * lightBsdfDirPdfA > 0);
-		const float wCamera = AccumulateCameraPathWeight(aCameraState.mPathLength, raySampleRevPdf * lightBsdfDirPdfA, cameraBsdfRevPdfW);
-		UPBP_ASSERT(raySamplePdf * cameraBsdfDirPdfA > 0);
-		const float wLight = AccumulateLightPathWeight(aPathIdx, aLightVertex.mPathLength, raySamplePdf * cameraBsdfDirPdfA, lightBsdfRevPdfW);
-		const float misWeight = 1.f / (wCamera + 1.f + wLight);
+		mConnections.Clear();
+		return result;
+	}
 
-		const Rgb contrib = (misWeight * geometryTerm) * cameraBsdfFactor * lightBsdfFactor * mediaAttenuation;
+	// Connects camera vertex to mLvcConnections vertices from the light vertex cache (connectable vertices of all
+	// light paths). Each one is selected by resampled importance sampling from mLvcCandidates uniformly chosen
+	// candidates with unoccluded contribution as the target function. Result multiplied by MIS weight, but
+	// not multiplied by camera throughput.
+	Rgb ConnectToLightVertexCache(
+		const BSDF         &aCameraBSDF,
+		const Pos          &aCameraHitpoint,
+		const SubPathState &aCameraState)
+	{
+		const int cacheSize = (int)mLightVertexCache.size();
+		if (cacheSize == 0)
+			return Rgb(0);
 
-		if (contrib.isBlackOrNegative())
-            return Rgb(0);
+		for (int k = 0; k < mLvcConnections; k++)
+		{
+			// Select one candidate with probability proportional to its target function (streaming resampling)
+			int   selected       = -1;
+			float selectedTarget = 0;
+			float targetSum      = 0;
+			for (int j = 0; j < mLvcCandidates; j++)
+			{
+				const int candidate = std::min(int(mRng.GetFloat() * cacheSize), cacheSize - 1);
+				const float target = LightVertexCacheTarget(mLightVertices[mLightVertexCache[candidate].mVertexIdx], aCameraBSDF, aCameraHitpoint, aCameraState);
+				if (target <= 0)
+					continue;
 
-        return contrib;
-    }
+				targetSum += target;
+				if (mRng.GetFloat() * targetSum < target)
+				{
+					selected       = candidate;
+					selectedTarget = target;
+				}
+			}
+
+			if (selected < 0)
+				continue;
+
+			// Resampling weight, candidates were chosen with PDF 1 / cacheSize
+			const float risWeight = targetSum * cacheSize / (selectedTarget * mLvcCandidates);
 
-	// Accumulates PDF ratios of all sampling techniques along path originally sampled from light
-	float AccumulateCameraPathWeight(int aPathLength, float aLastRevPdfA, float aNextToLastPartialRevPdfW) const
+			const CachedVertex &cached = mLightVertexCache[selected];
+			const PathVertex &lightVertex = mLightVertices[cached.mVertexIdx];
+			QueueConnection(lightVertex.mThroughput * risWeight, cached.mPathIdx, lightVertex, aCameraBSDF, aCameraHitpoint, aCameraState);
+		}
+
+		// The cache contains vertices of all light paths while BPT connects to one of them
+		return ResolveConnections(aCameraHitpoint, aCameraState) / (mLvcConnections * mLightSubPathCount);
+	}
+
+	// Target function for selecting vertices from the light vertex cache: luminance of the connection
+	// contribution without visibility, media attenuation and MIS weight
+	float LightVertexCacheTarget(
+		const PathVertex   &aLightVertex,
+		const BSDF         &aCameraBSDF,
+		const Pos          &aCameraHitpoint,
+		const SubPathState &aCameraState) const
+	{
+		if (aLightVertex.mPathLength + 1 + aCameraState.mPathLength < mMinPathLength ||
+			aLightVertex.mPathLength + 1 + aCameraState.mPathLength > mMaxPathLength)
+			return 0;
+
+		Dir direction     = aLightVertex.mHitpoint - aCameraHitpoint;
+		const float dist2 = direction.square();
+		if (dist2 <= 0)
+			return 0;
+		direction /= std::sqrt(dist2);
+
+		float cosCamera, cosLight;
+		const Rgb cameraBsdfFactor = aCameraBSDF.Evaluate(direction, cosCamera);
+		if (cameraBsdfFactor.isBlackOrNegative())
+			return 0;
+
+		const Rgb lightBsdfFactor = aLightVertex.mBSDF.Evaluate(-direction, cosLight);
+		if (lightBsdfFactor.isBlackOrNegative())
+			return 0;
+
+		const float geometryTerm = cosLight * cosCamera / dist2;
+		if (geometryTerm <= 0)
+			return 0;
+
+		return Luminance(aLightVertex.mThroughput * cameraBsdfFactor * lightBsdfFactor) * geometryTerm;
+	}
+
+	// MIS factor of technique with the given numbers of light and camera sub-path vertices. Connections
+	// (at least 2 vertices on both sub-paths) to the light vertex cache are sampled mConnectionMisFactor
+	// times more often than in BPT, other techniques are not affected. The factor assumes uniform selection
+	// from the cache, the resampled density is not used (it would need the candidates of every other
+	// technique's split), so the weights stay unbiased but are not optimal for the resampled connections.
+	float TechniqueMisFactor(int aLightVertexCount, int aCameraVertexCount) const
+	{
+		return (aLightVertexCount >= 2 && aCameraVertexCount >= 2) ? mConnectionMisFactor : 1.0f;
+	}
+
+	// Accumulates PDF ratios of all sampling techniques along path originally sampled from camera,
+	// aLightVertexCount is number of light sub-path vertices of the evaluated technique (0 for hitting light)
+	float AccumulateCameraPathWeight(int aPathLength, int aLightVertexCount, float aLastRevPdfA, float aNextToLastPartialRevPdfW) const
 	{
 		float weight = 0;
 		float product = 1.0f;
 		int lastIndex = aPathLength;
 		int index = 0;
+		const float currentFactorInv = 1.0f / TechniqueMisFactor(aLightVertexCount, aPathLength + 1);
 
 		// Zero vertex (on camera) is ignored (no chance hitting it)
 		while (index < aPathLength)
@@ -777,7 +1013,7 @@ private:
 
 			// Accumulate the ratio if none of the vertices sampled specular events
 			if ((index == 0 || !current.mIsSpecular) && !next.mIsSpecular)			
-				weight += product;		
+				weight += product * TechniqueMisFactor(aLightVertexCount + index + 1, aPathLength - index) * currentFactorInv;
 			
 			++index;
 		}
@@ -836,6 +1072,7 @@ private:
 		// Complete light path state initialization
 
         oLightState.mThroughput   /= emissionPdfW;
+        oLightState.mRRReference   = oLightState.mThroughput.max();
         oLightState.mPathLength    = 1;
         oLightState.mIsFiniteLight = light->IsFinite() ? 1 : 0;
 		oLightState.mLastSpecular  = false;
@@ -919,32 +1156,49 @@ private:
 					return;
 			}
 
-			// Compute MIS weight if doing BPT
-			float misWeight = 1.f;
-			if (mAlgorithm == kBPT)
-			{
-				UPBP_ASSERT(raySampleRevPdf * cameraPdfA > 0);
-				const float wLight = AccumulateLightPathWeight(aLightPathIdx, aLightState.mPathLength, raySampleRevPdf * cameraPdfA, bsdfRevPdfW) / mLightSubPathCount;
-				misWeight = 1.0f / (1.f + wLight);
-			}
-
 			// We divide the contribution by surfaceToImageFactor to convert the (already
 			// divided) PDF from surface area to image plane area, w.r.t. which the
 			// pixel integral is actually defined. We also divide by the number of samples
 			// this technique makes, which is equal to the number of light sub-paths
-			Rgb contrib = misWeight * aLightState.mThroughput * bsdfFactor * mediaAttenuation / (mLightSubPathCount * surfaceToImageFactor);
+			Rgb contrib = aLightState.mThroughput * bsdfFactor * mediaAttenuation / (mLightSubPathCount * surfaceToImageFactor);
 			
 			if (contrib.isBlackOrNegative())
 				return;
 
-            mFramebuffer.AddColor(imagePos, contrib);
+			UPBP_ASSERT(raySampleRevPdf * cameraPdfA > 0);
+
+			// The MIS weight depends on the light vertex cache, wait until it is built
+			if (mDeferCameraConnections)
+			{
+				DeferredCameraConnection deferred;
+				deferred.mImagePos                 = imagePos;
+				deferred.mContrib                  = contrib;
+				deferred.mLightPathIdx             = aLightPathIdx;
+				deferred.mPathLength               = aLightState.mPathLength;
+				deferred.mLastRevPdfA              = raySampleRevPdf * cameraPdfA;
+				deferred.mNextToLastPartialRevPdfW = bsdfRevPdfW;
+				mDeferredCameraConnections.push_back(deferred);
+				return;
+			}
+
+			// Compute MIS weight if doing BPT
+			float misWeight = 1.f;
+			if (mAlgorithm == kBPT)
+			{
+				const float wLight = AccumulateLightPathWeight(aLightPathIdx, aLightState.mPathLength, 1, raySampleRevPdf * cameraPdfA, bsdfRevPdfW) / mLightSubPathCount;
+				misWeight = 1.0f / (1.f + wLight);
+			}
+
+            mFramebuffer.AddColor(imagePos, contrib * misWeight);
         }
     }
 
-	// Accumulates PDF ratios of all sampling techniques along path originally sampled from light
+	// Accumulates PDF ratios of all sampling techniques along path originally sampled from light,
+	// aCameraVertexCount is number of camera sub-path vertices of the evaluated technique (1 for light tracing)
 	float AccumulateLightPathWeight(
 		const int   aPathIndex, 
 		const int   aPathLength, 
+		const int   aCameraVertexCount,
 		const float aLastRevPdfA, 
 		const float aNextToLastPartialRevPdfW) const
 	{
@@ -952,6 +1206,7 @@ private:
 		float product = 1.0f;
 		int lastIndex = (aPathIndex == 0) ? aPathLength : mPathEnds[aPathIndex - 1] + aPathLength;
 		int index = 0;
+		const float currentFactorInv = 1.0f / TechniqueMisFactor(aPathLength + 1, aCameraVertexCount);
 
 		while (index <= aPathLength)
 		{
@@ -980,7 +1235,7 @@ private:
 
 			// Accumulate the ratio if none of the vertices sampled specular events
 			if ((index == 0 || !current.mIsSpecular) && !next.mIsSpecular)			
-				weight += product;		
+				weight += product * TechniqueMisFactor(aPathLength - index, aCameraVertexCount + index + 1) * currentFactorInv;
 			
 			++index;
 		}
@@ -1052,10 +1307,14 @@ private:
 
 		const float bsdfDirPdfWInv = 1.0f / bsdfDirPdfW;
 
+		Rgb throughput = aoState.mThroughput * bsdfFactor * (cosThetaOut * bsdfDirPdfWInv);
+		if (!ThroughputRoulette(throughput, aoState.mRRReference, mRRThreshold, mRng))
+			return false;
+
 		// Update path state
 
 		aoState.mOrigin       = aHitPoint;
-		aoState.mThroughput  *= bsdfFactor * (cosThetaOut * bsdfDirPdfWInv);
+		aoState.mThroughput   = throughput;
 		aoState.mLastPdfWInv  = bsdfDirPdfWInv;
 		aoState.mLastSpecular = specular;
 
@@ -1076,6 +1335,8 @@ private:
 
     float mScreenPixelCount;  // Number of pixels
     float mLightSubPathCount; // Number of light sub-paths
+    float mPathCountPerIter;  // Number of light paths per iteration
+	float mRRThreshold;       // Relative throughput below which throughput based Russian roulette starts (0 = disabled)
 
     std::vector<PathVertex> mLightVertices; // Stored light vertices
 	MisData mCameraVerticesMisData[50];     // Stored MIS data for camera vertices (we don't need store whole vertices as for light paths)
@@ -1087,6 +1348,20 @@ private:
     // where it's light vertices end (begin is at [x-1])
     std::vector<int> mPathEnds;
 
+	// Light vertex cache (connectable vertices of all light paths)
+	std::vector<CachedVertex> mLightVertexCache;
+	int mLvcConnections; // Number of connections of each camera vertex to the light vertex cache (0 = connect to one light path as BPT)
+	int mLvcCandidates;  // Number of candidates for resampled selection of each connected cache vertex
+
+	ConnectionQueue<PendingConnection> mConnections; // Connections of the current camera vertex
+	float mShadowCullThreshold; // Fraction of the largest connection of a vertex below which connections are culled by Russian roulette (0 = only zero ones)
+
+	float mConnectionMisFactor; // MIS factor of connections relative to BPT in the current iteration (see TechniqueMisFactor)
+
+	// Light tracing contributions of the current iteration waiting for the light vertex cache (mLvcConnections > 0)
+	std::vector<DeferredCameraConnection> mDeferredCameraConnections;
+	bool mDeferCameraConnections;
+
 	// Used algorithm
 	AlgorithmType mAlgorithm;
 
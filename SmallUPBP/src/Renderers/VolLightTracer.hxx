@@ -84,6 +84,7 @@ public:
 		const BeamType		    aBB1DBeamType,
 		const float             aBB1DUsedLightSubPathCount,
 		const float             aRefPathCountPerIter,
+		const float             aPathCountPerIter,
 		const bool              aVerbose = true
 		) 
 		: AbstractRenderer(aScene)
@@ -105,6 +106,7 @@ public:
 		, mBB1DBeamType(aBB1DBeamType)
 		, mBB1DUsedLightSubPathCount(aBB1DUsedLightSubPathCount)
 		, mRefPathCountPerIter(aRefPathCountPerIter)
+		, mPathCountPerIter(aPathCountPerIter)
 	{
 		if (mPB2DRadiusInitial < 0)
 			mPB2DRadiusInitial = -mPB2DRadiusInitial * mScene.mSceneSphere.mSceneRadius;
@@ -124,17 +126,16 @@ public:
 		
 		mTimer.Start();
 
-		// While we have the same number of pixels (camera paths)
-        // and light paths, we do keep them separate for clarity reasons
+		// Number of light paths is independent of the number of pixels (camera paths)
         const int resX = int(mScene.mCamera.mResolution.get(0));
         const int resY = int(mScene.mCamera.mResolution.get(1));
 		
-		const int pathCount = resX * resY;
+		const int pathCount = int(mPathCountPerIter);
         mScreenPixelCount = float(resX * resY);
-        mLightSubPathCount   = float(pathCount);
+        mLightSubPathCount   = mPathCountPerIter;
 		
 		if (mBB1DUsedLightSubPathCount < 0)
-			mBB1DUsedLightSubPathCount = -mBB1DUsedLightSubPathCount * pathCount;
+			mBB1DUsedLightSubPathCount = std::floor(-mBB1DUsedLightSubPathCount * mLightSubPathCount);
 
 		// Radius reduction (1st iteration has aIteration == 0, thus offset)
 		// PB2D
@@ -313,8 +314,10 @@ private:
 			std::cout << " + tracing primary rays..." << std::endl;
 		mTimer.Start();
 
-		for (int pixID = 0; pixID < resX * resY; pixID++)
+		const int pixelCount = mScene.mCamera.GetCropPixelCount();
+		for (int cropIdx = 0; cropIdx < pixelCount; cropIdx++)
 		{
+			const int pixID = mScene.mCamera.GetCropPixelIndex(cropIdx);
 			const int x = pixID % resX;
 			const int y = pixID / resX;
 
@@ -383,7 +386,8 @@ private:
 					GridStats gridStats;
 					volumeRadiance = mPhotonBeams.evalBeamBeamEstimate(mBB1DBeamType, ray, mVolumeSegments, BB1D, 0, NULL, &gridStats) / mBB1DUsedLightSubPathCount;
 
-					mBeamDensity.Accumulate(pixID, gridStats);
+					if (mBeamDensity.IsUsed())
+						mBeamDensity.Accumulate(pixID, gridStats);
 				}
 
 				UPBP_ASSERT( !volumeRadiance.isNanInfNeg() );
@@ -643,6 +647,7 @@ private:
     float mScreenPixelCount;    // Number of pixels
     float mLightSubPathCount;   // Number of light sub-paths
 	float mRefPathCountPerIter; // Reference number of paths per iteration
+	float mPathCountPerIter;    // Number of paths per iteration
 
 	typedef std::vector<VltLightVertex> LightVertexVector;
     LightVertexVector mLightVertices;       // Stored light vertices
@@ -29,6 +29,7 @@
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
 
 #include "..\Path\Ray.hxx"
 #include "..\Structs\Mat4f.hxx"
@@ -38,6 +39,30 @@ class Camera
 {
 public:
 
+	// Rectangle of pixels [mMinX, mMaxX) x [mMinY, mMaxY)
+	struct Rect
+	{
+		Rect() {}
+		Rect(int aMinX, int aMinY, int aMaxX, int aMaxY) : mMinX(aMinX), mMinY(aMinY), mMaxX(aMaxX), mMaxY(aMaxY) {}
+
+		int Width() const { return mMaxX - mMinX; }
+		int Height() const { return mMaxY - mMinY; }
+		int Area() const { return Width() * Height(); }
+
+		bool Contains(const Vec2f &aRasterPos) const
+		{
+			return aRasterPos.get(0) >= mMinX && aRasterPos.get(1) >= mMinY &&
+				aRasterPos.get(0) < mMaxX && aRasterPos.get(1) < mMaxY;
+		}
+
+		bool Overlaps(const Rect &aOther) const
+		{
+			return mMinX < aOther.mMaxX && aOther.mMinX < mMaxX && mMinY < aOther.mMaxY && aOther.mMinY < mMaxY;
+		}
+
+		int mMinX, mMinY, mMaxX, mMaxY;
+	};
+
     void Setup(
         const Pos   &aOrigin,
         const Pos   &aTarget,
@@ -50,6 +75,9 @@ public:
     {
 		mOrigin = Pos(aOrigin);
 		mDirection = (aTarget - aOrigin).getNormalized();
+		mRoll = aRoll;
+		mHorizontalFOV = aHorizontalFOV;
+		mFocalDist = aFocalDist;
 
         mResolution = aResolution;
 
@@ -89,8 +117,56 @@ public:
 				
 		mMatID = aMatID;
 		mMedID = aMedID;
+
+		SetCrop(std::vector<Rect>());
     }
 
+	// Restricts rendering to the given non-overlapping pixel rectangles, whole image if empty
+	void SetCrop(const std::vector<Rect> &aRects)
+	{
+		mCropRects = aRects;
+		if (mCropRects.empty())
+			mCropRects.push_back(Rect(0, 0, int(mResolution.get(0)), int(mResolution.get(1))));
+
+		mCropWindow = mCropRects[0];
+		mCropPixelEnds.clear();
+		int pixelCount = 0;
+		for (size_t i = 0; i < mCropRects.size(); i++)
+		{
+			const Rect &rect = mCropRects[i];
+			mCropWindow = Rect(
+				std::min(mCropWindow.mMinX, rect.mMinX), std::min(mCropWindow.mMinY, rect.mMinY),
+				std::max(mCropWindow.mMaxX, rect.mMaxX), std::max(mCropWindow.mMaxY, rect.mMaxY));
+			pixelCount += rect.Area();
+			mCropPixelEnds.push_back(pixelCount);
+		}
+	}
+
+	bool IsCropped() const
+	{
+		return mCropRects.size() > 1 || mCropWindow.Area() != int(mResolution.get(0)) * int(mResolution.get(1));
+	}
+
+	// Number of pixels in the crop rectangles, i.e. camera paths traced per pass
+	int GetCropPixelCount() const
+	{
+		return mCropPixelEnds.back();
+	}
+
+	// Maps index of a pixel within the crop rectangles to index of the pixel in the whole image
+	int GetCropPixelIndex(int aCropIndex) const
+	{
+		size_t r = 0;
+		while (aCropIndex >= mCropPixelEnds[r])
+			r++;
+
+		const Rect &rect = mCropRects[r];
+		const int i = (r == 0) ? aCropIndex : aCropIndex - mCropPixelEnds[r - 1];
+		const int x = rect.mMinX + i % rect.Width();
+		const int y = rect.mMinY + i / rect.Width();
+		return x + y * int(mResolution.get(0));
+	}
+
     int RasterToIndex(const Vec2f &aPixelCoords) const
     {
         return int(std::floor(aPixelCoords.get(0)) + std::floor(aPixelCoords.get(1)) * mResolution.get(0));
@@ -114,11 +190,20 @@ public:
         return Vec2f(temp.x(), temp.y());
     }
 
-    // returns false when raster position is outside screen space
+    // returns false when raster position is outside screen space or the crop rectangles
     bool CheckRaster(const Vec2f &aRasterPos) const
     {
-        return aRasterPos.get(0) >= 0 && aRasterPos.get(1) >= 0 &&
-            aRasterPos.get(0) < mResolution.get(0) && aRasterPos.get(1) < mResolution.get(1);
+        if (!mCropWindow.Contains(aRasterPos))
+            return false;
+
+        if (mCropRects.size() == 1)
+            return true;
+
+        for (size_t i = 0; i < mCropRects.size(); i++)
+            if (mCropRects[i].Contains(aRasterPos))
+                return true;
+
+        return false;
     }
 
     Ray GenerateRay(const Vec2f &aRasterXY) const
@@ -139,8 +224,14 @@ public:
 	Mat4f mRasterToWorld;
     Mat4f mWorldToRaster;
     float mImagePlaneDist;	
+	Dir   mRoll;          // Roll vector given to Setup
+	float mHorizontalFOV; // Horizontal field of view in degrees
+	float mFocalDist;     // Focal distance given to Setup
 	int   mMatID;
 	int   mMedID;	
+	std::vector<Rect> mCropRects;     // Rendered pixel rectangles, whole image when not cropped
+	std::vector<int>  mCropPixelEnds; // Prefix sums of pixel counts of mCropRects
+	Rect              mCropWindow;    // Bounding rectangle of mCropRects
 };
 
 #endif //__CAMERA_HXX__
\ No newline at end of file
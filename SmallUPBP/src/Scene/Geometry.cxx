@@ -26,7 +26,6 @@
 
 #include "Geometry.hxx"
 
-Isect ** AbstractGeometry::sIntersections = nullptr;
 bool  AbstractGeometry::sUseShadingNormal = true;
 
 void AcceleratedGeometryList::GrowBBox(
@@ -59,7 +58,7 @@ void AcceleratedGeometryList::GrowBBox(
 	{
 		if (mGeometry[i]->getType() == GEOM_TRIANGLE)
 		{
-			const Triangle * tr = dynamic_cast<const Triangle *>(mGeometry[i]);
+			const Triangle * tr = static_cast<const Triangle *>(mGeometry[i]);
 			// Point 1
 			vertices[idver].x = tr->p[0].x();
 			vertices[idver].y = tr->p[0].y();
@@ -107,11 +106,13 @@ void AcceleratedGeometryList::GrowBBox(
 	// Prepare mesh intersector
 	mMeshIntersector = embree::rtcQueryIntersector1(mMesh, "default");
 	UPBP_ASSERT(mMeshIntersector != nullptr);
+	mMeshIntersector4 = embree::rtcQueryIntersector4(mMesh, "default");
+	UPBP_ASSERT(mMeshIntersector4 != nullptr);
 
 	// Prepare other geometry intersector
 	mOtherIntersector = embree::rtcQueryIntersector1(mOtherGeometry, "default");
 	UPBP_ASSERT(mOtherIntersector != nullptr);
 
-	// For intersections reporting
-	AbstractGeometry::allocStaticResources();
+	// Flat attributes for hit processing
+	BuildAttributes();
 }
\ No newline at end of file
@@ -35,6 +35,7 @@
 
 #include "include\embree.h"
 #include "common\ray.h"
+#include "common\ray4.h"
 #include "..\Misc\Utils2.hxx"
 #include "..\Path\Ray.hxx"
 #include "Materials.hxx"
@@ -102,11 +103,11 @@ public:
 		return r;
 	}
 
-	// Embree accelerated intersection test
+	// Embree accelerated intersection test, reports only distance and id, the rest is filled by the caller from the id
 	static void embreeIntersect(const embree::Intersector1* This, embree::Ray& ray)
 	{
 		const AbstractGeometry * geom = (const AbstractGeometry *)(This);
-		Isect & tmp = *sIntersections[omp_get_thread_num()];
+		Isect tmp(ray.tfar);
 		if (geom->Intersect(rayConvert(ray), tmp))
 		{
 			ray.tfar = tmp.mDist;
@@ -137,25 +138,6 @@ public:
 		return mId;
 	}
 
-	/// Allocates static resources for reporting Intersections
-	static void allocStaticResources()
-	{
-		if (sIntersections == nullptr)
-		{
-			sIntersections = new Isect *[omp_get_max_threads()];
-		}
-	}
-
-	/// Deallocates static resources for reporting Intersections
-	static void deallocStaticResources()
-	{
-		if (sIntersections != nullptr)
-		{
-			delete[] sIntersections;
-			sIntersections = nullptr;
-		}
-	}
-
 	/// Sets whether we will compute shading normal
 	static void setUseShadingNormal(bool use)
 	{
@@ -171,9 +153,6 @@ private:
 	GeometryPrimitiveType mType; /// Geometry type
 	int mId; /// Id for reporting embree intersection Intersections
 	static bool sUseShadingNormal; ///If false, it sets shading normal equal to geometry normal
-protected:
-	/// Static variables - one element of array for each thread
-	static Isect ** sIntersections; /// For reporting Intersections
 };
 
 class Triangle : public AbstractGeometry
@@ -450,6 +429,17 @@ public:
 	int    lightID;
 };
 
+// Flat copy of per-element data needed after a hit, indexed by element ID (equal to embree primitive ID)
+struct ElementAttributes
+{
+	GeometryPrimitiveType mType; // Triangles interpolate vertex normals, other geometry uses its own normal
+	int   mMatID;
+	int   mMedID;
+	int   mLightID;
+	Dir   mNormal;               // Geometric normal (triangles only)
+	Dir   mVertexNormals[3];     // Vertex normals (triangles only)
+};
+
 class GeometryList : public AbstractGeometry
 {
 public:
@@ -489,6 +479,17 @@ public:
 		oIntersections.sort();
 	}
 
+	// Finds materials of the closest triangle intersections of 4 rays at once, -1 for misses or when unknown.
+	// Only used to quickly find occluded rays, so the default reports nothing
+	virtual void IntersectMaterials4(
+		const Ray   aRays[4],
+		const float aMaxDists[4],
+		int         oMatIDs[4]) const
+	{
+		for (int i = 0; i < 4; i++)
+			oMatIDs[i] = -1;
+	}
+
 	// Not only grows BBox, but also builds structure for faster ray intersection routines
 	virtual void GrowBBox(
 		Pos &aoBBoxMin,
@@ -499,10 +500,56 @@ public:
 			mGeometry[i]->GrowBBox(aoBBoxMin, aoBBoxMax);
 			mGeometry[i]->setId(i);
 		}
+		BuildAttributes();
+	}
+
+	// Computes shading normal of the given intersection, replaces virtual computeIntersectionInfo on the hot path
+	INLINE void ComputeShadingNormal(Isect & oIntersection) const
+	{
+		const ElementAttributes & attr = mAttributes[oIntersection.mElementID];
+		if (attr.mType == GEOM_TRIANGLE && useShadingNormal())
+		{
+			const float u = oIntersection.mUV.x;
+			const float v = oIntersection.mUV.y;
+			oIntersection.mShadingNormal = (attr.mVertexNormals[1] * u + attr.mVertexNormals[2] * v + attr.mVertexNormals[0] * (1 - u - v)).getNormalized();
+		}
+		else
+		{
+			oIntersection.mShadingNormal = oIntersection.mNormal;
+		}
+	}
+
+protected:
+
+	// Fills attribute table from the geometry, must be called after all geometry is added
+	void BuildAttributes()
+	{
+		mAttributes.resize(mGeometry.size());
+		for (int i = 0; i < (int)mGeometry.size(); i++)
+		{
+			ElementAttributes & attr = mAttributes[i];
+			attr.mType = mGeometry[i]->getType();
+			if (attr.mType == GEOM_TRIANGLE)
+			{
+				const Triangle * tr = static_cast<const Triangle *>(mGeometry[i]);
+				attr.mMatID = tr->matID;
+				attr.mMedID = tr->medID;
+				attr.mLightID = tr->lightID;
+				attr.mNormal = tr->mNormal;
+				for (int j = 0; j < 3; j++)
+					attr.mVertexNormals[j] = tr->n[j];
+			}
+			else
+			{
+				// Analytic primitives report everything in their own Intersect
+				attr.mMatID = attr.mMedID = attr.mLightID = -1;
+			}
+		}
 	}
 
 public:
-	std::vector<AbstractGeometry*> mGeometry; // All geometry in small upbp internal format
+	std::vector<AbstractGeometry*> mGeometry;   // All geometry in small upbp internal format
+	std::vector<ElementAttributes> mAttributes; // Per-element attributes for hit processing, same indices as mGeometry
 };
 
 class AcceleratedGeometryList : public GeometryList
@@ -512,31 +559,30 @@ public:
 	virtual ~AcceleratedGeometryList()
 	{
 		embree::rtcDeleteIntersector1(mMeshIntersector);
+		embree::rtcDeleteIntersector4(mMeshIntersector4);
 		embree::rtcDeleteGeometry(mMesh);
 		embree::rtcDeleteIntersector1(mOtherIntersector);
 		embree::rtcDeleteGeometry(mOtherGeometry);
-		AbstractGeometry::deallocStaticResources();
 	};
 
 
 	virtual bool Intersect(const Ray& aRay, Isect &oIntersection) const
 	{
-		sIntersections[omp_get_thread_num()] = &oIntersection;
 		embree::Ray ray = AbstractGeometry::rayConvert(aRay, oIntersection.mDist);
 		mMeshIntersector->intersect(ray);
 		oIntersection.mElementID = -1;
 		if (ray.id0 >= 0) // Hit
 		{
-			const Triangle * tr = (const Triangle *)(mGeometry[ray.id0]);
+			const ElementAttributes & attr = mAttributes[ray.id0];
 			// Triangle hit
 			oIntersection.mDist = ray.tfar;
-			oIntersection.mMatID = tr->matID;
-			oIntersection.mMedID = tr->medID;
-			oIntersection.mLightID = tr->lightID;
-			oIntersection.mNormal = tr->mNormal;
+			oIntersection.mMatID = attr.mMatID;
+			oIntersection.mMedID = attr.mMedID;
+			oIntersection.mLightID = attr.mLightID;
+			oIntersection.mNormal = attr.mNormal;
 			oIntersection.mElementID = ray.id0;
 			oIntersection.mUV = Vec2f(ray.u, ray.v);
-			oIntersection.mEnter = dot(tr->mNormal, aRay.direction) < 0;
+			oIntersection.mEnter = dot(attr.mNormal, aRay.direction) < 0;
 			ray = AbstractGeometry::rayConvert(aRay, ray.tfar);
 		}
 		if (!mAnyNonTriangles)
@@ -549,6 +595,31 @@ public:
 		return oIntersection.mElementID >=0;
 	}
 
+	// Traces the rays as one embree packet against the triangles, rays with zero maximum distance are inactive.
+	// Other geometry is not tested, a closer hit with it may be missed
+	virtual void IntersectMaterials4(
+		const Ray   aRays[4],
+		const float aMaxDists[4],
+		int         oMatIDs[4]) const
+	{
+		embree::Ray4 ray(
+			embree::sse3f(
+				embree::ssef(aRays[0].origin.x(), aRays[1].origin.x(), aRays[2].origin.x(), aRays[3].origin.x()),
+				embree::ssef(aRays[0].origin.y(), aRays[1].origin.y(), aRays[2].origin.y(), aRays[3].origin.y()),
+				embree::ssef(aRays[0].origin.z(), aRays[1].origin.z(), aRays[2].origin.z(), aRays[3].origin.z())),
+			embree::sse3f(
+				embree::ssef(aRays[0].direction.x(), aRays[1].direction.x(), aRays[2].direction.x(), aRays[3].direction.x()),
+				embree::ssef(aRays[0].direction.y(), aRays[1].direction.y(), aRays[2].direction.y(), aRays[3].direction.y()),
+				embree::ssef(aRays[0].direction.z(), aRays[1].direction.z(), aRays[2].direction.z(), aRays[3].direction.z())),
+			embree::ssef(embree::zero),
+			embree::ssef(aMaxDists[0], aMaxDists[1], aMaxDists[2], aMaxDists[3]));
+		const __m128 valid = _mm_cmpgt_ps(ray.tfar, _mm_setzero_ps());
+		mMeshIntersector4->intersect(valid, ray);
+
+		for (int i = 0; i < 4; i++)
+			oMatIDs[i] = ray.id0.i[i] >= 0 ? mAttributes[ray.id0.i[i]].mMatID : -1;
+	}
+
 	// Not only grows BBox, but also builds structure for faster ray intersection routines
 	virtual void GrowBBox(
 		Pos &aoBBoxMin,
@@ -560,6 +631,8 @@ public:
 
 	embree::RTCIntersector1* mMeshIntersector; // Intersector for triangle geometry
 
+	embree::RTCIntersector4* mMeshIntersector4; // Intersector for packets of 4 rays with triangle geometry
+
 	embree::RTCGeometry * mOtherGeometry; // Other geometry
 
 	embree::RTCIntersector1* mOtherIntersector; // Intersector for 
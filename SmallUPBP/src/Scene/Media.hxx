@@ -250,7 +250,7 @@ public:
 
 		if (mMinPositiveAttenuationCoefComp() && HasScattering()) // we can sample along the ray
 		{
-			float s = -std::log(aRandom) / mMinPositiveAttenuationCoefComp();
+			float s = -FastMath::log(aRandom) / mMinPositiveAttenuationCoefComp();
 
 			if (s < aDistToBoundary) // sample is before the boundary intersection
 			{
@@ -344,7 +344,7 @@ private:
 		const float aAttenuationCoefComp,
 		const float aDistanceAlongRay) const
 	{
-		return std::exp(-aAttenuationCoefComp* aDistanceAlongRay);
+		return FastMath::exp(-aAttenuationCoefComp* aDistanceAlongRay);
 	}
 	
 };
@@ -33,6 +33,9 @@
 #include <vector>
 #include <map>
 #include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
 
 #include "..\Misc\Rng.hxx"
 #include "..\Misc\ObjReader.hxx"
@@ -575,7 +578,7 @@ public:
 		// Compute shading normal?
 		if (hit && !testOcclusion && !scatteringOccured)
 		{
-			dynamic_cast<const GeometryList *>(mRealGeometry)->mGeometry[oResult.mElementID]->computeIntersectionInfo(oResult);
+			mRealGeometry->ComputeShadingNormal(oResult);
 		}
 		
 		return hit;		
@@ -603,6 +606,45 @@ public:
 		return Intersect(Ray(aPoint, aDir), Isect(aTMax), stackCopy, kOcclusionTest, aRaySamplingFlags, NULL, &oVolumeSegments, NULL, NULL);
 	}
 
+	// Quickly finds which of 4 rays starting in the same medium are occluded: traces them as one packet and reports
+	// those whose closest hit is a real surface they cannot pass (the same test as in Intersect). Returns a bit mask
+	// of occluded rays, the others are not known to be unoccluded and must be tested by Occluded, which also walks
+	// the media boundaries. Rays with zero distance are ignored
+	int OccludedMask4(
+		const Pos           &aPoint,
+		const Dir           aDirs[4],
+		const float         aTMaxs[4],
+		const uint          aRaySamplingFlags[4],
+		const BoundaryStack &aBoundaryStack) const
+	{
+		Ray rays[4];
+		float maxDists[4];
+		for (int i = 0; i < 4; i++)
+		{
+			// Same epsilons as in Intersect
+			const float firstEps = (aRaySamplingFlags[i] & AbstractMedium::kOriginInMedium) ? 0 : EPS_RAY;
+			rays[i] = Ray(aPoint + aDirs[i] * firstEps, aDirs[i]);
+			maxDists[i] = aTMaxs[i] > 0 ? std::max(aTMaxs[i] - firstEps - EPS_RAY, 0.f) : 0.f;
+		}
+
+		int matIDs[4];
+		mRealGeometry->IntersectMaterials4(rays, maxDists, matIDs);
+
+		const int topPriority = aBoundaryStack.TopPriority();
+		int mask = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			if (matIDs[i] < 0)
+				continue;
+
+			const int priority = GetMediumBoundaryPriority(matIDs[i]);
+			if (priority >= topPriority || priority == THIN_WALL_PRIORITY)
+				mask |= 1 << i;
+		}
+
+		return mask;
+	}
+
 	// Clear boundary stack and push in the global medium without any material
 	void InitBoundaryStack(BoundaryStack &oBoundaryStack) const
 	{		
@@ -1153,6 +1195,40 @@ public:
         mSceneSphere.mInvSceneRadiusSqr = 1.f / Utils::sqr(mSceneSphere.mSceneRadius);
     }
 
+	/// Loads additional views for multi-view rendering, one "<origin xyz> <target xyz> [fov]" per line
+	/// (# starts a comment). Views share roll, resolution and medium of mCamera, and its fov if not given.
+	bool LoadViews(const std::string &aFilename)
+	{
+		std::ifstream file(aFilename.c_str());
+		if (!file)
+			return false;
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			const size_t comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+
+			std::istringstream iss(line);
+			float o[3], t[3];
+			if (!(iss >> o[0] >> o[1] >> o[2]))
+				continue; // empty line
+			if (!(iss >> t[0] >> t[1] >> t[2]))
+				return false;
+
+			float fov;
+			if (!(iss >> fov))
+				fov = mCamera.mHorizontalFOV;
+
+			Camera view;
+			view.Setup(Pos(o[0], o[1], o[2]), Pos(t[0], t[1], t[2]), mCamera.mRoll, mCamera.mResolution, fov, mCamera.mFocalDist, mCamera.mMatID, mCamera.mMedID);
+			mViews.push_back(view);
+		}
+
+		return true;
+	}
+
 	/// Loads scene from a selected obj file
 	void LoadFromObj(const char * file, const Vec2i &aResolution)
 	{
@@ -1349,9 +1425,10 @@ public:
 
 public:
 
-    AbstractGeometry              *mRealGeometry;
-	AbstractGeometry              *mImaginaryGeometry;
+    GeometryList                  *mRealGeometry;
+	GeometryList                  *mImaginaryGeometry;
     Camera                        mCamera;
+	std::vector<Camera>           mViews; // Additional views sharing light sub-paths with mCamera (upbp only)
     std::vector<Material>         mMaterials;
 	std::vector<AbstractMedium*>  mMedia;
 	int                           mGlobalMediumID;
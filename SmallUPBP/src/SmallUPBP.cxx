@@ -26,8 +26,12 @@
 
 #pragma warning(disable: 4482)
 
+#include <atomic>
+
 #include "Bre\EmbreeAcc.hxx"
 #include "Misc\Config.hxx"
+#include "Misc\Numa.hxx"
+#include "Misc\MemoryBudget.hxx"
 
 // Output image in continuous outputting
 void continuousOutput(const Config &aConfig, int iter, Framebuffer & accumFrameBuffer, Framebuffer & outputFrameBuffer, AbstractRenderer* renderer, const std::string & name, const std::string & ext, char * filename)
@@ -49,6 +53,100 @@ void continuousOutput(const Config &aConfig, int iter, Framebuffer & accumFrameB
 	}
 }
 
+// Creates and sets up a renderer of the given config
+AbstractRenderer* createConfiguredRenderer(const Config &aConfig, int aThreadId, LightPathCounter *aLightPathCounter)
+{
+	AbstractRenderer* renderer = CreateRenderer(aConfig, aConfig.mBaseSeed + aThreadId, aConfig.mBaseSeed, aLightPathCounter);
+
+	renderer->mMaxPathLength = aConfig.mMaxPathLength;
+	renderer->mMinPathLength = aConfig.mMinPathLength;
+	renderer->SetupDebugImages(aConfig.mDebugImages);
+	renderer->SetupBeamDensity(aConfig.mBeamDensType, aConfig.mScene->mCamera.mResolution, aConfig.mBeamDensMax);
+
+	return renderer;
+}
+
+// Creates renderer of the given thread
+AbstractRenderer* createThreadRenderer(const Config &aConfig, int aThreadId, LightPathCounter *aLightPathCounter)
+{
+	AbstractRenderer* renderer = createConfiguredRenderer(aConfig, aThreadId, aLightPathCounter);
+
+	// Debug images and beam density are accumulated per renderer, so they are not supported by pipelining
+	if (aConfig.mPipelineIterations && renderer->SupportsPhases() && !aConfig.mDebugImages.IsUsed() && aConfig.mBeamDensType == BeamDensity::NONE)
+		renderer = new PipelinedRenderer(*aConfig.mScene, renderer, createConfiguredRenderer(aConfig, aThreadId, aLightPathCounter));
+
+	return renderer;
+}
+
+// Estimated size of the BB1D grid of the given resolution, including temporary arrays of its build
+double estimateGridMemory(uint aResolution)
+{
+	const double cells = std::pow(aResolution + 1.0, 3.0);
+	return cells * (3 * sizeof(uint) + sizeof(float));
+}
+
+// Fits the render into aConfig.mMemoryBudget using estimated sizes of per-thread structures. The BB1D grid
+// resolution is reduced first (down to a quarter of the thread memory), then light sub-paths per iteration
+// (down to a quarter of the requested ones), then render threads. The planned path count and grid resolution
+// also limit the iteration tuner.
+void planMemoryBudget(Config &aConfig)
+{
+	if (aConfig.mMemoryBudget == 0)
+		return;
+
+	const bool upbp = aConfig.mAlgorithm >= Config::kVolumetricLightTracingFromUPBP && aConfig.mAlgorithm <= Config::kUPBPAll;
+	const bool debugImages = aConfig.mDebugImages.IsUsed() || aConfig.mBeamDensType != BeamDensity::NONE;
+	const int engines = (upbp && aConfig.mPipelineIterations && !debugImages) ? 2 : 1;
+
+	// Output, accumulated and final images (and final images of views) are shared, each renderer has its own
+	// framebuffers of all views, all of them store only the crop window
+	const double views = (double)aConfig.mScene->mViews.size();
+	const double framebuffer = double(aConfig.mScene->mCamera.mCropWindow.Area()) * sizeof(Rgb) * (1 + views);
+	const double shared = framebuffer + 2 * framebuffer / (1 + views);
+
+	// Debug images are accumulated by each renderer and into the shared ones
+	const double debugImageBytes = (double)aConfig.mDebugImages.GetMemorySize();
+
+	// Light vertex with its index and hash grid entries (128 B more for its photon, embree's BVH and k-NN tree node),
+	// and photon beam with its pointers in grid cells (a few per beam)
+	const int avgVerts = std::min((int)aConfig.mMaxPathLength, UPBP_LIGHT_AVGVERTS);
+	const double vertexBytes = sizeof(UPBPLightVertex) + 6 * sizeof(int) + 128;
+	const double beamBytes = sizeof(PhotonBeam) + 8 * sizeof(void *);
+	const float beamFraction = aConfig.mBB1DUsedLightSubPathCount < 0 ? -aConfig.mBB1DUsedLightSubPathCount :
+		std::min(aConfig.mBB1DUsedLightSubPathCount, aConfig.mPathCountPerIter) / aConfig.mPathCountPerIter;
+	const double pathBytes = upbp ? avgVerts * (vertexBytes + beamFraction * beamBytes) : 0;
+
+	int threads = aConfig.mNumThreads;
+	uint gridResolution = aConfig.mGridResolution;
+	double lightBytes = 0;
+	for (;;)
+	{
+		const double engineBytes = (double(aConfig.mMemoryBudget) - shared - debugImageBytes) / (threads * engines) - framebuffer - debugImageBytes;
+
+		while (upbp && gridResolution > 16 && estimateGridMemory(gridResolution) > engineBytes / 4)
+			gridResolution /= 2;
+
+		lightBytes = engineBytes - (upbp ? estimateGridMemory(gridResolution) : 0);
+		if (threads == 1 || lightBytes >= pathBytes * aConfig.mPathCountPerIter / 4)
+			break;
+
+		--threads;
+	}
+
+	if (lightBytes <= 0)
+		printf("Warning: memory budget of %d MB is too small\n", int(aConfig.mMemoryBudget >> 20));
+
+	aConfig.mNumThreads = threads;
+	if (upbp)
+	{
+		if (pathBytes * aConfig.mPathCountPerIter > lightBytes)
+			aConfig.mPathCountPerIter = std::max(1.0f, (float)std::floor(lightBytes / pathBytes));
+		aConfig.mMaxMemoryPerThread = std::min(aConfig.mMaxMemoryPerThread, (size_t)std::max(lightBytes, 0.0));
+		aConfig.mGridResolution = gridResolution;
+		PhotonBeamsEvaluator::sGridSize = gridResolution;
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////
 // The main rendering function, renders what is in aConfig
 
@@ -68,22 +166,45 @@ float render(
     AbstractRendererPtr *renderers;
     renderers = new AbstractRendererPtr[usedThreads];
 
-    for(int i=0; i<usedThreads; i++)
-    {
-        renderers[i] = CreateRenderer(aConfig, aConfig.mBaseSeed + i, aConfig.mBaseSeed);
+	// Light passes of all renderers, radius reduction counts the paths traced by all of them
+	LightPathCounter lightPathCounter;
 
-        renderers[i]->mMaxPathLength = aConfig.mMaxPathLength;
-        renderers[i]->mMinPathLength = aConfig.mMinPathLength;
-		renderers[i]->SetupDebugImages(aConfig.mDebugImages);
-		renderers[i]->SetupBeamDensity(aConfig.mBeamDensType, aConfig.mScene->mCamera.mResolution, aConfig.mBeamDensMax);
-    }
+	if (aConfig.mNumaAware)
+	{
+		// Each thread pins itself to its node and creates its own renderer, so the renderer's data
+		// are first touched (and thus allocated) in the local memory. OpenMP reuses the same threads
+		// in the rendering loops below, so they keep working on the local data.
+		NumaTopology numa;
+#pragma omp parallel for schedule(static, 1)
+		for (int i = 0; i < usedThreads; i++)
+		{
+			numa.PinCurrentThread(omp_get_thread_num(), usedThreads);
+			renderers[i] = createThreadRenderer(aConfig, i, &lightPathCounter);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < usedThreads; i++)
+			renderers[i] = createThreadRenderer(aConfig, i, &lightPathCounter);
+	}
 
     clock_t startT = clock();
     int iter = 0;
 
+	// Ticket dispenser of iteration indices shared by all threads, every index is claimed exactly once,
+	// so the iterations run (and thus their seeds and radii) do not depend on thread scheduling
+	std::atomic<int> nextIteration(0);
+
 	Framebuffer accumFrameBuffer, outputFrameBuffer;
-	accumFrameBuffer.Setup(aConfig.mResolution);
-	outputFrameBuffer.Setup(aConfig.mResolution);
+	AbstractRenderer::SetupFramebuffer(accumFrameBuffer, aConfig.mScene->mCamera);
+	AbstractRenderer::SetupFramebuffer(outputFrameBuffer, aConfig.mScene->mCamera);
+
+	// Images of the renderers and the shared ones (including the final ones set up after rendering)
+	MemoryBudget::Tracker framebufferMemory(MemoryBudget::kFramebuffers);
+	size_t framebufferBytes = (3 + aConfig.mScene->mViews.size()) * accumFrameBuffer.GetMemorySize();
+	for (int i = 0; i < usedThreads; i++)
+		framebufferBytes += renderers[i]->GetFramebufferMemory();
+	framebufferMemory.Set(framebufferBytes);
 	std::string name = aConfig.mOutputName.substr(0, aConfig.mOutputName.length() - 4);
 	std::string ext = aConfig.mOutputName.substr(aConfig.mOutputName.length() - 3, 3);
 	char filename[1024]; // Must be shared, otherwise critical section fails
@@ -93,40 +214,60 @@ float render(
     if(aConfig.mMaxTime > 0)
     {
         // Time based loop
-#pragma omp parallel shared(iter,accumFrameBuffer,outputFrameBuffer,name,ext,filename)
-        while(clock() < startT + aConfig.mMaxTime*CLOCKS_PER_SEC)
-        {
-            int threadId = omp_get_thread_num();
-			renderers[threadId]->RunIteration(iter);
+#pragma omp parallel shared(iter,nextIteration,accumFrameBuffer,outputFrameBuffer,name,ext,filename)
+		{
+			// The next ticket is claimed in advance, so that pipelined renderers can start it early. It is not
+			// announced when the previous iteration would not fit into the remaining time, its prepared light
+			// pass would be thrown away
+			int threadId = omp_get_thread_num();
+			int ticket = nextIteration++;
+			const clock_t stopT = startT + clock_t(aConfig.mMaxTime*CLOCKS_PER_SEC);
+			clock_t lastIterationTime = 0;
+			while(clock() < stopT)
+			{
+				const clock_t iterationStartT = clock();
+				const int next = nextIteration++;
+				renderers[threadId]->SetNextIteration(iterationStartT + 2 * lastIterationTime < stopT ? next : -1);
+				renderers[threadId]->RunIteration(ticket);
+				lastIterationTime = clock() - iterationStartT;
 
 #pragma omp critical
-			{
-				iter++; // counts number of iterations
-				continuousOutput(aConfig, iter, accumFrameBuffer, outputFrameBuffer, renderers[threadId], name, ext, filename);
+				{
+					iter++; // counts number of iterations
+					continuousOutput(aConfig, iter, accumFrameBuffer, outputFrameBuffer, renderers[threadId], name, ext, filename);
+				}
+
+				ticket = next;
 			}
-        }
+		}
     }
     else
     {
         // Iterations based loop
 		int cnt = 0, p = -1;
-#pragma omp parallel for shared(cnt,p,accumFrameBuffer,outputFrameBuffer,name,ext,filename)
-        for(iter=0; iter < aConfig.mIterations; iter++)
-        {
-            int threadId = omp_get_thread_num();
-			renderers[threadId]->RunIteration(iter);
-#pragma omp critical
+#pragma omp parallel shared(cnt,p,nextIteration,accumFrameBuffer,outputFrameBuffer,name,ext,filename)
+		{
+			// The next ticket is claimed in advance, so that pipelined renderers can start it early
+			int threadId = omp_get_thread_num();
+			for(int ticket = nextIteration++; ticket < aConfig.mIterations;)
 			{
-				++cnt;
-				int percent = (int)(((float)cnt / aConfig.mIterations)*100.0f);
-				if (percent != p)
+				const int next = nextIteration++;
+				renderers[threadId]->SetNextIteration(next < aConfig.mIterations ? next : -1);
+				renderers[threadId]->RunIteration(ticket);
+#pragma omp critical
 				{
-					p = percent;
-					std::cout << percent << "%" << std::endl;
+					++cnt;
+					int percent = (int)(((float)cnt / aConfig.mIterations)*100.0f);
+					if (percent != p)
+					{
+						p = percent;
+						std::cout << percent << "%" << std::endl;
+					}
+					continuousOutput(aConfig, cnt, accumFrameBuffer, outputFrameBuffer, renderers[threadId], name, ext,filename);
 				}
-				continuousOutput(aConfig, cnt, accumFrameBuffer, outputFrameBuffer, renderers[threadId], name, ext,filename);
+				ticket = next;
 			}
-        }
+		}
 		iter = aConfig.mIterations;
     }
 
@@ -140,6 +281,12 @@ float render(
 	aConfig.mCameraTracingTime = 0;
 	aConfig.mBeamDensity.Setup(aConfig.mBeamDensType, aConfig.mScene->mCamera.mResolution, aConfig.mBeamDensMax);
 
+	std::vector<const Framebuffer*> framebuffers;
+	std::vector<const DebugImages*> debugImages;
+	std::vector<const BeamDensity*> beamDensities;
+	std::vector<int> iterations;
+	int totalIterations = 0;
+
     // Not all created renderers had to have been used.
     // Those must not participate in accumulation.
     for(int i=0; i<usedThreads; i++)
@@ -147,34 +294,47 @@ float render(
         if(!renderers[i]->WasUsed())
             continue;
 
-		if (aConfig.mContinuousOutput <= 0)
-		{
-			if (usedRenderers == 0)
-			{
-				renderers[i]->GetFramebuffer(*aConfig.mFramebuffer);
-			}
-			else
-			{
-				Framebuffer tmp;
-				renderers[i]->GetFramebuffer(tmp);
-				aConfig.mFramebuffer->Add(tmp);
-			}
-		}
-
-		renderers[i]->AccumulateDebugImages(aConfig.mDebugImages);
-		renderers[i]->AccumulateBeamDensity(aConfig.mBeamDensity);
+		framebuffers.push_back(&renderers[i]->GetFramebufferUnscaled());
+		debugImages.push_back(&renderers[i]->GetDebugImages());
+		beamDensities.push_back(&renderers[i]->GetBeamDensity());
+		iterations.push_back(renderers[i]->GetIterations());
+		totalIterations += renderers[i]->GetIterations();
 
 		aConfig.mCameraTracingTime += renderers[i]->mCameraTracingTime;
 
         usedRenderers++;
     }
-	
+
+	// Reduces all images of the used renderers in parallel, each pixel at once
 	if (aConfig.mContinuousOutput <= 0)
 	{
-		// Scale framebuffer by the number of used renderers
-		aConfig.mFramebuffer->Scale(1.f / usedRenderers);
+		// Average of all iterations, renderers that ran more iterations have proportionally more weight,
+		// so the result does not depend on how the iterations were distributed among threads
+		std::vector<float> scales(usedRenderers, 1.f / totalIterations);
+
+		AbstractRenderer::SetupFramebuffer(*aConfig.mFramebuffer, aConfig.mScene->mCamera);
+		aConfig.mFramebuffer->AddScaled(framebuffers, scales);
 	}
-	else
+
+	// Additional views are averaged the same way, renderers keep their images also with continuous output
+	aConfig.mViewFramebuffers.resize(aConfig.mScene->mViews.size());
+	for (size_t view = 0; view < aConfig.mViewFramebuffers.size(); ++view)
+	{
+		std::vector<const Framebuffer*> viewFramebuffers;
+		for (int i = 0; i < usedThreads; i++)
+		{
+			if (renderers[i]->WasUsed())
+				viewFramebuffers.push_back(&renderers[i]->GetViewFramebufferUnscaled((int)view));
+		}
+
+		AbstractRenderer::SetupFramebuffer(aConfig.mViewFramebuffers[view], aConfig.mScene->mViews[view]);
+		aConfig.mViewFramebuffers[view].AddScaled(viewFramebuffers, std::vector<float>(viewFramebuffers.size(), 1.f / totalIterations));
+	}
+
+	aConfig.mDebugImages.Accumulate(debugImages, iterations);
+	aConfig.mBeamDensity.Accumulate(beamDensities);
+
+	if (aConfig.mContinuousOutput > 0)
 	{
 		*aConfig.mFramebuffer = accumFrameBuffer;
 		aConfig.mFramebuffer->Scale(1.f / iter);
@@ -211,10 +371,21 @@ int main(int argc, const char *argv[])
 		if (config.mNumThreads <= 0)
 			config.mNumThreads = std::max(1, omp_get_num_procs());
 
+		// Restricts embree builder threads, so they do not compete with render threads building their structures at once
+		int embreeThreads = config.mEmbreeThreads;
+		if (embreeThreads < 0)
+			embreeThreads = config.mNumaAware ? 1 : 0;
+		if (embreeThreads > 0)
+			EmbreeAcc::setBuildThreads(embreeThreads);
+
 		// When some error has been encountered, exits
 		if (config.mScene == NULL)
 			return 1;
 
+		// Scales threads and per-thread structures to the memory budget
+		planMemoryBudget(config);
+		MemoryBudget::Reset();
+
 		// Sets up framebuffer
 		Framebuffer fbuffer;
 		config.mFramebuffer = &fbuffer;
@@ -225,6 +396,8 @@ int main(int argc, const char *argv[])
 			printf("Target:   %g seconds render time\n", config.mMaxTime);
 		else
 			printf("Target:   %d iteration(s)\n", config.mIterations);
+		if (config.mMemoryBudget > 0)
+			printf("Memory:   %d MB budget, %d thread(s)\n", int(config.mMemoryBudget >> 20), config.mNumThreads);
 
 		// Renders the image
 		std::string desc = GetDescription(config, "            ");
@@ -235,6 +408,7 @@ int main(int argc, const char *argv[])
 		EmbreeAcc::cleanupLib();
 		printf("done in %.2f s (%i iterations)\n", time, (iterations - 1));
 		if (config.mCameraTracingTime) printf("avg camera time %.2f s\n", config.mCameraTracingTime);
+		MemoryBudget::Print();
 
 		std::string extension = config.mOutputName.substr(config.mOutputName.length() - 3, 3);
 
@@ -261,6 +435,13 @@ int main(int argc, const char *argv[])
 		fbuffer.Save(config.mOutputName, 2.2f /*gamma*/);
 
 		std::string name = config.mOutputName.substr(0, config.mOutputName.length() - 4);
+		for (size_t view = 0; view < config.mViewFramebuffers.size(); ++view)
+		{
+			std::ostringstream viewName;
+			viewName << name << "_view" << view + 1 << "." << extension;
+			std::string viewFilename = viewName.str();
+			config.mViewFramebuffers[view].Save(viewFilename, 2.2f /*gamma*/);
+		}
 		config.mDebugImages.Output(name, extension);
 		config.mBeamDensity.Output(name, extension);
 
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2014, Petr Vevoda, Martin Sik (http://cgg.mff.cuni.cz/~sik/), 
+ * Tomas Davidovic (http://www.davidovic.cz), Iliyan Georgiev (http://www.iliyan.com/), 
+ * Jaroslav Krivanek (http://cgg.mff.cuni.cz/~jaroslav/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE
+ * OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * (The above is MIT License: http://en.wikipedia.origin/wiki/MIT_License)
+ */
+
+
+#ifndef __VECTOR8_HXX__
+#define __VECTOR8_HXX__
+
+#include <immintrin.h>
+
+#include "Rgb.hxx"
+
+//////////////////////////////////////////////////////////////////////////
+// Classes holding 8 positions, directions or colors in SoA layout (one Float8 per component).
+// They are used by batch kernels processing 8 elements at once, check Sse::cpuHasAvx() before using them.
+
+class Dir8;
+
+// 8 positions in 3D space.
+class Pos8 {
+public:
+    Float8 x, y, z;
+
+    INLINE Pos8() { }
+
+    INLINE Pos8(const Float8& x, const Float8& y, const Float8& z) : x(x), y(y), z(z) { }
+
+    // Initializes all 8 positions to the same position.
+    INLINE explicit Pos8(const Pos& pos) : x(pos.x()), y(pos.y()), z(pos.z()) { }
+
+    // Loads 8 positions from arrays of their components with any alignment.
+    INLINE Pos8(const float* xs, const float* ys, const float* zs)
+        : x(Float8::loadUnaligned(xs)), y(Float8::loadUnaligned(ys)), z(Float8::loadUnaligned(zs)) { }
+
+    INLINE Dir8 operator-(const Pos8& other) const;
+
+    INLINE Pos8 operator+(const Dir8& other) const;
+
+    INLINE Pos8 operator-(const Dir8& other) const;
+
+    // Squared distances to the other positions.
+    INLINE Float8 squareDistance(const Pos8& other) const {
+        const Float8 dx = x - other.x;
+        const Float8 dy = y - other.y;
+        const Float8 dz = z - other.z;
+        return dx * dx + dy * dy + dz * dz;
+    }
+};
+
+// 8 directions in 3D space.
+class Dir8 {
+public:
+    Float8 x, y, z;
+
+    INLINE Dir8() { }
+
+    INLINE Dir8(const Float8& x, const Float8& y, const Float8& z) : x(x), y(y), z(z) { }
+
+    // Initializes all 8 directions to the same direction.
+    INLINE explicit Dir8(const Dir& dir) : x(dir.x()), y(dir.y()), z(dir.z()) { }
+
+    // Loads 8 directions from arrays of their components with any alignment.
+    INLINE Dir8(const float* xs, const float* ys, const float* zs)
+        : x(Float8::loadUnaligned(xs)), y(Float8::loadUnaligned(ys)), z(Float8::loadUnaligned(zs)) { }
+
+    INLINE Dir8 operator+(const Dir8& other) const {
+        return Dir8(x + other.x, y + other.y, z + other.z);
+    }
+
+    INLINE Dir8 operator-(const Dir8& other) const {
+        return Dir8(x - other.x, y - other.y, z - other.z);
+    }
+
+    INLINE Dir8 operator*(const Float8& fact) const {
+        return Dir8(x * fact, y * fact, z * fact);
+    }
+
+    INLINE Dir8 operator*(const float fact) const {
+        return Dir8(x * fact, y * fact, z * fact);
+    }
+
+    INLINE Dir8 operator-() const {
+        return Dir8(-x, -y, -z);
+    }
+
+    INLINE Float8 dot(const Dir8& other) const {
+        return x * other.x + y * other.y + z * other.z;
+    }
+
+    INLINE Float8 square() const {
+        return dot(*this);
+    }
+
+    INLINE Float8 size() const {
+        return square().sqrt();
+    }
+
+    INLINE Dir8 cross(const Dir8& other) const {
+        return Dir8(
+            y * other.z - z * other.y,
+            z * other.x - x * other.z,
+            x * other.y - y * other.x);
+    }
+
+    INLINE Dir8 getNormalized() const {
+        return *this * square().invSqrt();
+    }
+
+    // Keeps directions with true mask elements, others are taken from the other directions.
+    INLINE Dir8 blend(const Bool8& mask, const Dir8& other) const {
+        return Dir8(mask.blend(x, other.x), mask.blend(y, other.y), mask.blend(z, other.z));
+    }
+};
+
+INLINE Dir8 Pos8::operator-(const Pos8& other) const {
+    return Dir8(x - other.x, y - other.y, z - other.z);
+}
+
+INLINE Pos8 Pos8::operator+(const Dir8& other) const {
+    return Pos8(x + other.x, y + other.y, z + other.z);
+}
+
+INLINE Pos8 Pos8::operator-(const Dir8& other) const {
+    return Pos8(x - other.x, y - other.y, z - other.z);
+}
+
+// 8 RGB colors.
+class Rgb8 {
+public:
+    Float8 r, g, b;
+
+    INLINE Rgb8() { }
+
+    INLINE Rgb8(const Float8& r, const Float8& g, const Float8& b) : r(r), g(g), b(b) { }
+
+    // Initializes all 8 colors to the same color.
+    INLINE explicit Rgb8(const Rgb& rgb) : r(rgb.r()), g(rgb.g()), b(rgb.b()) { }
+
+    INLINE Rgb8 operator+(const Rgb8& other) const {
+        return Rgb8(r + other.r, g + other.g, b + other.b);
+    }
+
+    INLINE Rgb8 operator*(const Rgb8& other) const {
+        return Rgb8(r * other.r, g * other.g, b * other.b);
+    }
+
+    INLINE Rgb8 operator*(const Float8& fact) const {
+        return Rgb8(r * fact, g * fact, b * fact);
+    }
+
+    // Keeps colors with true mask elements, others are set to black.
+    INLINE Rgb8 masked(const Bool8& mask) const {
+        const Float8 zero(0.f);
+        return Rgb8(mask.blend(r, zero), mask.blend(g, zero), mask.blend(b, zero));
+    }
+
+    // Same weights as Luminance(const Rgb&).
+    INLINE Float8 luminance() const {
+        return r * 0.212671f + g * 0.715160f + b * 0.072169f;
+    }
+
+    // Gets i-th color.
+    INLINE Rgb get(const int index) const {
+        return Rgb(r[index], g[index], b[index]);
+    }
+};
+
+#endif //__VECTOR8_HXX__
@@ -32,6 +32,7 @@ namespace embree
 	{
 		void*                 mLightVertices;           // type std::vector<UPBPLightVertex>*
 		void*                 mPathEnds;                // type std::vector<int>*
+		void*                 mPathVertexIndices;       // type std::vector<int>*, storage indices of light vertices in path order (NULL if stored in path order)
 		void*                 mCameraVerticesMisData;   // type MisData*		
 		const unsigned int    mCameraPathLength;
 		const unsigned int    mMinPathLength;
@@ -51,6 +52,11 @@ namespace embree
 		float                 mRaySampleRevPdf;
 		unsigned int          mRaySamplingFlags;
 		void				  *mDebugImages;			// Pointer to DebugImages class
+		void*                 mQueryTruncation;         // type QueryTruncation*, NULL if query traversal is not truncated
+		float                 mTruncationDist;          // Distance of the first roulette cut in the current segment
+		float                 mTruncationStep;          // Distance between subsequent roulette cuts
+		float                 mTruncationInvProb;       // Inverse survival probability of a cut
+		void*                 mEstimatorTuner;          // type EstimatorTuner*, NULL if all techniques are used in all media
 
 		AdditionalRayDataForMis(
 			void*                 aLightVertices,
@@ -76,6 +82,7 @@ namespace embree
 			void				  *aDebugImages = 0) :
 			mLightVertices(aLightVertices),
 			mPathEnds(aPathEnds),
+			mPathVertexIndices(0),
 			mCameraVerticesMisData(aCameraVerticesMisData),				
 			mCameraPathLength(aCameraPathLength),
 			mMinPathLength(aMinPathLength),
@@ -94,8 +101,20 @@ namespace embree
 			mRaySamplePdf(aRaySamplePdf),
 			mRaySampleRevPdf(aRaySampleRevPdf),
 			mRaySamplingFlags(aRaySamplingFlags),
-			mDebugImages(aDebugImages)
+			mDebugImages(aDebugImages),
+			mQueryTruncation(0),
+			mTruncationDist(inf),
+			mTruncationStep(inf),
+			mTruncationInvProb(1),
+			mEstimatorTuner(0)
 		{}
+
+		/*! Weight of a hit at the given distance caused by the roulette cuts survived before it. */
+		__forceinline float truncationWeight(const float aDist) const
+		{
+			if (aDist < mTruncationDist) return 1.0f;
+			return powf(mTruncationInvProb, floorf((aDist - mTruncationDist) / mTruncationStep) + 1.0f);
+		}
 	};
 	
 	/*! Ray structure. Contains all information about a ray including